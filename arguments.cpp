@@ -1,3 +1,4 @@
+#include <cstdio> //sscanf
 #include <stdexcept>
 
 #include "opencv2/highgui/highgui.hpp" //CV_FOURCC
@@ -41,6 +42,44 @@ void Arguments::reset() {
     full_dp = false;
     start_frame = 0;
     end_frame = 0;
+    engine = "sgbm";
+    texture_threshold = 10;
+    pre_filter_size = 9;
+    benchmark = 0;
+    max_memory = 0;
+    match_scale = 1.0;
+    calibration_filename = "";
+    layout = "auto";
+    right_filename = "";
+    luma = false;
+    both_eyes = false;
+    cross_check = -1;
+    batch_filename = "";
+    jobs = 0;
+    priority = 0;
+    stream_size = "";
+    stream_format = "bgr24";
+    stream_output_format = "gray";
+    live_source = "";
+    latency = 100;
+    temporal = 0;
+    post_filter = 0;
+    confidence_filename = "";
+    points_filename = "";
+    points_format = "ply";
+    trace_filename = "";
+    self_test_directory = "";
+    perf_tolerance = 20;
+    auto_range = false;
+    roi = "";
+    output_size = "";
+    fan_outs = "";
+    numa = "off";
+    cache_directory = "";
+    cache_size = 4096;
+    raw_size = "";
+    record_references = false;
+    batch_memory = 0;
     g_args_mutex.unlock();
 }
 
@@ -70,6 +109,7 @@ bool Arguments::is_valid(const Arg &arg, bool correct) {
      rules:
      *) verbose and full_dp are boolean and independent - so no validation
      *) if nogui is set, filenames have to be set because pipes aren't handled yet.
+     *) ... except the input filename in batch mode, where each job sets its own, in stream mode (stdin) and in live mode
      *) if nogui is not set, filenames are optional
      *) num_disparities has to be a multiple of 16 and >=0
      *) min_disparity >= 0
@@ -80,6 +120,29 @@ bool Arguments::is_valid(const Arg &arg, bool correct) {
      *) uniquness should be >=0
      *) speckle_window_size >=0
      *) speckle_range >=0
+     *) engine must be one of "sgbm", "bm" or "census"
+     *) benchmark >=0
+     *) max_memory >=0 (0 is unlimited)
+     *) match_scale within (0, 1]
+     *) texture_threshold >=0
+     *) pre_filter_size must be odd and within [5, 255]
+     *) layout must be one of "auto", "sbs", "half-sbs", "tb", "half-tb" or "separate"
+     *) a "separate" layout needs right_filename
+     *) jobs must be >= 0
+     *) stream_size must be empty or WIDTHxHEIGHT with both > 0
+     *) stream_format must be one of "gray", "bgr24", "rgb24" or "yuv420p", and not "yuv420p" when streaming
+     *) stream_output_format must be one of "gray" or "gray16le"
+     *) latency > 0 (milliseconds)
+     *) temporal must be within [0, 16] (frames)
+     *) post_filter must be within [0, 64] (pixels)
+     *) points_format must be one of "ply" or "float"
+     *) perf_tolerance must be within [0, 100] (percent)
+     *) roi must be empty or WIDTHxHEIGHT+X+Y with width and height > 0 and x, y >= 0
+     *) output_size must be empty or WIDTHxHEIGHT with both > 0
+     *) numa must be "off", "auto" or a node number >= 0
+     *) cache_size >= 0 (MB, 0 for unlimited)
+     *) raw_size must be empty or WIDTHxHEIGHT with both > 0
+     *) batch_memory >=0 (0 is unlimited)
     */
 
     bool valid = true;
@@ -97,10 +160,26 @@ bool Arguments::is_valid(const Arg &arg, bool correct) {
         case VERBOSE:
         case FULL_DP:
         case OUTPUT_FOURCC:
+        case CALIBRATION_FILENAME:
+        case LUMA:
+        case BOTH_EYES:
+        case CROSS_CHECK:
+        case BATCH_FILENAME:
+        case PRIORITY:
+        case LIVE_SOURCE:
+        case CONFIDENCE_FILENAME:
+        case POINTS_FILENAME:
+        case TRACE_FILENAME:
+        case SELF_TEST_DIRECTORY:
+        case AUTO_RANGE:
+        case FAN_OUTS:
+        case CACHE_DIRECTORY:
+        case RECORD_REFERENCES:
             break;
         case NOGUI:
             if (nogui) {
-                if (input_filename.empty()) {
+                //in batch mode every job brings its own input file, stream and live modes have their own sources, self-tests make theirs
+                if (input_filename.empty() && batch_filename.empty() && stream_size.empty() && live_source.empty() && self_test_directory.empty()) {
                     //can't correct this without using stdin/stdout
                     valid = false;
                 }
@@ -128,7 +207,7 @@ bool Arguments::is_valid(const Arg &arg, bool correct) {
             break;
         case INPUT_FILENAME:
             if (nogui) {
-                if (input_filename.empty()) {
+                if (input_filename.empty() && batch_filename.empty() && stream_size.empty() && live_source.empty() && self_test_directory.empty()) {
                     //can't correct this without using stdin/stdout
                     valid = false;
                 }
@@ -189,6 +268,191 @@ bool Arguments::is_valid(const Arg &arg, bool correct) {
                 geq(end_frame, start_frame);
             }
             break;
+        case ENGINE:
+            if (engine != "sgbm" && engine != "bm" && engine != "census") {
+                if (correct) {
+                    engine = "sgbm";
+                } else {
+                    valid = false;
+                }
+            }
+            break;
+        case BENCHMARK:
+            geq(benchmark, 0);
+            break;
+        case MAX_MEMORY:
+            geq(max_memory, 0);
+            break;
+        case MATCH_SCALE:
+            if (!(match_scale > 0.0 && match_scale <= 1.0)) {
+                if (correct) {
+                    match_scale = 1.0;
+                } else {
+                    valid = false;
+                }
+            }
+            break;
+        case TEXTURE_THRESHOLD:
+            geq(texture_threshold, 0);
+            break;
+        case PRE_FILTER_SIZE:
+            if (!((pre_filter_size % 2) && (pre_filter_size >= 5) && (pre_filter_size <= 255))) {
+                if (correct) {
+                    pre_filter_size = std::min(std::max(5, pre_filter_size % 2 ? pre_filter_size : pre_filter_size + 1), 255);
+                } else {
+                    valid = false;
+                }
+            }
+            break;
+        case LAYOUT:
+            if (layout != "auto" && layout != "sbs" && layout != "half-sbs" && layout != "tb" && layout != "half-tb" && layout != "separate") {
+                if (correct) {
+                    layout = "auto";
+                } else {
+                    valid = false;
+                }
+            }
+            break;
+        case RIGHT_FILENAME:
+            if (layout == "separate" && right_filename.empty()) {
+                //can't guess the second file
+                valid = false;
+            }
+            break;
+        case JOBS:
+            geq(jobs, 0);
+            break;
+        case STREAM_SIZE:
+            if (!stream_size.empty()) {
+                int width = 0, height = 0;
+                char end = 0;
+                if (std::sscanf(stream_size.c_str(), "%dx%d%c", &width, &height, &end) != 2 || width <= 0 || height <= 0) {
+                    //can't guess the frame size
+                    valid = false;
+                }
+            }
+            break;
+        case STREAM_FORMAT:
+            if (stream_format != "gray" && stream_format != "bgr24" && stream_format != "rgb24" && stream_format != "yuv420p") {
+                if (correct) {
+                    stream_format = "bgr24";
+                } else {
+                    valid = false;
+                }
+            }
+            //only mapped --raw-size files can be read as yuv420p, a guessed format would garble the stream
+            if (stream_format == "yuv420p" && !stream_size.empty()) {
+                valid = false;
+            }
+            break;
+        case STREAM_OUTPUT_FORMAT:
+            if (stream_output_format != "gray" && stream_output_format != "gray16le") {
+                if (correct) {
+                    stream_output_format = "gray";
+                } else {
+                    valid = false;
+                }
+            }
+            break;
+        case LATENCY:
+            if (latency <= 0) {
+                if (correct) {
+                    latency = 100;
+                } else {
+                    valid = false;
+                }
+            }
+            break;
+        case TEMPORAL:
+            if (temporal < 0 || temporal > 16) {
+                if (correct) {
+                    temporal = std::min(std::max(temporal, 0), 16);
+                } else {
+                    valid = false;
+                }
+            }
+            break;
+        case POST_FILTER:
+            if (post_filter < 0 || post_filter > 64) {
+                if (correct) {
+                    post_filter = std::min(std::max(post_filter, 0), 64);
+                } else {
+                    valid = false;
+                }
+            }
+            break;
+        case POINTS_FORMAT:
+            if (points_format != "ply" && points_format != "float") {
+                if (correct) {
+                    points_format = "ply";
+                } else {
+                    valid = false;
+                }
+            }
+            break;
+        case PERF_TOLERANCE:
+            if (perf_tolerance < 0 || perf_tolerance > 100) {
+                if (correct) {
+                    perf_tolerance = std::min(std::max(perf_tolerance, 0), 100);
+                } else {
+                    valid = false;
+                }
+            }
+            break;
+        case ROI:
+            if (!roi.empty()) {
+                int width = 0, height = 0, x = -1, y = -1;
+                char end = 0;
+                if (std::sscanf(roi.c_str(), "%dx%d+%d+%d%c", &width, &height, &x, &y, &end) != 4
+                        || width <= 0 || height <= 0 || x < 0 || y < 0) {
+                    if (correct) {
+                        //process the whole frame
+                        roi = "";
+                    } else {
+                        valid = false;
+                    }
+                }
+            }
+            break;
+        case OUTPUT_SIZE:
+            if (!output_size.empty()) {
+                int width = 0, height = 0;
+                char end = 0;
+                if (std::sscanf(output_size.c_str(), "%dx%d%c", &width, &height, &end) != 2 || width <= 0 || height <= 0) {
+                    if (correct) {
+                        //write at the natural output size
+                        output_size = "";
+                    } else {
+                        valid = false;
+                    }
+                }
+            }
+            break;
+        case NUMA:
+            if (numa != "off" && numa != "auto" && (numa.empty() || numa.find_first_not_of("0123456789") != std::string::npos)) {
+                if (correct) {
+                    numa = "off";
+                } else {
+                    valid = false;
+                }
+            }
+            break;
+        case CACHE_SIZE:
+            geq(cache_size, 0);
+            break;
+        case RAW_SIZE:
+            if (!raw_size.empty()) {
+                int width = 0, height = 0;
+                char end = 0;
+                if (std::sscanf(raw_size.c_str(), "%dx%d%c", &width, &height, &end) != 2 || width <= 0 || height <= 0) {
+                    //can't guess the frame size
+                    valid = false;
+                }
+            }
+            break;
+        case BATCH_MEMORY:
+            geq(batch_memory, 0);
+            break;
         default:
             throw std::range_error("Error: Unknown variable index");
     }
@@ -31,10 +31,48 @@ class Arguments
             SPECKLE_RANGE,
             FULL_DP,
             START_FRAME,
-            END_FRAME
+            END_FRAME,
+            ENGINE,
+            TEXTURE_THRESHOLD,
+            PRE_FILTER_SIZE,
+            BENCHMARK,
+            MAX_MEMORY,
+            MATCH_SCALE,
+            CALIBRATION_FILENAME,
+            LAYOUT,
+            RIGHT_FILENAME,
+            LUMA,
+            BOTH_EYES,
+            CROSS_CHECK,
+            BATCH_FILENAME,
+            JOBS,
+            PRIORITY,
+            STREAM_SIZE,
+            STREAM_FORMAT,
+            STREAM_OUTPUT_FORMAT,
+            LIVE_SOURCE,
+            LATENCY,
+            TEMPORAL,
+            POST_FILTER,
+            CONFIDENCE_FILENAME,
+            POINTS_FILENAME,
+            POINTS_FORMAT,
+            TRACE_FILENAME,
+            SELF_TEST_DIRECTORY,
+            PERF_TOLERANCE,
+            AUTO_RANGE,
+            ROI,
+            OUTPUT_SIZE,
+            FAN_OUTS,
+            NUMA,
+            CACHE_DIRECTORY,
+            CACHE_SIZE,
+            RAW_SIZE,
+            RECORD_REFERENCES,
+            BATCH_MEMORY
         };
 
-        const Arg arg_list[18] = {VERBOSE,
+        const Arg arg_list[56] = {VERBOSE,
                                   NOGUI,
                                   OUTPUT_FOURCC,
                                   INPUT_FILENAME,
@@ -51,7 +89,45 @@ class Arguments
                                   SPECKLE_RANGE,
                                   FULL_DP,
                                   START_FRAME,
-                                  END_FRAME};
+                                  END_FRAME,
+                                  ENGINE,
+                                  TEXTURE_THRESHOLD,
+                                  PRE_FILTER_SIZE,
+                                  BENCHMARK,
+                                  MAX_MEMORY,
+                                  MATCH_SCALE,
+                                  CALIBRATION_FILENAME,
+                                  LAYOUT,
+                                  RIGHT_FILENAME,
+                                  LUMA,
+                                  BOTH_EYES,
+                                  CROSS_CHECK,
+                                  BATCH_FILENAME,
+                                  JOBS,
+                                  PRIORITY,
+                                  STREAM_SIZE,
+                                  STREAM_FORMAT,
+                                  STREAM_OUTPUT_FORMAT,
+                                  LIVE_SOURCE,
+                                  LATENCY,
+                                  TEMPORAL,
+                                  POST_FILTER,
+                                  CONFIDENCE_FILENAME,
+                                  POINTS_FILENAME,
+                                  POINTS_FORMAT,
+                                  TRACE_FILENAME,
+                                  SELF_TEST_DIRECTORY,
+                                  PERF_TOLERANCE,
+                                  AUTO_RANGE,
+                                  ROI,
+                                  OUTPUT_SIZE,
+                                  FAN_OUTS,
+                                  NUMA,
+                                  CACHE_DIRECTORY,
+                                  CACHE_SIZE,
+                                  RAW_SIZE,
+                                  RECORD_REFERENCES,
+                                  BATCH_MEMORY};
 
         void reset();
         bool is_valid(bool correct = false);
@@ -122,6 +198,120 @@ class Arguments
                 case END_FRAME:
                     try_set<int, Val>(end_frame, value);
                     break;
+                case ENGINE:
+                    try_set<std::string, Val>(engine, value);
+                    break;
+                case TEXTURE_THRESHOLD:
+                    try_set<int, Val>(texture_threshold, value);
+                    break;
+                case PRE_FILTER_SIZE:
+                    try_set<int, Val>(pre_filter_size, value);
+                    break;
+                case BENCHMARK:
+                    try_set<int, Val>(benchmark, value);
+                    break;
+                case MAX_MEMORY:
+                    try_set<int, Val>(max_memory, value);
+                    break;
+                case MATCH_SCALE:
+                    try_set<double, Val>(match_scale, value);
+                    break;
+                case CALIBRATION_FILENAME:
+                    try_set<std::string, Val>(calibration_filename, value);
+                    break;
+                case LAYOUT:
+                    try_set<std::string, Val>(layout, value);
+                    break;
+                case RIGHT_FILENAME:
+                    try_set<std::string, Val>(right_filename, value);
+                    break;
+                case LUMA:
+                    try_set<bool, Val>(luma, value);
+                    break;
+                case BOTH_EYES:
+                    try_set<bool, Val>(both_eyes, value);
+                    break;
+                case CROSS_CHECK:
+                    try_set<int, Val>(cross_check, value);
+                    break;
+                case BATCH_FILENAME:
+                    try_set<std::string, Val>(batch_filename, value);
+                    break;
+                case JOBS:
+                    try_set<int, Val>(jobs, value);
+                    break;
+                case PRIORITY:
+                    try_set<int, Val>(priority, value);
+                    break;
+                case STREAM_SIZE:
+                    try_set<std::string, Val>(stream_size, value);
+                    break;
+                case STREAM_FORMAT:
+                    try_set<std::string, Val>(stream_format, value);
+                    break;
+                case STREAM_OUTPUT_FORMAT:
+                    try_set<std::string, Val>(stream_output_format, value);
+                    break;
+                case LIVE_SOURCE:
+                    try_set<std::string, Val>(live_source, value);
+                    break;
+                case LATENCY:
+                    try_set<int, Val>(latency, value);
+                    break;
+                case TEMPORAL:
+                    try_set<int, Val>(temporal, value);
+                    break;
+                case POST_FILTER:
+                    try_set<int, Val>(post_filter, value);
+                    break;
+                case CONFIDENCE_FILENAME:
+                    try_set<std::string, Val>(confidence_filename, value);
+                    break;
+                case POINTS_FILENAME:
+                    try_set<std::string, Val>(points_filename, value);
+                    break;
+                case POINTS_FORMAT:
+                    try_set<std::string, Val>(points_format, value);
+                    break;
+                case TRACE_FILENAME:
+                    try_set<std::string, Val>(trace_filename, value);
+                    break;
+                case SELF_TEST_DIRECTORY:
+                    try_set<std::string, Val>(self_test_directory, value);
+                    break;
+                case PERF_TOLERANCE:
+                    try_set<int, Val>(perf_tolerance, value);
+                    break;
+                case AUTO_RANGE:
+                    try_set<bool, Val>(auto_range, value);
+                    break;
+                case ROI:
+                    try_set<std::string, Val>(roi, value);
+                    break;
+                case OUTPUT_SIZE:
+                    try_set<std::string, Val>(output_size, value);
+                    break;
+                case FAN_OUTS:
+                    try_set<std::string, Val>(fan_outs, value);
+                    break;
+                case NUMA:
+                    try_set<std::string, Val>(numa, value);
+                    break;
+                case CACHE_DIRECTORY:
+                    try_set<std::string, Val>(cache_directory, value);
+                    break;
+                case CACHE_SIZE:
+                    try_set<int, Val>(cache_size, value);
+                    break;
+                case RAW_SIZE:
+                    try_set<std::string, Val>(raw_size, value);
+                    break;
+                case RECORD_REFERENCES:
+                    try_set<bool, Val>(record_references, value);
+                    break;
+                case BATCH_MEMORY:
+                    try_set<int, Val>(batch_memory, value);
+                    break;
                 default:
                     throw std::range_error("Error: unknown key");
                     break;
@@ -188,6 +378,120 @@ class Arguments
                 case END_FRAME:
                     try_set<T, int>(retval, end_frame);
                     break;
+                case ENGINE:
+                    try_set<T, std::string>(retval, engine);
+                    break;
+                case TEXTURE_THRESHOLD:
+                    try_set<T, int>(retval, texture_threshold);
+                    break;
+                case PRE_FILTER_SIZE:
+                    try_set<T, int>(retval, pre_filter_size);
+                    break;
+                case BENCHMARK:
+                    try_set<T, int>(retval, benchmark);
+                    break;
+                case MAX_MEMORY:
+                    try_set<T, int>(retval, max_memory);
+                    break;
+                case MATCH_SCALE:
+                    try_set<T, double>(retval, match_scale);
+                    break;
+                case CALIBRATION_FILENAME:
+                    try_set<T, std::string>(retval, calibration_filename);
+                    break;
+                case LAYOUT:
+                    try_set<T, std::string>(retval, layout);
+                    break;
+                case RIGHT_FILENAME:
+                    try_set<T, std::string>(retval, right_filename);
+                    break;
+                case LUMA:
+                    try_set<T, bool>(retval, luma);
+                    break;
+                case BOTH_EYES:
+                    try_set<T, bool>(retval, both_eyes);
+                    break;
+                case CROSS_CHECK:
+                    try_set<T, int>(retval, cross_check);
+                    break;
+                case BATCH_FILENAME:
+                    try_set<T, std::string>(retval, batch_filename);
+                    break;
+                case JOBS:
+                    try_set<T, int>(retval, jobs);
+                    break;
+                case PRIORITY:
+                    try_set<T, int>(retval, priority);
+                    break;
+                case STREAM_SIZE:
+                    try_set<T, std::string>(retval, stream_size);
+                    break;
+                case STREAM_FORMAT:
+                    try_set<T, std::string>(retval, stream_format);
+                    break;
+                case STREAM_OUTPUT_FORMAT:
+                    try_set<T, std::string>(retval, stream_output_format);
+                    break;
+                case LIVE_SOURCE:
+                    try_set<T, std::string>(retval, live_source);
+                    break;
+                case LATENCY:
+                    try_set<T, int>(retval, latency);
+                    break;
+                case TEMPORAL:
+                    try_set<T, int>(retval, temporal);
+                    break;
+                case POST_FILTER:
+                    try_set<T, int>(retval, post_filter);
+                    break;
+                case CONFIDENCE_FILENAME:
+                    try_set<T, std::string>(retval, confidence_filename);
+                    break;
+                case POINTS_FILENAME:
+                    try_set<T, std::string>(retval, points_filename);
+                    break;
+                case POINTS_FORMAT:
+                    try_set<T, std::string>(retval, points_format);
+                    break;
+                case TRACE_FILENAME:
+                    try_set<T, std::string>(retval, trace_filename);
+                    break;
+                case SELF_TEST_DIRECTORY:
+                    try_set<T, std::string>(retval, self_test_directory);
+                    break;
+                case PERF_TOLERANCE:
+                    try_set<T, int>(retval, perf_tolerance);
+                    break;
+                case AUTO_RANGE:
+                    try_set<T, bool>(retval, auto_range);
+                    break;
+                case ROI:
+                    try_set<T, std::string>(retval, roi);
+                    break;
+                case OUTPUT_SIZE:
+                    try_set<T, std::string>(retval, output_size);
+                    break;
+                case FAN_OUTS:
+                    try_set<T, std::string>(retval, fan_outs);
+                    break;
+                case NUMA:
+                    try_set<T, std::string>(retval, numa);
+                    break;
+                case CACHE_DIRECTORY:
+                    try_set<T, std::string>(retval, cache_directory);
+                    break;
+                case CACHE_SIZE:
+                    try_set<T, int>(retval, cache_size);
+                    break;
+                case RAW_SIZE:
+                    try_set<T, std::string>(retval, raw_size);
+                    break;
+                case RECORD_REFERENCES:
+                    try_set<T, bool>(retval, record_references);
+                    break;
+                case BATCH_MEMORY:
+                    try_set<T, int>(retval, batch_memory);
+                    break;
                 default:
                     throw std::range_error("Error: unknown key");
                     break;
@@ -251,6 +555,44 @@ class Arguments
         bool full_dp;
         int start_frame;
         int end_frame;
+        std::string engine;
+        int texture_threshold;
+        int pre_filter_size;
+        int benchmark;
+        int max_memory;
+        double match_scale;
+        std::string calibration_filename;
+        std::string layout;
+        std::string right_filename;
+        bool luma;
+        bool both_eyes;
+        int cross_check;
+        std::string batch_filename;
+        int jobs;
+        int priority;
+        std::string stream_size;
+        std::string stream_format;
+        std::string stream_output_format;
+        std::string live_source;
+        int latency;
+        int temporal;
+        int post_filter;
+        std::string confidence_filename;
+        std::string points_filename;
+        std::string points_format;
+        std::string trace_filename;
+        std::string self_test_directory;
+        int perf_tolerance;
+        bool auto_range;
+        std::string roi;
+        std::string output_size;
+        std::string fan_outs;
+        std::string numa;
+        std::string cache_directory;
+        int cache_size;
+        std::string raw_size;
+        bool record_references;
+        int batch_memory;
 };
 
 
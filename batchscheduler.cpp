@@ -0,0 +1,351 @@
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "opencv2/highgui/highgui.hpp" //VideoCapture
+
+#include "batchscheduler.h"
+#include "numaplacement.h"
+#include "processor.h"
+#include "rangeestimator.h"
+#include "tracer.h"
+
+namespace {
+
+/**
+ * Does nothing, in parallel: running it makes OpenCV start its thread pool.
+ */
+class StartPoolBody : public cv::ParallelLoopBody
+{
+public:
+    void operator()(const cv::Range&) const {
+    }
+};
+
+}
+
+/**
+ * Constructor for a job that hasn't been looked at yet.
+ * @param arguments The job's settings.
+ * @param index Position of the job in the manifest, 1-indexed.
+ */
+BatchScheduler::Job::Job(const Arguments& arguments, size_t index)
+    : arguments(arguments), index(index), state(PENDING), probed(false), memory(0), start_frame(0), end_frame(0), frames(0), seconds(0), peak_memory(0)
+{
+    priority = this->arguments.get_value<int>(Arguments::PRIORITY);
+}
+
+/**
+ * Constructor.
+ * @param workers How many jobs may run at once, 0 for a quarter of the hardware threads (at least one).
+ * @param memory_budget Matcher memory all running jobs may use together, in bytes. 0 for unlimited.
+ * @param numa_node Where to pin the workers: NumaPlacement::OFF, AUTO to spread them over the nodes, or a node.
+ * @param report The stream progress and statistics are written to.
+ */
+BatchScheduler::BatchScheduler(size_t workers, size_t memory_budget, int numa_node, std::ostream& report)
+    : workers(workers), numa_node(numa_node), memory_budget(memory_budget), memory_in_use(0), report(report)
+{
+    if (this->workers == 0) {
+        this->workers = std::max(1u, std::thread::hardware_concurrency() / 4);
+    }
+}
+
+/**
+ * Queue a job. Jobs can only be added before run().
+ * @param job_arguments The job's settings, including its input and output files.
+ */
+void BatchScheduler::add(const Arguments& job_arguments) {
+    jobs.push_back(Job(job_arguments, jobs.size() + 1));
+}
+
+/**
+ * Check every job's input, then probe and process them all and print the per-job statistics.
+ * @return True if every job succeeded.
+ */
+bool BatchScheduler::run() {
+    report << "Batch of " << jobs.size() << " jobs, " << workers << " at a time";
+    if (memory_budget > 0) {
+        report << ", within " << memory_budget / (1024 * 1024) << " MB";
+    }
+    report << std::endl;
+
+    //probing can already run parallel code, so the pool has to be placed before it
+    if (numa_node != NumaPlacement::OFF) {
+        std::thread starter(&BatchScheduler::start_pool, this);
+        starter.join();
+    }
+
+    for (Job& job : jobs) {
+        check_input(job);
+    }
+
+    std::vector<std::thread> pool;
+    for (size_t worker = 0; worker < std::min(workers, jobs.size()); ++worker) {
+        pool.push_back(std::thread(&BatchScheduler::work, this, worker));
+    }
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+
+    print_summary();
+
+    for (const Job& job : jobs) {
+        if (job.state != DONE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Check that a job's input opens, so a missing or unreadable file fails before anything runs. Nothing is decoded or indexed.
+ * @param job The job to check.
+ */
+void BatchScheduler::check_input(Job& job) {
+    std::string input_filename = job.arguments.get_value<std::string>(Arguments::INPUT_FILENAME);
+    MappedCapture feed_src(job.arguments, input_filename);
+    if (!feed_src.isOpened()) {
+        job.state = FAILED;
+        job.error = "Input file [" + input_filename + "] cannot be opened for reading";
+    }
+}
+
+/**
+ * Open a job's input to estimate its memory use and resolve its frame range. Called by the worker that picked the job,
+ * without the mutex held; a job that can't be set up fails here. An end frame of 0 means the end of the clip.
+ * @param job The job to probe, in the PROBING state.
+ */
+void BatchScheduler::probe(Job& job) {
+    try {
+        std::string input_filename = job.arguments.get_value<std::string>(Arguments::INPUT_FILENAME);
+        MappedCapture feed_src(job.arguments, input_filename);
+        if (!feed_src.isOpened()) {
+            throw std::runtime_error("Input file [" + input_filename + "] cannot be opened for reading");
+        }
+        Processor processor(job.arguments, feed_src);
+        //the range changes the memory the job needs, so it's settled first
+        if (job.arguments.get_value<bool>(Arguments::AUTO_RANGE)) {
+            std::ostringstream range_report;
+            RangeEstimator(job.arguments, processor.get_layout(), range_report).estimate();
+            std::lock_guard<std::mutex> lock(mutex);
+            report << "[job " << job.index << "] " << range_report.str();
+        }
+        job.memory = processor.memory_estimate();
+
+        job.start_frame = job.arguments.get_value<int>(Arguments::START_FRAME);
+        job.end_frame = job.arguments.get_value<int>(Arguments::END_FRAME);
+        if (job.end_frame == 0) {
+            size_t frame_count = processor.get_frame_count();
+            job.end_frame = frame_count > 0 ? frame_count - 1 : 0;
+        }
+    } catch (std::exception& e) {
+        job.state = FAILED;
+        job.error = e.what();
+    }
+}
+
+/**
+ * Start OpenCV's thread pool from a thread bound to the CPUs of the workers' nodes. Threads inherit their creator's
+ * affinity, so the pool stays on those nodes instead of floating over the whole machine, or landing inside whichever
+ * worker's node gets to it first. The workers' own stages (decode, the right eye, encode) take a CPU each, so the pool
+ * leaves them room.
+ */
+void BatchScheduler::start_pool() {
+    std::vector<std::vector<int> > nodes = NumaPlacement::get_nodes();
+    std::vector<bool> used(nodes.size(), false);
+    for (size_t worker = 0; worker < std::min(workers, jobs.size()); ++worker) {
+        int node = worker_node(worker);
+        if (node >= 0 && node < (int)nodes.size()) {
+            used[node] = true;
+        }
+    }
+    std::vector<int> cpus;
+    for (size_t node = 0; node < nodes.size(); ++node) {
+        if (used[node]) {
+            cpus.insert(cpus.end(), nodes[node].begin(), nodes[node].end());
+        }
+    }
+    int available = (int)cpus.size();
+    if (!NumaPlacement::pin_thread(cpus)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        report << "OpenCV's thread pool cannot be pinned, it runs on every CPU" << std::endl;
+        available = (int)std::thread::hardware_concurrency();
+    }
+
+    int threads = std::max(1, available - (int)workers);
+    cv::setNumThreads(threads);
+    cv::parallel_for_(cv::Range(0, threads), StartPoolBody());
+}
+
+/**
+ * @param worker The worker's number, from 0.
+ * @return The NUMA node the worker is pinned to: the --numa node, or with AUTO, the nodes that have CPUs in turn.
+ */
+int BatchScheduler::worker_node(size_t worker) const {
+    if (numa_node != NumaPlacement::AUTO) {
+        return numa_node;
+    }
+    std::vector<std::vector<int> > nodes = NumaPlacement::get_nodes();
+    std::vector<int> cpu_nodes;
+    for (size_t index = 0; index < nodes.size(); ++index) {
+        if (!nodes[index].empty()) {
+            cpu_nodes.push_back((int)index);
+        }
+    }
+    return cpu_nodes.empty() ? 0 : cpu_nodes[worker % cpu_nodes.size()];
+}
+
+/**
+ * Worker loop: keep taking the next admissible job until none are left.
+ * @param worker The worker's number, from 0, which picks its node when the workers are spread.
+ */
+void BatchScheduler::work(size_t worker) {
+    Tracer::name_thread("batch worker");
+    if (numa_node != NumaPlacement::OFF) {
+        int node = worker_node(worker);
+        bool pinned = NumaPlacement::pin_thread(node);
+        std::lock_guard<std::mutex> lock(mutex);
+        report << "[worker " << worker + 1 << "] " << (pinned ? "pinned to " : "cannot be pinned to ") << NumaPlacement::describe(node) << std::endl;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        bool pending = false;
+        for (const Job& job : jobs) {
+            pending = pending || job.state == PENDING || job.state == PROBING;
+        }
+        if (!pending) {
+            break;
+        }
+
+        Job* job = admit();
+        if (!job) {
+            //wait for a running job to release its memory, or for another worker to finish probing
+            TraceSpan span("admission wait");
+            changed.wait(lock);
+            continue;
+        }
+
+        //a job's memory is only known once it has been probed, which this worker does before it competes for admission
+        if (!job->probed) {
+            job->state = PROBING;
+            lock.unlock();
+            {
+                TraceSpan span("probe");
+                probe(*job);
+            }
+            lock.lock();
+            job->probed = true;
+            if (job->state == PROBING) {
+                job->state = PENDING;
+            } else {
+                report << "[job " << job->index << "] failed: " << job->error << std::endl;
+            }
+            changed.notify_all();
+            continue;
+        }
+
+        job->state = RUNNING;
+        memory_in_use += job->memory;
+        report << "[job " << job->index << "] started, ~" << job->memory / (1024 * 1024) << " MB" << std::endl;
+
+        lock.unlock();
+        process(*job);
+        lock.lock();
+
+        memory_in_use -= job->memory;
+        changed.notify_all();
+    }
+}
+
+/**
+ * Pick the job to run next: the pending job with the highest priority, earliest in the manifest on ties.
+ * A job that hasn't been probed yet is returned straight away, to be probed. A probed one is only admitted if it fits next
+ * to the running jobs, or if nothing is running (so oversized jobs still run, alone).
+ * Must be called with the mutex held.
+ * @return The job to run, or null if it has to wait for memory.
+ */
+BatchScheduler::Job* BatchScheduler::admit() {
+    Job* next = 0;
+    for (Job& job : jobs) {
+        if (job.state == PENDING && (!next || job.priority > next->priority)) {
+            next = &job;
+        }
+    }
+    if (next && next->probed && memory_budget > 0 && memory_in_use > 0 && memory_in_use + next->memory > memory_budget) {
+        return 0;
+    }
+    return next;
+}
+
+/**
+ * Process one job's frame range, reporting progress every 10%.
+ * @param job The job to run.
+ */
+void BatchScheduler::process(Job& job) {
+    State state = DONE;
+    std::string error;
+    double start = (double)cv::getTickCount();
+    size_t peak_memory = 0;
+    size_t frames = 0;
+
+    try {
+        std::string input_filename = job.arguments.get_value<std::string>(Arguments::INPUT_FILENAME);
+        MappedCapture feed_src(job.arguments, input_filename);
+        if (!feed_src.isOpened()) {
+            throw std::runtime_error("Input file [" + input_filename + "] cannot be opened for reading");
+        }
+        Processor processor(job.arguments, feed_src);
+        std::shared_ptr<cv::VideoWriter> output = processor.create_writer();
+        if (!output->isOpened()) {
+            throw std::runtime_error("Output file [" + job.arguments.get_value<std::string>(Arguments::OUTPUT_FILENAME) + "] cannot be opened for writing");
+        }
+
+        size_t range = job.end_frame + 1 - job.start_frame;
+        size_t next_report = 1;
+        processor.set_next_frame(job.start_frame);
+        for (size_t index = job.start_frame; index <= job.end_frame; ++index) {
+            std::shared_ptr<cv::Mat> output_frame = processor.process_next_frame();
+            if (output_frame->empty()) {
+                break;
+            }
+            *output << *output_frame;
+            ++frames;
+
+            if (10 * frames >= next_report * range) {
+                std::lock_guard<std::mutex> lock(mutex);
+                job.frames = frames;
+                report << "[job " << job.index << "] " << frames << " of " << range << " [" << 100 * frames / range << "%]" << std::endl;
+                next_report = 10 * frames / range + 1;
+            }
+        }
+        peak_memory = processor.get_peak_memory();
+    } catch (std::exception& e) {
+        state = FAILED;
+        error = e.what();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    job.state = state;
+    job.error = error;
+    job.frames = frames;
+    job.peak_memory = peak_memory;
+    job.seconds = ((double)cv::getTickCount() - start) / cv::getTickFrequency();
+    report << "[job " << job.index << "] " << (state == DONE ? "done" : "failed: " + error) << std::endl;
+}
+
+/**
+ * Write one line of statistics per job.
+ */
+void BatchScheduler::print_summary() {
+    report << "Batch summary:" << std::endl;
+    for (const Job& job : jobs) {
+        report << "[job " << job.index << "] " << job.arguments.get_value<std::string>(Arguments::INPUT_FILENAME) << ":\t";
+        if (job.state == DONE) {
+            report << job.frames << " frames\t" << job.seconds << " s\t" << (job.seconds > 0 ? job.frames / job.seconds : 0) << " fps\t"
+                   << "peak " << job.peak_memory / (1024 * 1024) << " MB (estimated " << job.memory / (1024 * 1024) << " MB)";
+        } else {
+            report << "FAILED\t" << job.error;
+        }
+        report << std::endl;
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef BATCHSCHEDULER_H
+#define BATCHSCHEDULER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "arguments.hpp"
+
+/**
+ * Runs many clips in one process. A fixed pool of workers takes jobs in priority order, while all jobs share OpenCV's
+ * thread pool instead of every clip starting its own. A job is only admitted while the estimated matcher memory of
+ * everything running, itself included, fits the memory budget, so large-resolution jobs don't run together.
+ * The highest priority job waiting for memory holds back the jobs behind it, so it can't be starved by smaller ones.
+ * Only the inputs are checked up front. The expensive part of setting a job up (layout detection, indexing, --auto-range and
+ * the memory estimate) is done by the worker that picks the job, so the workers probe jobs concurrently with running others.
+ * With --numa, each worker is pinned to a node (round robin for auto), so a job's decoding, buffers and encoding stay on it.
+ */
+class BatchScheduler
+{
+public:
+    BatchScheduler(size_t workers, size_t memory_budget, int numa_node, std::ostream& report);
+
+    void add(const Arguments& job_arguments);
+    bool run();
+private:
+    enum State {
+        PENDING,
+        PROBING,
+        RUNNING,
+        DONE,
+        FAILED
+    };
+
+    /**
+     * One clip to process, with its settings and statistics.
+     */
+    struct Job {
+        Job(const Arguments& arguments, size_t index);
+
+        Arguments arguments;
+        size_t index;
+        int priority;
+        State state;
+        bool probed;        //memory and frame range are known
+        size_t memory;      //estimated matcher memory, in bytes
+        size_t start_frame, end_frame;
+        size_t frames;      //frames written so far
+        double seconds;
+        size_t peak_memory;
+        std::string error;
+    };
+
+    void check_input(Job& job);
+    void probe(Job& job);
+    void start_pool();
+    int worker_node(size_t worker) const;
+    void work(size_t worker);
+    Job* admit();
+    void process(Job& job);
+    void print_summary();
+
+    std::vector<Job> jobs;
+    size_t workers;
+    int numa_node; //NumaPlacement::OFF, AUTO (spread the workers) or a node
+    size_t memory_budget, memory_in_use;
+    std::ostream& report;
+    std::mutex mutex;
+    std::condition_variable changed;
+};
+
+#endif // BATCHSCHEDULER_H
@@ -0,0 +1,370 @@
+#include <algorithm>
+#include <cstring>
+
+#include "opencv2/core/core.hpp" //parallel_for_
+#include "opencv2/imgproc/imgproc.hpp" //cvtColor
+#include "opencv2/calib3d/calib3d.hpp" //filterSpeckles
+
+#include "censusmatcher.h"
+
+#if defined(__GNUC__) && !defined(__clang__) && (defined(__x86_64__) || defined(__i386__))
+#define CENSUS_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+//highest possible Hamming distance between two 9x7 census signatures (62 bits), also used for out-of-image pairs
+#define CENSUS_MAX_COST 62
+
+#define SGM_NS census_scalar
+#define SGM_LEVEL 0
+#include "censuskernels.inc"
+#undef SGM_NS
+#undef SGM_LEVEL
+
+#ifdef CENSUS_X86_DISPATCH
+#pragma GCC push_options
+#pragma GCC target("sse4.1,popcnt")
+#define SGM_NS census_sse4
+#define SGM_LEVEL 1
+#include "censuskernels.inc"
+#undef SGM_NS
+#undef SGM_LEVEL
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,popcnt")
+#define SGM_NS census_avx2
+#define SGM_LEVEL 2
+#include "censuskernels.inc"
+#undef SGM_NS
+#undef SGM_LEVEL
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx2,popcnt")
+#define SGM_NS census_avx512
+#define SGM_LEVEL 3
+#include "censuskernels.inc"
+#undef SGM_NS
+#undef SGM_LEVEL
+#pragma GCC pop_options
+#endif
+
+namespace {
+
+/**
+ * One instruction set's copy of the kernels.
+ */
+struct CensusKernels {
+    const char* name;
+    int lanes;
+    void (*census_row)(const uint8_t*, int, int, size_t, int, uint64_t*);
+    void (*cost_row)(const uint64_t*, const uint64_t*, int, int, int, uint8_t*);
+    void (*aggregate_line)(const uint8_t*, uint16_t*, ptrdiff_t, int, int, uint16_t, uint16_t, uint16_t*);
+};
+
+#define CENSUS_KERNELS(label, ns) { label, ns::lanes, ns::census_row, ns::cost_row, ns::aggregate_line }
+
+/**
+ * Pick the widest kernel the CPU supports whose vector width divides the disparity count.
+ * @param disparities Number of disparities searched.
+ * @return The selected kernels.
+ */
+CensusKernels select_kernels(int disparities) {
+#ifdef CENSUS_X86_DISPATCH
+    if (__builtin_cpu_supports("avx512bw") && disparities % census_avx512::lanes == 0) {
+        return CENSUS_KERNELS("AVX-512", census_avx512);
+    }
+    if (__builtin_cpu_supports("avx2") && disparities % census_avx2::lanes == 0) {
+        return CENSUS_KERNELS("AVX2", census_avx2);
+    }
+    if (__builtin_cpu_supports("sse4.1") && disparities % census_sse4::lanes == 0) {
+        return CENSUS_KERNELS("SSE4.1", census_sse4);
+    }
+#endif
+    return CENSUS_KERNELS("scalar", census_scalar);
+}
+
+/**
+ * Census transform of both eyes, then the cost volume, one row at a time. Also clears the matching aggregate rows.
+ */
+class CostBody : public cv::ParallelLoopBody
+{
+public:
+    CostBody(const CensusKernels& kernels, const cv::Mat& left, const cv::Mat& right, int min_disparity, int disparities,
+             uint64_t* left_census, uint64_t* right_census, uint8_t* cost, uint16_t* aggregate)
+        : kernels(kernels), left(left), right(right), min_disparity(min_disparity), disparities(disparities),
+          left_census(left_census), right_census(right_census), cost(cost), aggregate(aggregate) {}
+
+    void operator()(const cv::Range& range) const {
+        const int width = left.cols;
+        const size_t row_values = (size_t)width * disparities;
+        //census rows are only needed by this row's cost, so each thread works in its own slice of the census buffers
+        for (int y = range.start; y < range.end; ++y) {
+            uint64_t* left_row = left_census + (size_t)y * width;
+            uint64_t* right_row = right_census + (size_t)y * width;
+            kernels.census_row(left.data, width, left.rows, left.step, y, left_row);
+            kernels.census_row(right.data, width, right.rows, right.step, y, right_row);
+            kernels.cost_row(left_row, right_row, width, min_disparity, disparities, cost + y * row_values);
+            std::fill(aggregate + y * row_values, aggregate + (y + 1) * row_values, 0);
+        }
+    }
+private:
+    const CensusKernels& kernels;
+    const cv::Mat& left;
+    const cv::Mat& right;
+    int min_disparity, disparities;
+    uint64_t* left_census;
+    uint64_t* right_census;
+    uint8_t* cost;
+    uint16_t* aggregate;
+};
+
+/**
+ * Aggregation along every line of one path direction. Lines of the same direction never share a pixel, so they run in parallel.
+ */
+class PathBody : public cv::ParallelLoopBody
+{
+public:
+    PathBody(const CensusKernels& kernels, const std::vector<cv::Point>& starts, int dx, int dy, int width, int height,
+             int disparities, uint16_t P1, uint16_t P2, const uint8_t* cost, uint16_t* aggregate)
+        : kernels(kernels), starts(starts), dx(dx), dy(dy), width(width), height(height), disparities(disparities),
+          P1(P1), P2(P2), cost(cost), aggregate(aggregate) {}
+
+    void operator()(const cv::Range& range) const {
+        std::vector<uint16_t> buffer(2 * (disparities + 2));
+        const ptrdiff_t step = (ptrdiff_t)dy * width + dx;
+        for (int i = range.start; i < range.end; ++i) {
+            const cv::Point& start = starts[i];
+            int steps_x = dx > 0 ? width - start.x : (dx < 0 ? start.x + 1 : width + height);
+            int steps_y = dy > 0 ? height - start.y : (dy < 0 ? start.y + 1 : width + height);
+            size_t offset = ((size_t)start.y * width + start.x) * disparities;
+            kernels.aggregate_line(cost + offset, aggregate + offset, step, std::min(steps_x, steps_y),
+                                   disparities, P1, P2, buffer.data());
+        }
+    }
+private:
+    const CensusKernels& kernels;
+    const std::vector<cv::Point>& starts;
+    int dx, dy, width, height, disparities;
+    uint16_t P1, P2;
+    const uint8_t* cost;
+    uint16_t* aggregate;
+};
+
+/**
+ * Winner-takes-all with uniqueness check, sub-pixel refinement and left-right consistency check, one row at a time.
+ */
+class SelectBody : public cv::ParallelLoopBody
+{
+public:
+    SelectBody(const uint16_t* aggregate, cv::Mat& disparity, int min_disparity, int disparities, int uniqueness, int disp12_max_diff)
+        : aggregate(aggregate), disparity(disparity), min_disparity(min_disparity), disparities(disparities),
+          uniqueness(uniqueness), disp12_max_diff(disp12_max_diff) {}
+
+    void operator()(const cv::Range& range) const {
+        const int width = disparity.cols;
+        const short invalid = (short)((min_disparity - 1) * 16);
+        //same valid column range as StereoSGBM
+        const int min_x = std::max(min_disparity + disparities, 0);
+        const int max_x = width + std::min(min_disparity, 0);
+        std::vector<int> right_disparity(width);
+
+        for (int y = range.start; y < range.end; ++y) {
+            const uint16_t* row = aggregate + (size_t)y * width * disparities;
+            short* output = disparity.ptr<short>(y);
+
+            if (disp12_max_diff >= 0) {
+                //best disparity seen from the right eye: walk the diagonal of the aggregate volume
+                for (int xr = 0; xr < width; ++xr) {
+                    int best = -1;
+                    unsigned best_cost = 0xFFFFFFFF;
+                    for (int d = 0; d < disparities; ++d) {
+                        int x = xr + min_disparity + d;
+                        if (x >= 0 && x < width && row[(size_t)x * disparities + d] < best_cost) {
+                            best_cost = row[(size_t)x * disparities + d];
+                            best = d;
+                        }
+                    }
+                    right_disparity[xr] = best;
+                }
+            }
+
+            for (int x = 0; x < width; ++x) {
+                output[x] = invalid;
+                if (x < min_x || x >= max_x) {
+                    continue;
+                }
+                const uint16_t* costs = row + (size_t)x * disparities;
+                int best = 0;
+                for (int d = 1; d < disparities; ++d) {
+                    if (costs[d] < costs[best]) {
+                        best = d;
+                    }
+                }
+                bool unique = true;
+                for (int d = 0; d < disparities && unique; ++d) {
+                    unique = !(costs[d] * (100 - uniqueness) < costs[best] * 100 && std::abs(best - d) > 1);
+                }
+                if (!unique) {
+                    continue;
+                }
+                if (disp12_max_diff >= 0) {
+                    int xr = x - min_disparity - best;
+                    if (xr < 0 || xr >= width || std::abs(right_disparity[xr] - best) > disp12_max_diff) {
+                        continue;
+                    }
+                }
+                int value = best * 16;
+                if (best > 0 && best < disparities - 1) {
+                    int denominator = std::max(costs[best - 1] + costs[best + 1] - 2 * costs[best], 1);
+                    value += ((costs[best - 1] - costs[best + 1]) * 16 + denominator) / (denominator * 2);
+                }
+                output[x] = (short)(min_disparity * 16 + value);
+            }
+        }
+    }
+private:
+    const uint16_t* aggregate;
+    cv::Mat& disparity;
+    int min_disparity, disparities, uniqueness, disp12_max_diff;
+};
+
+/**
+ * List the first pixel of every line that a path direction follows across the image.
+ * @return The start points.
+ */
+std::vector<cv::Point> path_starts(int dx, int dy, int width, int height) {
+    std::vector<cv::Point> starts;
+    if (dy != 0) {
+        int y = dy > 0 ? 0 : height - 1;
+        for (int x = 0; x < width; ++x) {
+            starts.push_back(cv::Point(x, y));
+        }
+    }
+    if (dx != 0) {
+        int x = dx > 0 ? 0 : width - 1;
+        //rows already started from the top or bottom edge are skipped
+        int first = dy > 0 ? 1 : 0;
+        int last = dy < 0 ? height - 1 : height;
+        for (int y = first; y < last; ++y) {
+            starts.push_back(cv::Point(x, y));
+        }
+    }
+    return starts;
+}
+
+}
+
+/**
+ * Constructor. Parameters are set with configure().
+ */
+CensusSGMMatcher::CensusSGMMatcher()
+    : min_disparity(0), num_disparities(16), P1(10), P2(120), uniqueness(0), disp12_max_diff(-1),
+      speckle_window_size(0), speckle_range(0), full_dp(false)
+{
+}
+
+/**
+ * @return The engine name as accepted by --engine.
+ */
+std::string CensusSGMMatcher::name() const {
+    return "census";
+}
+
+/**
+ * Copy the matching parameters from the arguments.
+ * @param args The arguments that contain the processing parameters.
+ */
+void CensusSGMMatcher::configure(const Arguments& args) {
+    min_disparity       = args.get_value<int>  (Arguments::MIN_DISPARITY);
+    num_disparities     = std::max(16, args.get_value<int>(Arguments::NUM_DISPARITIES));
+    P1                  = args.get_value<int>  (Arguments::P1);
+    P2                  = args.get_value<int>  (Arguments::P2);
+    uniqueness          = args.get_value<int>  (Arguments::UNIQUENESS);
+    disp12_max_diff     = args.get_value<int>  (Arguments::DISP12_MAX_DIFF);
+    speckle_window_size = args.get_value<int>  (Arguments::SPECKLE_WINDOW_SIZE);
+    speckle_range       = args.get_value<int>  (Arguments::SPECKLE_RANGE);
+    full_dp             = args.get_value<bool> (Arguments::FULL_DP);
+
+    if (P1 == 0 && P2 == 0) {
+        P1 = 10;
+        P2 = 120;
+    }
+    //8 path sums of (62 + P2) have to fit in 16 bits
+    P2 = std::min(P2, 1000);
+    P1 = std::min(P1, P2);
+}
+
+/**
+ * Compute the disparity between two eye frames.
+ * @param left_eye The left eye frame (1 or 3 channel, 8-bit).
+ * @param right_eye The right eye frame, same size and type as left_eye.
+ * @param disparity Receives the CV_16SC1 disparity map.
+ */
+void CensusSGMMatcher::compute(const cv::Mat& left_eye, const cv::Mat& right_eye, cv::Mat& disparity) {
+    const cv::Mat* left = &left_eye;
+    const cv::Mat* right = &right_eye;
+    if (left_eye.channels() != 1) {
+        cvtColor(left_eye, left_gray, CV_BGR2GRAY);
+        cvtColor(right_eye, right_gray, CV_BGR2GRAY);
+        left = &left_gray;
+        right = &right_gray;
+    }
+
+    const int width = left->cols;
+    const int height = left->rows;
+    const size_t pixels = (size_t)width * height;
+    const CensusKernels kernels = select_kernels(num_disparities);
+
+    left_census.resize(pixels);
+    right_census.resize(pixels);
+    cost.resize(pixels * num_disparities);
+    aggregate.resize(pixels * num_disparities);
+
+    cv::parallel_for_(cv::Range(0, height), CostBody(kernels, *left, *right, min_disparity, num_disparities,
+                                                     left_census.data(), right_census.data(), cost.data(), aggregate.data()));
+
+    static const int directions[8][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}, {1, 1}, {-1, 1}, {1, -1}, {-1, -1}};
+    const int paths = full_dp ? 8 : 4;
+    for (int p = 0; p < paths; ++p) {
+        const int dx = directions[p][0];
+        const int dy = directions[p][1];
+        std::vector<cv::Point> starts = path_starts(dx, dy, width, height);
+        cv::parallel_for_(cv::Range(0, (int)starts.size()),
+                          PathBody(kernels, starts, dx, dy, width, height, num_disparities,
+                                   (uint16_t)P1, (uint16_t)P2, cost.data(), aggregate.data()));
+    }
+
+    disparity.create(height, width, CV_16SC1);
+    cv::parallel_for_(cv::Range(0, height), SelectBody(aggregate.data(), disparity, min_disparity, num_disparities,
+                                                       uniqueness, disp12_max_diff));
+
+    if (speckle_window_size > 0) {
+        cv::filterSpeckles(disparity, (min_disparity - 1) * 16, speckle_window_size, 16 * speckle_range, speckle_buffer);
+    }
+}
+
+/**
+ * Compute the peak working memory of one compute() call: census signatures, the 8-bit cost and 16-bit aggregate volumes,
+ * gray copies for colour input and the output disparity map.
+ * @param size Size of one eye frame.
+ * @param channels Number of channels of the eye frames.
+ * @return The size in bytes.
+ */
+size_t CensusSGMMatcher::memory_estimate(const cv::Size& size, int channels) const {
+    size_t area = (size_t)size.area();
+    return area * 2 * sizeof(uint64_t)
+            + area * num_disparities * (sizeof(uint8_t) + sizeof(uint16_t))
+            + (channels > 1 ? 2 * area : 0)
+            + area * sizeof(short);
+}
+
+/**
+ * Name the instruction set that compute() dispatches to on this CPU.
+ * @param disparities Number of disparities searched.
+ * @return "AVX-512", "AVX2", "SSE4.1" or "scalar".
+ */
+std::string CensusSGMMatcher::instruction_set(int disparities) {
+    return select_kernels(disparities).name;
+}
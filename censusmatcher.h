@@ -0,0 +1,39 @@
+#ifndef CENSUSMATCHER_H
+#define CENSUSMATCHER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "matcher.h"
+
+/**
+ * In-house semi-global matcher: 9x7 census transform, Hamming costs and SIMD cost aggregation over 4 or 8 paths.
+ * Costs are kept in an 8-bit volume and the path sums in a 16-bit volume, with rows and path lines spread across threads.
+ * The aggregation kernel is picked at runtime from SSE4.1, AVX2 and AVX-512BW (or plain C++ when none is available).
+ * Output matches SGBMMatcher: CV_16SC1 scaled by 16, invalid pixels set to (minDisparity - 1) * 16.
+ *
+ * Parameter mapping: P1/P2 are on the Hamming cost scale (0-62), with 0/0 selecting 10/120. fullDP selects 8 paths instead of 4.
+ * SADWindowSize and preFilterCap don't apply, the census window is fixed.
+ */
+class CensusSGMMatcher : public Matcher
+{
+public:
+    CensusSGMMatcher();
+
+    std::string name() const;
+    void configure(const Arguments& args);
+    void compute(const cv::Mat& left_eye, const cv::Mat& right_eye, cv::Mat& disparity);
+    size_t memory_estimate(const cv::Size& size, int channels) const;
+
+    static std::string instruction_set(int disparities);
+private:
+    int min_disparity, num_disparities, P1, P2, uniqueness, disp12_max_diff, speckle_window_size, speckle_range;
+    bool full_dp;
+
+    cv::Mat left_gray, right_gray, speckle_buffer;
+    std::vector<uint64_t> left_census, right_census;
+    std::vector<uint8_t> cost;
+    std::vector<uint16_t> aggregate;
+};
+
+#endif // CENSUSMATCHER_H
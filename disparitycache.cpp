@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <cstdio> //rename, remove
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <dirent.h> //opendir
+#include <sys/stat.h> //stat, mkdir
+#include <unistd.h> //getpid
+#include <utime.h> //utime
+
+#include "disparitycache.h"
+
+namespace {
+
+//identifies (and versions) the entry format
+const char CACHE_MAGIC[8] = {'S', '2', 'D', 'D', 'S', 'P', '0', '1'};
+const std::string CACHE_EXTENSION = ".dsp";
+
+//settings that change what the matcher outputs; cross check, filters and everything after them don't
+const Arguments::Arg MATCHER_INTS[] = {Arguments::NUM_DISPARITIES, Arguments::SAD_WINDOW_SIZE, Arguments::MIN_DISPARITY,
+                                       Arguments::PRE_FILTER_CAP, Arguments::UNIQUENESS, Arguments::P1, Arguments::P2,
+                                       Arguments::DISP12_MAX_DIFF, Arguments::SPECKLE_WINDOW_SIZE, Arguments::SPECKLE_RANGE,
+                                       Arguments::TEXTURE_THRESHOLD, Arguments::PRE_FILTER_SIZE, Arguments::MAX_MEMORY};
+const Arguments::Arg MATCHER_BOOLS[] = {Arguments::FULL_DP, Arguments::LUMA};
+//how headerless input is read changes the frames themselves
+const Arguments::Arg MATCHER_STRINGS[] = {Arguments::ENGINE, Arguments::LAYOUT, Arguments::RAW_SIZE, Arguments::STREAM_FORMAT};
+
+template<typename T>
+void write_value(std::ofstream& file, const T& value) {
+    file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<typename T>
+bool read_value(std::ifstream& file, T& value) {
+    return (bool)file.read(reinterpret_cast<char*>(&value), sizeof(value));
+}
+
+/**
+ * @return The 64-bit FNV-1a hash of a string.
+ */
+uint64_t fnv1a(const std::string& text) {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : text) {
+        hash ^= (unsigned char)c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+/**
+ * @return A file's name, size and modification time, or just its name if it can't be looked at.
+ */
+std::string file_identity(const std::string& filename) {
+    std::ostringstream identity;
+    identity << filename;
+    struct stat info;
+    if (!filename.empty() && stat(filename.c_str(), &info) == 0) {
+        identity << ":" << info.st_size << ":" << info.st_mtime;
+    }
+    return identity.str();
+}
+
+/**
+ * One file of the cache directory.
+ */
+struct Entry {
+    std::string filename;
+    size_t bytes;
+    time_t used; //modification time, refreshed on every hit
+};
+
+/**
+ * @return Every entry in a cache directory.
+ */
+std::vector<Entry> list_entries(const std::string& directory) {
+    std::vector<Entry> entries;
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) {
+        return entries;
+    }
+    while (struct dirent* item = readdir(dir)) {
+        std::string name = item->d_name;
+        if (name.size() <= CACHE_EXTENSION.size() || name.compare(name.size() - CACHE_EXTENSION.size(), CACHE_EXTENSION.size(), CACHE_EXTENSION) != 0) {
+            continue;
+        }
+        Entry entry;
+        entry.filename = directory + "/" + name;
+        struct stat info;
+        if (stat(entry.filename.c_str(), &info) == 0) {
+            entry.bytes = info.st_size;
+            entry.used = info.st_mtime;
+            entries.push_back(entry);
+        }
+    }
+    closedir(dir);
+    return entries;
+}
+
+}
+
+/**
+ * Constructor for a disabled cache.
+ */
+DisparityCache::DisparityCache()
+    : budget(0), bytes(0), hits(0), misses(0)
+{
+}
+
+/**
+ * Start caching in a directory, which is created if it doesn't exist.
+ * Throws std::runtime_error if the directory can't be created.
+ * @param directory The cache directory. Empty disables the cache.
+ * @param budget The most bytes the directory may hold, 0 for unlimited.
+ * @param input_filename The input video.
+ * @param right_filename The right eye video for separate files, empty otherwise.
+ */
+void DisparityCache::open(const std::string& directory, size_t budget, const std::string& input_filename, const std::string& right_filename) {
+    this->directory = directory;
+    this->budget = budget;
+    if (directory.empty()) {
+        return;
+    }
+    struct stat info;
+    if (stat(directory.c_str(), &info) != 0 && mkdir(directory.c_str(), 0777) != 0) {
+        throw std::runtime_error("Error: cache directory [" + directory + "] cannot be created");
+    }
+    identity = file_identity(input_filename) + "|" + file_identity(right_filename);
+
+    bytes = 0;
+    for (const Entry& entry : list_entries(directory)) {
+        bytes += entry.bytes;
+    }
+}
+
+/**
+ * @return True if a cache directory is set.
+ */
+bool DisparityCache::is_enabled() const {
+    return !directory.empty();
+}
+
+/**
+ * Look up the matcher output of a frame.
+ * @param args The settings the frame is matched with.
+ * @param region The region of the eye that is matched.
+ * @param right_wanted Whether the right eye's map is matched too.
+ * @param frame The frame index.
+ * @param left Receives the left eye's map on a hit.
+ * @param right Receives the right eye's map on a hit, when it's wanted.
+ * @return True on a hit.
+ */
+bool DisparityCache::load(const Arguments& args, const cv::Rect& region, bool right_wanted, int64_t frame, cv::Mat& left, cv::Mat& right) {
+    std::string filename = entry_filename(args, region, right_wanted, frame);
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    char magic[sizeof(CACHE_MAGIC)];
+    int32_t rows = 0, cols = 0, maps = 0;
+    bool valid = file && file.read(magic, sizeof(magic)) && std::equal(magic, magic + sizeof(magic), CACHE_MAGIC)
+                 && read_value(file, rows) && read_value(file, cols) && read_value(file, maps)
+                 && rows == region.height && cols == region.width && maps == (right_wanted ? 2 : 1);
+    cv::Mat loaded[2];
+    for (int32_t map = 0; valid && map < maps; ++map) {
+        loaded[map].create(rows, cols, CV_16SC1);
+        valid = (bool)file.read(reinterpret_cast<char*>(loaded[map].data), loaded[map].total() * loaded[map].elemSize());
+    }
+    if (!valid) {
+        ++misses;
+        return false;
+    }
+
+    //a hit counts as a use for the eviction order
+    utime(filename.c_str(), 0);
+    left = loaded[0];
+    if (right_wanted) {
+        right = loaded[1];
+    }
+    ++hits;
+    return true;
+}
+
+/**
+ * Save the matcher output of a frame. A cache entry that can't be written is not an error, the frame just isn't cached.
+ * @param args The settings the frame was matched with.
+ * @param region The region of the eye that was matched.
+ * @param right_wanted Whether the right eye's map was matched too.
+ * @param frame The frame index.
+ * @param left The left eye's CV_16SC1 map.
+ * @param right The right eye's CV_16SC1 map, when it's wanted.
+ */
+void DisparityCache::store(const Arguments& args, const cv::Rect& region, bool right_wanted, int64_t frame, const cv::Mat& left, const cv::Mat& right) {
+    std::string filename = entry_filename(args, region, right_wanted, frame);
+    //written aside under a name of this process and thread, and renamed, so no reader ever sees half an entry and two writers
+    //of the same entry never share a temporary file
+    std::string temporary = filename + "." + std::to_string(getpid()) + "."
+            + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    size_t written = 0;
+    {
+        std::ofstream file(temporary.c_str(), std::ios::binary);
+        if (!file) {
+            return;
+        }
+        file.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        write_value(file, (int32_t)left.rows);
+        write_value(file, (int32_t)left.cols);
+        write_value(file, (int32_t)(right_wanted ? 2 : 1));
+        const cv::Mat* maps[2] = {&left, &right};
+        for (int map = 0; map < (right_wanted ? 2 : 1); ++map) {
+            cv::Mat continuous = maps[map]->isContinuous() ? *maps[map] : maps[map]->clone();
+            file.write(reinterpret_cast<const char*>(continuous.data), continuous.total() * continuous.elemSize());
+            written += continuous.total() * continuous.elemSize();
+        }
+        if (!file) {
+            file.close();
+            std::remove(temporary.c_str());
+            return;
+        }
+    }
+    if (std::rename(temporary.c_str(), filename.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return;
+    }
+
+    bytes += written + sizeof(CACHE_MAGIC) + 3 * sizeof(int32_t);
+    if (budget > 0 && bytes > budget) {
+        trim();
+    }
+}
+
+/**
+ * @return The number of frames found in the cache.
+ */
+size_t DisparityCache::get_hits() const {
+    return hits;
+}
+
+/**
+ * @return The number of frames that had to be matched.
+ */
+size_t DisparityCache::get_misses() const {
+    return misses;
+}
+
+/**
+ * @return The file of a frame's entry, named by the hash of everything that identifies its content.
+ */
+std::string DisparityCache::entry_filename(const Arguments& args, const cv::Rect& region, bool right_wanted, int64_t frame) const {
+    std::ostringstream key;
+    key << identity << "|" << frame << "|" << region.x << "," << region.y << "," << region.width << "," << region.height
+        << "|" << right_wanted << "|" << args.get_value<double>(Arguments::MATCH_SCALE);
+    for (Arguments::Arg arg : MATCHER_INTS) {
+        key << "|" << args.get_value<int>(arg);
+    }
+    for (Arguments::Arg arg : MATCHER_BOOLS) {
+        key << "|" << args.get_value<bool>(arg);
+    }
+    for (Arguments::Arg arg : MATCHER_STRINGS) {
+        key << "|" << args.get_value<std::string>(arg);
+    }
+    //the calibration's content matters too, not just its name
+    key << "|" << file_identity(args.get_value<std::string>(Arguments::CALIBRATION_FILENAME));
+
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", (unsigned long long)fnv1a(key.str()));
+    return directory + "/" + name + CACHE_EXTENSION;
+}
+
+/**
+ * Delete the least recently used entries until the directory is back to 90% of its budget, so trimming isn't needed again
+ * on the very next frame. Other processes may share the directory, so it's rescanned.
+ */
+void DisparityCache::trim() {
+    std::vector<Entry> entries = list_entries(directory);
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.used < b.used;
+    });
+    bytes = 0;
+    for (const Entry& entry : entries) {
+        bytes += entry.bytes;
+    }
+    size_t target = budget / 10 * 9;
+    for (const Entry& entry : entries) {
+        if (bytes <= target) {
+            break;
+        }
+        if (std::remove(entry.filename.c_str()) == 0) {
+            bytes -= entry.bytes;
+        }
+    }
+}
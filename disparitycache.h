@@ -0,0 +1,43 @@
+#ifndef DISPARITYCACHE_H
+#define DISPARITYCACHE_H
+
+#include <cstdint>
+#include <string>
+
+#include "opencv2/core/core.hpp"
+#include "arguments.hpp"
+
+/**
+ * Content-addressed disk cache of raw matcher output (--cache), so re-exports that only change what happens after matching
+ * (cross check, filters, scaling, codec, extra outputs) skip matching entirely.
+ * An entry holds the CV_16S map of one frame as it came out of the matcher (and the right eye's map when that is matched too).
+ * It is keyed by a hash of the input files' identity (name, size, modification time), the frame index, every setting that
+ * changes the matcher's output, and the region matched. Changing any of them simply misses.
+ * Entries are written to a temporary file and renamed into place, so several processes can share a cache directory.
+ * When the directory grows past its byte budget, the least recently used entries are deleted.
+ */
+class DisparityCache
+{
+public:
+    DisparityCache();
+
+    void open(const std::string& directory, size_t budget, const std::string& input_filename, const std::string& right_filename);
+    bool is_enabled() const;
+
+    bool load(const Arguments& args, const cv::Rect& region, bool right_wanted, int64_t frame, cv::Mat& left, cv::Mat& right);
+    void store(const Arguments& args, const cv::Rect& region, bool right_wanted, int64_t frame, const cv::Mat& left, const cv::Mat& right);
+
+    size_t get_hits() const;
+    size_t get_misses() const;
+private:
+    std::string entry_filename(const Arguments& args, const cv::Rect& region, bool right_wanted, int64_t frame) const;
+    void trim();
+
+    std::string directory;
+    size_t budget;        //bytes, 0 for unlimited
+    std::string identity; //of the input files
+    size_t bytes;         //estimated size of the directory, rescanned when it passes the budget
+    size_t hits, misses;
+};
+
+#endif // DISPARITYCACHE_H
@@ -0,0 +1,205 @@
+#include <cstdio> //sscanf
+#include <exception>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+
+#include "fanout.h"
+#include "tracer.h"
+
+namespace {
+
+//settings that change the disparity map; branches that agree on all of them share one matching
+const Arguments::Arg MATCHING_INTS[] = {Arguments::NUM_DISPARITIES, Arguments::SAD_WINDOW_SIZE, Arguments::MIN_DISPARITY,
+                                        Arguments::PRE_FILTER_CAP, Arguments::UNIQUENESS, Arguments::P1, Arguments::P2,
+                                        Arguments::DISP12_MAX_DIFF, Arguments::SPECKLE_WINDOW_SIZE, Arguments::SPECKLE_RANGE,
+                                        Arguments::TEXTURE_THRESHOLD, Arguments::PRE_FILTER_SIZE, Arguments::MAX_MEMORY,
+                                        Arguments::CROSS_CHECK, Arguments::TEMPORAL, Arguments::POST_FILTER};
+const Arguments::Arg MATCHING_BOOLS[] = {Arguments::FULL_DP, Arguments::LUMA, Arguments::BOTH_EYES};
+const Arguments::Arg MATCHING_STRINGS[] = {Arguments::ENGINE, Arguments::CALIBRATION_FILENAME, Arguments::ROI};
+
+//settings every branch must share with the main run, since the decode is shared
+const Arguments::Arg INPUT_INTS[] = {Arguments::START_FRAME, Arguments::END_FRAME};
+const Arguments::Arg INPUT_STRINGS[] = {Arguments::INPUT_FILENAME, Arguments::RIGHT_FILENAME, Arguments::LAYOUT};
+
+/**
+ * Run count tasks at once, the first on the calling thread, and rethrow the first error after all have finished.
+ * @param count The number of tasks.
+ * @param task Called with the index of each task.
+ */
+void run_parallel(size_t count, const std::function<void(size_t)>& task) {
+    std::vector<std::exception_ptr> errors(count);
+    std::vector<std::thread> threads;
+    for (size_t index = 1; index < count; ++index) {
+        threads.push_back(std::thread([index, &task, &errors]() {
+            try {
+                Tracer::name_thread("fan-out worker");
+                task(index);
+            } catch (...) {
+                errors[index] = std::current_exception();
+            }
+        }));
+    }
+    if (count > 0) {
+        try {
+            task(0);
+        } catch (...) {
+            errors[0] = std::current_exception();
+        }
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    for (const std::exception_ptr& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+}
+
+/**
+ * Constructor. Opens every output, and creates a Processor for each distinct set of matching settings.
+ * Throws std::runtime_error if a branch reads a different input or frame range, or an output can't be opened.
+ * @param processor The main run's Processor, which decodes the frames. Its own output is written too.
+ * @param args The main run's arguments.
+ * @param branches The arguments of every --fan-out branch. They must outlive the FanOut.
+ * @param report The stream progress is written to.
+ */
+FanOut::FanOut(Processor& processor, Arguments& args, std::vector<Arguments>& branches, std::ostream& report)
+    : processor(processor), report(report)
+{
+    Matching main_matching;
+    main_matching.processor = &processor;
+    matchings.push_back(main_matching);
+    matching_arguments.push_back(&args);
+
+    Output main_output;
+    main_output.matching = 0;
+    main_output.filename = args.get_value<std::string>(Arguments::OUTPUT_FILENAME);
+    main_output.size = processor.get_video_size();
+    main_output.writer = processor.create_writer();
+    if (!main_output.writer->isOpened()) {
+        throw std::runtime_error("Error: output file [" + main_output.filename + "] cannot be opened for writing");
+    }
+    outputs.push_back(main_output);
+
+    for (size_t branch = 0; branch < branches.size(); ++branch) {
+        if (!same_input(args, branches[branch])) {
+            throw std::runtime_error("Error: fan-out " + std::to_string(branch + 1) + " must read the same input and frames as the main run");
+        }
+        size_t matching = 0;
+        while (matching < matchings.size() && !same_matching(*matching_arguments[matching], branches[branch])) {
+            ++matching;
+        }
+        if (matching == matchings.size()) {
+            Matching branch_matching;
+            branch_matching.owned.reset(new Processor(branches[branch], processor.get_input_size(), processor.get_layout().get_type()));
+            branch_matching.processor = branch_matching.owned.get();
+            matchings.push_back(branch_matching);
+            matching_arguments.push_back(&branches[branch]);
+        }
+        add_output(branches[branch], matching);
+    }
+
+    report << "Fan-out: " << outputs.size() << " outputs from " << matchings.size() << " matchings" << std::endl;
+}
+
+/**
+ * Open a branch's video.
+ * Throws std::runtime_error if it can't be opened.
+ * @param output_arguments The branch's arguments.
+ * @param matching The matching the branch's frames come from.
+ */
+void FanOut::add_output(Arguments& output_arguments, size_t matching) {
+    Output output;
+    output.matching = matching;
+    output.filename = output_arguments.get_value<std::string>(Arguments::OUTPUT_FILENAME);
+    output.size = matchings[matching].processor->get_output_size();
+    std::string output_size = output_arguments.get_value<std::string>(Arguments::OUTPUT_SIZE);
+    if (!output_size.empty()) {
+        std::sscanf(output_size.c_str(), "%dx%d", &output.size.width, &output.size.height);
+    }
+    output.writer.reset(new cv::VideoWriter());
+    output.writer->open(output.filename, output_arguments.get_value<int>(Arguments::OUTPUT_FOURCC), processor.get_fps(), output.size, true);
+    if (!output.writer->isOpened()) {
+        throw std::runtime_error("Error: output file [" + output.filename + "] cannot be opened for writing");
+    }
+    outputs.push_back(output);
+}
+
+/**
+ * Process a frame range into every output.
+ * @param start_frame The first frame, 0-indexed.
+ * @param end_frame The last frame.
+ * @return The number of frames written to each output.
+ */
+size_t FanOut::run(size_t start_frame, size_t end_frame) {
+    for (Matching& matching : matchings) {
+        matching.processor->set_next_frame(start_frame);
+    }
+
+    size_t range = end_frame + 1 - start_frame;
+    size_t counter = 0;
+    cv::Mat frame_src, right_src;
+    for (size_t index = start_frame; index <= end_frame; ++index) {
+        //decoded once; every matching only reads it
+        if (!processor.read_frame(frame_src, right_src)) {
+            break;
+        }
+        ++counter;
+        report << "Processing frame " << counter << " of " << range << " [" << 100 * counter / range << "%]\r" << std::flush;
+
+        run_parallel(matchings.size(), [&](size_t matching) {
+            matchings[matching].processor->compute_depth(frame_src, right_src, matchings[matching].disparity);
+        });
+        run_parallel(outputs.size(), [&](size_t output) {
+            Output& target = outputs[output];
+            TraceSpan span("encode", index);
+            matchings[target.matching].processor->to_video_frame(matchings[target.matching].disparity, target.size, target.frame);
+            *target.writer << target.frame;
+        });
+    }
+    report << std::endl;
+    return counter;
+}
+
+/**
+ * @return True if both arguments read the same input and frame range.
+ */
+bool FanOut::same_input(const Arguments& a, const Arguments& b) {
+    for (Arguments::Arg arg : INPUT_INTS) {
+        if (a.get_value<int>(arg) != b.get_value<int>(arg)) {
+            return false;
+        }
+    }
+    for (Arguments::Arg arg : INPUT_STRINGS) {
+        if (a.get_value<std::string>(arg) != b.get_value<std::string>(arg)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @return True if both arguments give the same disparity maps.
+ */
+bool FanOut::same_matching(const Arguments& a, const Arguments& b) {
+    for (Arguments::Arg arg : MATCHING_INTS) {
+        if (a.get_value<int>(arg) != b.get_value<int>(arg)) {
+            return false;
+        }
+    }
+    for (Arguments::Arg arg : MATCHING_BOOLS) {
+        if (a.get_value<bool>(arg) != b.get_value<bool>(arg)) {
+            return false;
+        }
+    }
+    for (Arguments::Arg arg : MATCHING_STRINGS) {
+        if (a.get_value<std::string>(arg) != b.get_value<std::string>(arg)) {
+            return false;
+        }
+    }
+    return a.get_value<double>(Arguments::MATCH_SCALE) == b.get_value<double>(Arguments::MATCH_SCALE);
+}
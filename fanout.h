@@ -0,0 +1,59 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "opencv2/highgui/highgui.hpp" //VideoWriter
+#include "arguments.hpp"
+#include "processor.h"
+
+/**
+ * Writes several deliveries of a clip from one pass over it (--fan-out): every branch has its own output file, codec and
+ * size, and may have its own matching settings. Each frame is decoded once, by the main Processor, and shared read-only.
+ * Branches whose matching settings equal the main run's share its disparity map and only cost a scale and an encode; each
+ * distinct set of matching settings gets its own Processor. Per frame, the distinct matchings run concurrently, then every
+ * output is scaled and encoded concurrently.
+ * Confidence and point cloud outputs are only written for the main run.
+ */
+class FanOut
+{
+public:
+    FanOut(Processor& processor, Arguments& args, std::vector<Arguments>& branches, std::ostream& report);
+
+    size_t run(size_t start_frame, size_t end_frame);
+private:
+    /**
+     * One disparity computation per frame, shared by every output with the same matching settings.
+     */
+    struct Matching {
+        Processor* processor;
+        std::shared_ptr<Processor> owned; //empty for the main Processor
+        cv::Mat disparity;
+    };
+
+    /**
+     * One written video.
+     */
+    struct Output {
+        size_t matching;
+        std::string filename;
+        cv::Size size;
+        std::shared_ptr<cv::VideoWriter> writer;
+        cv::Mat frame;
+    };
+
+    void add_output(Arguments& output_arguments, size_t matching);
+    static bool same_input(const Arguments& a, const Arguments& b);
+    static bool same_matching(const Arguments& a, const Arguments& b);
+
+    Processor& processor;
+    std::vector<Matching> matchings;
+    std::vector<Arguments*> matching_arguments;
+    std::vector<Output> outputs;
+    std::ostream& report;
+};
+
+#endif // FANOUT_H
@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <sys/stat.h> //stat
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include "frameindex.h"
+
+namespace {
+
+//identifies (and versions) the sidecar format
+const char INDEX_MAGIC[8] = {'S', '2', 'D', 'I', 'D', 'X', '0', '1'};
+
+template<typename T>
+void write_value(std::ofstream& file, const T& value) {
+    file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<typename T>
+bool read_value(std::ifstream& file, T& value) {
+    return (bool)file.read(reinterpret_cast<char*>(&value), sizeof(value));
+}
+
+}
+
+/**
+ * Constructor for an empty index.
+ */
+FrameIndex::FrameIndex()
+    : time_base_num(1), time_base_den(1)
+{
+}
+
+/**
+ * Get the index of a video file: read from its sidecar if that is up to date with the file (same size and modification
+ * time), otherwise built with a demux pass and saved to the sidecar. A sidecar that can't be written is not an error.
+ * Throws std::runtime_error if the file can't be indexed.
+ * @param video_filename The video file.
+ * @return The index.
+ */
+std::shared_ptr<FrameIndex> FrameIndex::open(const std::string& video_filename) {
+    struct stat info;
+    if (stat(video_filename.c_str(), &info) != 0) {
+        throw std::runtime_error("Error: video file [" + video_filename + "] cannot be indexed");
+    }
+
+    std::string index_filename = video_filename + ".idx";
+    std::shared_ptr<FrameIndex> index(new FrameIndex());
+    if (index->load(index_filename, info.st_size, info.st_mtime)) {
+        index->video_filename = video_filename;
+        return index;
+    }
+
+    index = build(video_filename);
+    index->save(index_filename, info.st_size, info.st_mtime);
+    return index;
+}
+
+/**
+ * Index a video file by reading the packets of its video stream, without decoding them.
+ * Throws std::runtime_error if the file can't be demuxed or has no timestamped video frames.
+ * @param video_filename The video file.
+ * @return The index, in display order.
+ */
+std::shared_ptr<FrameIndex> FrameIndex::build(const std::string& video_filename) {
+#if LIBAVFORMAT_VERSION_MAJOR < 58
+    av_register_all();
+#endif
+    AVFormatContext* format = 0;
+    if (avformat_open_input(&format, video_filename.c_str(), 0, 0) < 0) {
+        throw std::runtime_error("Error: video file [" + video_filename + "] cannot be opened for indexing");
+    }
+    int stream = -1;
+    if (avformat_find_stream_info(format, 0) >= 0) {
+        stream = av_find_best_stream(format, AVMEDIA_TYPE_VIDEO, -1, -1, 0, 0);
+    }
+    if (stream < 0) {
+        avformat_close_input(&format);
+        throw std::runtime_error("Error: video file [" + video_filename + "] has no video stream to index");
+    }
+
+    //only the video packets are wanted
+    for (unsigned int other = 0; other < format->nb_streams; ++other) {
+        if ((int)other != stream) {
+            format->streams[other]->discard = AVDISCARD_ALL;
+        }
+    }
+
+    std::shared_ptr<FrameIndex> index(new FrameIndex());
+    index->video_filename = video_filename;
+    index->time_base_num = format->streams[stream]->time_base.num;
+    index->time_base_den = format->streams[stream]->time_base.den;
+
+    AVPacket packet;
+    av_init_packet(&packet);
+    packet.data = 0;
+    packet.size = 0;
+    while (av_read_frame(format, &packet) >= 0) {
+        if (packet.stream_index == stream) {
+            Entry entry;
+            entry.pts = packet.pts != (int64_t)AV_NOPTS_VALUE ? packet.pts : packet.dts;
+            entry.offset = packet.pos;
+            entry.key = (packet.flags & AV_PKT_FLAG_KEY) ? 1 : 0;
+            if (entry.pts != (int64_t)AV_NOPTS_VALUE) {
+                index->entries.push_back(entry);
+            }
+        }
+#if LIBAVCODEC_VERSION_MAJOR >= 57
+        av_packet_unref(&packet);
+#else
+        av_free_packet(&packet);
+#endif
+    }
+    avformat_close_input(&format);
+
+    if (index->entries.empty()) {
+        throw std::runtime_error("Error: video file [" + video_filename + "] has no timestamped video frames");
+    }
+
+    //packets come in decoding order, frames are shown in presentation order
+    std::stable_sort(index->entries.begin(), index->entries.end(), [](const Entry& first, const Entry& second) {
+        return first.pts < second.pts;
+    });
+    return index;
+}
+
+/**
+ * Read a sidecar index.
+ * @param index_filename The sidecar file.
+ * @param file_size The current size of the video file.
+ * @param file_time The current modification time of the video file.
+ * @return False if there is no sidecar, or it is unreadable or out of date.
+ */
+bool FrameIndex::load(const std::string& index_filename, uint64_t file_size, int64_t file_time) {
+    std::ifstream file(index_filename.c_str(), std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    char magic[sizeof(INDEX_MAGIC)];
+    uint64_t indexed_size, count;
+    int64_t indexed_time;
+    int32_t num, den;
+    if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0
+            || !read_value(file, indexed_size) || !read_value(file, indexed_time)
+            || indexed_size != file_size || indexed_time != file_time
+            || !read_value(file, num) || !read_value(file, den) || !read_value(file, count) || count == 0 || den == 0) {
+        return false;
+    }
+
+    std::vector<Entry> loaded(count);
+    for (Entry& entry : loaded) {
+        if (!read_value(file, entry.pts) || !read_value(file, entry.offset) || !read_value(file, entry.key)) {
+            return false;
+        }
+    }
+
+    entries.swap(loaded);
+    time_base_num = num;
+    time_base_den = den;
+    return true;
+}
+
+/**
+ * Write the sidecar index. Failures are ignored, the index will just be rebuilt next time.
+ * @param index_filename The sidecar file.
+ * @param file_size The size of the indexed video file.
+ * @param file_time The modification time of the indexed video file.
+ */
+void FrameIndex::save(const std::string& index_filename, uint64_t file_size, int64_t file_time) const {
+    std::ofstream file(index_filename.c_str(), std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return;
+    }
+    file.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    write_value(file, file_size);
+    write_value(file, file_time);
+    write_value(file, (int32_t)time_base_num);
+    write_value(file, (int32_t)time_base_den);
+    write_value(file, (uint64_t)entries.size());
+    for (const Entry& entry : entries) {
+        write_value(file, entry.pts);
+        write_value(file, entry.offset);
+        write_value(file, entry.key);
+    }
+}
+
+/**
+ * @return The exact number of frames in the video stream.
+ */
+size_t FrameIndex::frame_count() const {
+    return entries.size();
+}
+
+/**
+ * @param frame A 0-indexed frame, in display order.
+ * @return The frame's presentation time in seconds, relative to the first frame.
+ */
+double FrameIndex::seconds(size_t frame) const {
+    return (double)(entries[frame].pts - entries[0].pts) * time_base_num / time_base_den;
+}
+
+/**
+ * @param frame A 0-indexed frame, in display order.
+ * @return True if the frame can be decoded on its own.
+ */
+bool FrameIndex::is_keyframe(size_t frame) const {
+    return entries[frame].key != 0;
+}
+
+/**
+ * @param frame A 0-indexed frame, in display order.
+ * @return The byte offset of the frame's packet in the file, -1 if the container doesn't say.
+ */
+int64_t FrameIndex::byte_offset(size_t frame) const {
+    return entries[frame].offset;
+}
+
+/**
+ * @param frame A 0-indexed frame, in display order.
+ * @return The nearest keyframe at or before the frame (the first frame if there is none).
+ */
+size_t FrameIndex::keyframe_before(size_t frame) const {
+    frame = std::min(frame, entries.size() - 1);
+    while (frame > 0 && !entries[frame].key) {
+        --frame;
+    }
+    return frame;
+}
+
+/**
+ * Find the indexed frame a capture will read next, from the time the backend reports for it. Backends report that time
+ * from the decoded frame's timestamp, but rounded to the average frame rate, so it is matched to the nearest indexed
+ * presentation time, and only trusted if no other indexed frame is as close as that rounding.
+ * @param capture A capture of the indexed file, just seeked.
+ * @param frame Receives the 0-indexed frame, in display order.
+ * @return False if the landing point can't be pinned to a single frame.
+ */
+bool FrameIndex::landed_frame(cv::VideoCapture& capture, size_t& frame) const {
+    double fps = capture.get(CV_CAP_PROP_FPS);
+    double landed = capture.get(CV_CAP_PROP_POS_MSEC) / 1000.0;
+    if (!(fps > 0) || !(landed >= 0)) {
+        return false;
+    }
+    double tolerance = 0.5 / fps;
+
+    //the first frame at or after the landing time, and the one before it, are the only candidates
+    size_t low = 0, high = entries.size();
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (seconds(middle) < landed) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    size_t candidates = 0;
+    for (size_t candidate = low > 0 ? low - 1 : 0; candidate <= low && candidate < entries.size(); ++candidate) {
+        if (std::abs(seconds(candidate) - landed) <= tolerance) {
+            frame = candidate;
+            ++candidates;
+        }
+    }
+    return candidates == 1;
+}
+
+/**
+ * Position a capture so that its next read returns exactly the given frame.
+ * The capture is seeked to the nearest indexed keyframe, and where it landed is looked up by time in the index, see
+ * landed_frame(). Landing past the frame retries from earlier keyframes. The frames between the landing point and the frame
+ * are then decoded and skipped. If no keyframe gives a landing point at or before the frame, the file is reopened and
+ * decoded forward from the start.
+ * Throws std::runtime_error if the frame can't be reached either way.
+ * @param capture A capture of the indexed file.
+ * @param frame A 0-indexed frame, in display order.
+ */
+void FrameIndex::seek(cv::VideoCapture& capture, size_t frame) const {
+    if (frame >= entries.size()) {
+        capture.set(CV_CAP_PROP_POS_FRAMES, frame);
+        return;
+    }
+    size_t keyframe = keyframe_before(frame);
+    while (true) {
+        capture.set(CV_CAP_PROP_POS_FRAMES, keyframe);
+        size_t position;
+        if (!landed_frame(capture, position)) {
+            break;
+        }
+        if (position <= frame) {
+            for (; position < frame; ++position) {
+                if (!capture.grab()) {
+                    throw std::runtime_error("Error: frame " + std::to_string(frame) + " of [" + video_filename + "] cannot be decoded");
+                }
+            }
+            return;
+        }
+        if (keyframe == 0) {
+            break;
+        }
+        keyframe = keyframe_before(keyframe - 1);
+    }
+
+    //a freshly opened file starts at its first frame, whatever the timestamps say
+    if (!capture.open(video_filename)) {
+        throw std::runtime_error("Error: [" + video_filename + "] cannot be reopened to seek to frame " + std::to_string(frame));
+    }
+    for (size_t position = 0; position < frame; ++position) {
+        if (!capture.grab()) {
+            throw std::runtime_error("Error: frame " + std::to_string(frame) + " of [" + video_filename + "] cannot be decoded");
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef FRAMEINDEX_H
+#define FRAMEINDEX_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "opencv2/highgui/highgui.hpp" //VideoCapture
+
+/**
+ * Frame-accurate index of a video file, built in one demux pass (packets are read, not decoded) and kept in a sidecar file
+ * next to the video (VIDEO.idx) so reopening the file is instant.
+ * Each frame, in display order, has its presentation time, keyframe flag and byte offset. Seeking goes to an indexed keyframe
+ * at or before the frame. The decoder's landing time is then looked up in the indexed presentation times, which gives the
+ * frame it really landed on, even in variable frame rate and edited files. If it landed past the frame, earlier keyframes are
+ * tried. The frames up to the wanted one are then decoded and skipped. When the landing point can't be pinned to a single
+ * indexed frame, the file is reopened and decoded forward from its first frame instead, which is slow but exact.
+ */
+class FrameIndex
+{
+public:
+    static std::shared_ptr<FrameIndex> open(const std::string& video_filename);
+    static std::shared_ptr<FrameIndex> build(const std::string& video_filename);
+
+    size_t frame_count() const;
+    double seconds(size_t frame) const;
+    bool is_keyframe(size_t frame) const;
+    int64_t byte_offset(size_t frame) const;
+    size_t keyframe_before(size_t frame) const;
+
+    void seek(cv::VideoCapture& capture, size_t frame) const;
+private:
+    /**
+     * One frame, as read from the container.
+     */
+    struct Entry {
+        int64_t pts;    //presentation timestamp, in time_base units
+        int64_t offset; //byte offset of the packet in the file, -1 if unknown
+        uint8_t key;    //1 for keyframes
+    };
+
+    FrameIndex();
+
+    bool landed_frame(cv::VideoCapture& capture, size_t& frame) const;
+    bool load(const std::string& index_filename, uint64_t file_size, int64_t file_time);
+    void save(const std::string& index_filename, uint64_t file_size, int64_t file_time) const;
+
+    std::string video_filename; //for reopening when a seek can't be placed
+    std::vector<Entry> entries;
+    int time_base_num, time_base_den;
+};
+
+#endif // FRAMEINDEX_H
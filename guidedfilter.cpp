@@ -0,0 +1,340 @@
+#include <algorithm>
+
+#include "opencv2/imgproc/imgproc.hpp" //cvtColor
+
+#include "guidedfilter.h"
+
+namespace {
+
+//rows per parallel band of the vertical box pass. Each band primes its own column sums, which costs one window of rows.
+const int BAND_ROWS = 64;
+
+//the masked products that are box filtered. With M the validity mask, I the guide and p the disparity in pixels:
+enum Plane {
+    VALID,             //M
+    GUIDE,             //M I
+    DISPARITY,         //M p
+    GUIDE_DISPARITY,   //M I p
+    GUIDE_SQUARED,     //M I I
+    DISPARITY_SQUARED, //M p p
+    PLANE_COUNT
+};
+
+/**
+ * Builds the masked product planes from the disparity map and the guide.
+ */
+class PrepareBody : public cv::ParallelLoopBody
+{
+public:
+    PrepareBody(const cv::Mat& disparity, const cv::Mat& guide, short invalid, std::vector<cv::Mat>& planes)
+        : disparity(disparity), guide(guide), invalid(invalid), planes(planes) {}
+
+    void operator()(const cv::Range& range) const {
+        for (int y = range.start; y < range.end; ++y) {
+            const short* values = disparity.ptr<short>(y);
+            const float* intensities = guide.ptr<float>(y);
+            float* valid = planes[VALID].ptr<float>(y);
+            float* masked_guide = planes[GUIDE].ptr<float>(y);
+            float* masked_disparity = planes[DISPARITY].ptr<float>(y);
+            float* guide_disparity = planes[GUIDE_DISPARITY].ptr<float>(y);
+            float* guide_squared = planes[GUIDE_SQUARED].ptr<float>(y);
+            float* disparity_squared = planes[DISPARITY_SQUARED].ptr<float>(y);
+            for (int x = 0; x < disparity.cols; ++x) {
+                float mask = values[x] > invalid ? 1.0f : 0.0f;
+                float intensity = intensities[x];
+                float pixels = mask * (float)values[x] * (1.0f / 16);
+                valid[x] = mask;
+                masked_guide[x] = mask * intensity;
+                masked_disparity[x] = pixels;
+                guide_disparity[x] = intensity * pixels;
+                guide_squared[x] = mask * intensity * intensity;
+                disparity_squared[x] = pixels * pixels;
+            }
+        }
+    }
+private:
+    const cv::Mat& disparity;
+    const cv::Mat& guide;
+    short invalid;
+    std::vector<cv::Mat>& planes;
+};
+
+/**
+ * Horizontal box sums over a band of rows, with a running sum so the cost doesn't depend on the radius.
+ * The window is clipped at the image border.
+ */
+class HorizontalBoxBody : public cv::ParallelLoopBody
+{
+public:
+    HorizontalBoxBody(const cv::Mat& src, int radius, cv::Mat& dst) : src(src), radius(radius), dst(dst) {}
+
+    void operator()(const cv::Range& range) const {
+        const int width = src.cols;
+        for (int y = range.start; y < range.end; ++y) {
+            const float* in = src.ptr<float>(y);
+            float* out = dst.ptr<float>(y);
+            double sum = 0;
+            for (int x = 0; x < std::min(radius, width); ++x) {
+                sum += in[x];
+            }
+            for (int x = 0; x < width; ++x) {
+                if (x + radius < width) {
+                    sum += in[x + radius];
+                }
+                if (x - radius - 1 >= 0) {
+                    sum -= in[x - radius - 1];
+                }
+                out[x] = (float)sum;
+            }
+        }
+    }
+private:
+    const cv::Mat& src;
+    int radius;
+    cv::Mat& dst;
+};
+
+/**
+ * Vertical box sums over bands of BAND_ROWS rows. Each band primes a row of column sums, then slides it down,
+ * adding the row entering the window and subtracting the one leaving it, a whole row at a time.
+ */
+class VerticalBoxBody : public cv::ParallelLoopBody
+{
+public:
+    VerticalBoxBody(const cv::Mat& src, int radius, cv::Mat& dst) : src(src), radius(radius), dst(dst) {}
+
+    void operator()(const cv::Range& range) const {
+        const int width = src.cols;
+        const int height = src.rows;
+        std::vector<double> column_sums(width);
+        double* sums = &column_sums[0];
+        for (int band = range.start; band < range.end; ++band) {
+            int start = band * BAND_ROWS;
+            int end = std::min(start + BAND_ROWS, height);
+
+            std::fill(column_sums.begin(), column_sums.end(), 0.0);
+            for (int y = std::max(0, start - radius); y < std::min(height, start + radius); ++y) {
+                const float* in = src.ptr<float>(y);
+                for (int x = 0; x < width; ++x) {
+                    sums[x] += in[x];
+                }
+            }
+
+            for (int y = start; y < end; ++y) {
+                if (y + radius < height) {
+                    const float* entering = src.ptr<float>(y + radius);
+                    for (int x = 0; x < width; ++x) {
+                        sums[x] += entering[x];
+                    }
+                }
+                //the primed sums start at the band's first window, so nothing leaves before the second row
+                if (y > start && y - radius - 1 >= 0) {
+                    const float* leaving = src.ptr<float>(y - radius - 1);
+                    for (int x = 0; x < width; ++x) {
+                        sums[x] -= leaving[x];
+                    }
+                }
+                float* out = dst.ptr<float>(y);
+                for (int x = 0; x < width; ++x) {
+                    out[x] = (float)sums[x];
+                }
+            }
+        }
+    }
+private:
+    const cv::Mat& src;
+    int radius;
+    cv::Mat& dst;
+};
+
+/**
+ * Fits the linear model of each window from the valid disparities in it. Windows without any valid disparity get no weight.
+ */
+class CoefficientBody : public cv::ParallelLoopBody
+{
+public:
+    CoefficientBody(const std::vector<cv::Mat>& sums, float epsilon, cv::Mat& a, cv::Mat& b, cv::Mat& weight)
+        : sums(sums), epsilon(epsilon), a(a), b(b), weight(weight) {}
+
+    void operator()(const cv::Range& range) const {
+        for (int y = range.start; y < range.end; ++y) {
+            const float* count = sums[VALID].ptr<float>(y);
+            const float* guide = sums[GUIDE].ptr<float>(y);
+            const float* disparity = sums[DISPARITY].ptr<float>(y);
+            const float* guide_disparity = sums[GUIDE_DISPARITY].ptr<float>(y);
+            const float* guide_squared = sums[GUIDE_SQUARED].ptr<float>(y);
+            float* out_a = a.ptr<float>(y);
+            float* out_b = b.ptr<float>(y);
+            float* out_weight = weight.ptr<float>(y);
+            for (int x = 0; x < a.cols; ++x) {
+                //counts are whole numbers, so anything below a half is an empty window
+                float valid = count[x] > 0.5f ? 1.0f : 0.0f;
+                float inverse = valid / std::max(count[x], 1.0f);
+                float mean_guide = guide[x] * inverse;
+                float mean_disparity = disparity[x] * inverse;
+                float covariance = guide_disparity[x] * inverse - mean_guide * mean_disparity;
+                float variance = std::max(guide_squared[x] * inverse - mean_guide * mean_guide, 0.0f);
+                float slope = covariance / (variance + epsilon);
+                out_a[x] = valid * slope;
+                out_b[x] = valid * (mean_disparity - slope * mean_guide);
+                out_weight[x] = valid;
+            }
+        }
+    }
+private:
+    const std::vector<cv::Mat>& sums;
+    float epsilon;
+    cv::Mat& a;
+    cv::Mat& b;
+    cv::Mat& weight;
+};
+
+/**
+ * Evaluates the averaged linear models at each pixel's guide intensity, and the confidence if it's wanted.
+ */
+class OutputBody : public cv::ParallelLoopBody
+{
+public:
+    OutputBody(const cv::Mat& guide, const cv::Mat& sum_a, const cv::Mat& sum_b, const cv::Mat& sum_weight,
+               const std::vector<cv::Mat>& sums, int radius, float sigma_confidence, short invalid, cv::Mat& filtered, cv::Mat* confidence)
+        : guide(guide), sum_a(sum_a), sum_b(sum_b), sum_weight(sum_weight), sums(sums), radius(radius),
+          sigma_confidence(sigma_confidence), invalid(invalid), filtered(filtered), confidence(confidence) {}
+
+    void operator()(const cv::Range& range) const {
+        const int width = guide.cols;
+        const int height = guide.rows;
+        for (int y = range.start; y < range.end; ++y) {
+            const float* intensities = guide.ptr<float>(y);
+            const float* a = sum_a.ptr<float>(y);
+            const float* b = sum_b.ptr<float>(y);
+            const float* weight = sum_weight.ptr<float>(y);
+            short* out = filtered.ptr<short>(y);
+            for (int x = 0; x < width; ++x) {
+                float inverse = 1.0f / std::max(weight[x], 1.0f);
+                float pixels = (a[x] * intensities[x] + b[x]) * inverse;
+                out[x] = weight[x] > 0.5f ? (short)cvRound(pixels * 16) : invalid;
+            }
+
+            if (confidence) {
+                //confidence falls with the share of invalid disparities in the window and with how much its disparities spread
+                const float* count = sums[VALID].ptr<float>(y);
+                const float* disparity = sums[DISPARITY].ptr<float>(y);
+                const float* disparity_squared = sums[DISPARITY_SQUARED].ptr<float>(y);
+                uchar* out_confidence = confidence->ptr<uchar>(y);
+                float rows = (float)(std::min(y + radius, height - 1) - std::max(y - radius, 0) + 1);
+                float inverse_sigma = 1.0f / (sigma_confidence * sigma_confidence);
+                for (int x = 0; x < width; ++x) {
+                    float columns = (float)(std::min(x + radius, width - 1) - std::max(x - radius, 0) + 1);
+                    float inverse = 1.0f / std::max(count[x], 1.0f);
+                    float mean = disparity[x] * inverse;
+                    float variance = std::max(disparity_squared[x] * inverse - mean * mean, 0.0f);
+                    float share = count[x] / (rows * columns);
+                    out_confidence[x] = cv::saturate_cast<uchar>(255.0f * share / (1.0f + variance * inverse_sigma));
+                }
+            }
+        }
+    }
+private:
+    const cv::Mat& guide;
+    const cv::Mat& sum_a;
+    const cv::Mat& sum_b;
+    const cv::Mat& sum_weight;
+    const std::vector<cv::Mat>& sums;
+    int radius;
+    float sigma_confidence;
+    short invalid;
+    cv::Mat& filtered;
+    cv::Mat* confidence;
+};
+
+}
+
+/**
+ * Constructor. The filter starts disabled.
+ * @param epsilon Regularization, in squared gray levels. Windows whose guide varies less than this are smoothed flat,
+ * stronger guide edges are kept.
+ * @param sigma_confidence Disparity spread within a window, in pixels, at which the confidence is halved.
+ */
+GuidedFilter::GuidedFilter(float epsilon, float sigma_confidence)
+    : radius(0), epsilon(epsilon), sigma_confidence(sigma_confidence), planes(PLANE_COUNT), sums(PLANE_COUNT)
+{
+}
+
+/**
+ * Set the window radius.
+ * @param radius Window radius in pixels, 0 disables the filter.
+ */
+void GuidedFilter::configure(int radius) {
+    this->radius = std::max(radius, 0);
+}
+
+/**
+ * @return True if the filter changes its input.
+ */
+bool GuidedFilter::is_enabled() const {
+    return radius > 0;
+}
+
+/**
+ * Filter a disparity map.
+ * @param disparity The CV_16SC1 disparity map.
+ * @param guide The eye the map was matched for, at the same size (gray or BGR).
+ * @param invalid The disparity value of invalid pixels.
+ * @param filtered Receives the filtered CV_16SC1 disparity map. Pixels with no valid disparity within the radius stay invalid.
+ * @param confidence If not null, receives the CV_8UC1 confidence of each pixel, 0 to 255. When the filter is off, it is 255 for
+ * valid disparities and 0 for invalid ones.
+ */
+void GuidedFilter::filter(const cv::Mat& disparity, const cv::Mat& guide, short invalid, cv::Mat& filtered, cv::Mat* confidence) {
+    if (!is_enabled()) {
+        filtered = disparity;
+        //without the window statistics, all that's known is which pixels matched
+        if (confidence) {
+            cv::compare(disparity, invalid, *confidence, cv::CMP_GT);
+        }
+        return;
+    }
+
+    if (guide.channels() == 1) {
+        guide_gray = guide;
+    } else {
+        cvtColor(guide, guide_gray, CV_BGR2GRAY);
+    }
+    guide_gray.convertTo(guide_float, CV_32F);
+
+    cv::Size size = disparity.size();
+    for (int plane = 0; plane < PLANE_COUNT; ++plane) {
+        planes[plane].create(size, CV_32FC1);
+        sums[plane].create(size, CV_32FC1);
+    }
+    cv::Range rows(0, size.height);
+    cv::parallel_for_(rows, PrepareBody(disparity, guide_float, invalid, planes));
+    for (int plane = 0; plane < PLANE_COUNT; ++plane) {
+        box(planes[plane], sums[plane]);
+    }
+
+    coefficients_a.create(size, CV_32FC1);
+    coefficients_b.create(size, CV_32FC1);
+    coefficients_weight.create(size, CV_32FC1);
+    cv::parallel_for_(rows, CoefficientBody(sums, epsilon, coefficients_a, coefficients_b, coefficients_weight));
+    box(coefficients_a, sum_a);
+    box(coefficients_b, sum_b);
+    box(coefficients_weight, sum_weight);
+
+    filtered.create(size, CV_16SC1);
+    if (confidence) {
+        confidence->create(size, CV_8UC1);
+    }
+    cv::parallel_for_(rows, OutputBody(guide_float, sum_a, sum_b, sum_weight, sums, radius, sigma_confidence, invalid, filtered, confidence));
+}
+
+/**
+ * Box sum over the (2 radius + 1) square window, clipped at the borders.
+ * @param src The CV_32FC1 plane.
+ * @param dst Receives the CV_32FC1 sums.
+ */
+void GuidedFilter::box(const cv::Mat& src, cv::Mat& dst) {
+    row_sums.create(src.size(), CV_32FC1);
+    dst.create(src.size(), CV_32FC1);
+    cv::parallel_for_(cv::Range(0, src.rows), HorizontalBoxBody(src, radius, row_sums));
+    cv::parallel_for_(cv::Range(0, (src.rows + BAND_ROWS - 1) / BAND_ROWS), VerticalBoxBody(row_sums, radius, dst));
+}
@@ -0,0 +1,38 @@
+#ifndef GUIDEDFILTER_H
+#define GUIDEDFILTER_H
+
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+/**
+ * Edge-preserving guided filter for disparity maps, with the left eye as the guide. It removes matching noise and fills
+ * holes (invalid pixels, e.g. occlusions masked by the cross check) while keeping depth edges on image edges.
+ * Within each window the disparity is fitted as a linear function of the guide intensity, using only the valid disparities,
+ * and the fits of all windows covering a pixel are averaged. Everything is built from box filters computed with running
+ * sums, so the cost per pixel doesn't depend on the radius. All passes run in parallel over bands of rows.
+ * Optionally it also produces a per-pixel confidence: high where the window is mostly valid and its disparities agree.
+ */
+class GuidedFilter
+{
+public:
+    GuidedFilter(float epsilon = 100.0f, float sigma_confidence = 1.0f);
+
+    void configure(int radius);
+    bool is_enabled() const;
+
+    void filter(const cv::Mat& disparity, const cv::Mat& guide, short invalid, cv::Mat& filtered, cv::Mat* confidence = 0);
+private:
+    void box(const cv::Mat& src, cv::Mat& dst);
+
+    int radius;
+    float epsilon, sigma_confidence;
+
+    //work planes, kept between frames so filtering doesn't allocate once the frame size is settled
+    cv::Mat guide_gray, guide_float;
+    std::vector<cv::Mat> planes, sums;
+    cv::Mat coefficients_a, coefficients_b, coefficients_weight, sum_a, sum_b, sum_weight;
+    cv::Mat row_sums;
+};
+
+#endif // GUIDEDFILTER_H
@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <csignal>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "liveprocessor.h"
+#include "processor.h"
+#include "tracer.h"
+
+namespace {
+
+/**
+ * One step of degradation, relative to the configured settings.
+ */
+struct LiveLevel {
+    double scale;          //multiplies the match scale
+    int disparity_divisor; //divides the disparity range
+};
+
+//tried in order while the latency is over budget
+const LiveLevel LIVE_LEVELS[] = {
+    {1.0,  1},
+    {0.75, 1},
+    {0.5,  1},
+    {0.5,  2},
+    {0.35, 2},
+    {0.25, 4}
+};
+const size_t LIVE_LEVEL_COUNT = sizeof(LIVE_LEVELS) / sizeof(LIVE_LEVELS[0]);
+
+//frames have to come in under this fraction of the budget, this many times in a row, before quality is raised again
+const double LIVE_RECOVER_FRACTION = 0.6;
+const size_t LIVE_RECOVER_FRAMES = 15;
+
+//set by Ctrl-C, so the run can stop cleanly and still report
+volatile std::sig_atomic_t g_live_interrupted = 0;
+
+void live_interrupt(int) {
+    g_live_interrupted = 1;
+}
+
+}
+
+/**
+ * Constructor. Opens the live source: an all-digit source is a capture device index, anything else a file or stream URL.
+ * Plain files are paced at their native frame rate so they behave like a live source.
+ * Throws std::runtime_error if the source can't be opened, or if --confidence or --points is set.
+ * @param args The processing arguments, including --live and --latency.
+ * @param report The stream to write per-frame latency and the summary to.
+ */
+LiveProcessor::LiveProcessor(Arguments& args, std::ostream& report)
+    : arguments(args), report(report), slot_full(false), ended(false), captured_frames(0), dropped_frames(0)
+{
+    //only the video is written live, a confidence map or point cloud per frame would blow the latency budget
+    if (!arguments.get_value<std::string>(Arguments::CONFIDENCE_FILENAME).empty() || !arguments.get_value<std::string>(Arguments::POINTS_FILENAME).empty()) {
+        throw std::runtime_error("Error: --confidence and --points can't be used with --live");
+    }
+
+    std::string source_name = arguments.get_value<std::string>(Arguments::LIVE_SOURCE);
+    bool device = !source_name.empty() && source_name.find_first_not_of("0123456789") == std::string::npos;
+    if (device) {
+        source.open(std::stoi(source_name));
+    } else {
+        source.open(source_name);
+    }
+    if (!source.isOpened()) {
+        throw std::runtime_error("Error: live source [" + source_name + "] cannot be opened");
+    }
+
+    paced = !device && source_name.find("://") == std::string::npos;
+    fps = source.get(CV_CAP_PROP_FPS);
+    if (!(fps > 0)) {
+        fps = 25;
+    }
+}
+
+/**
+ * Process the live source until it ends or the user interrupts it, then report the latency statistics.
+ * Throws std::runtime_error if processing fails.
+ */
+void LiveProcessor::run() {
+    std::chrono::milliseconds budget(arguments.get_value<int>(Arguments::LATENCY));
+    void (*previous_handler)(int) = std::signal(SIGINT, live_interrupt);
+
+    //matching settings are changed on a private copy, so the user's settings stay the reference for every level
+    Arguments live_arguments(arguments);
+    std::unique_ptr<Processor> processor;
+    std::shared_ptr<cv::VideoWriter> output;
+
+    std::thread capture_thread(&LiveProcessor::capture_frames, this);
+    Tracer::name_thread("live matcher");
+
+    cv::Mat frame, disparity, output_colour;
+    std::vector<double> latencies;
+    size_t level = 0, fast_frames = 0;
+    try {
+        while (!g_live_interrupted) {
+            Clock::time_point frame_time;
+            size_t dropped;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                TraceSpan span("wait frame");
+                while (!slot_full && !ended && !g_live_interrupted) {
+                    captured.wait_for(lock, std::chrono::milliseconds(100));
+                }
+                if (!slot_full) {
+                    break;
+                }
+                //take the newest frame, and leave the old buffer for the capture thread to reuse
+                std::swap(frame, slot);
+                slot_full = false;
+                frame_time = slot_time;
+                dropped = dropped_frames;
+            }
+
+            //the layout can only be detected once there's a frame to look at
+            if (!processor) {
+                StereoLayout::Type layout_type = StereoLayout::from_string(arguments.get_value<std::string>(Arguments::LAYOUT));
+                if (layout_type == StereoLayout::SEPARATE) {
+                    throw std::runtime_error("Error: the separate layout can't be used live");
+                } else if (layout_type == StereoLayout::AUTO) {
+                    layout_type = StereoLayout::detect(frame);
+                }
+                processor.reset(new Processor(live_arguments, frame.size(), layout_type));
+                output.reset(new cv::VideoWriter(arguments.get_value<std::string>(Arguments::OUTPUT_FILENAME),
+                                                 arguments.get_value<int>(Arguments::OUTPUT_FOURCC), fps, processor->get_video_size(), true));
+                report << "Live " << frame.cols << "x" << frame.rows << " " << StereoLayout::to_string(layout_type) << " at "
+                       << fps << " fps, latency budget " << budget.count() << " ms" << std::endl;
+            }
+
+            apply_level(live_arguments, level);
+            processor->compute_depth(frame, cv::Mat(), disparity);
+            processor->to_video_frame(disparity, processor->get_video_size(), output_colour);
+            if (output->isOpened()) {
+                TraceSpan span("encode");
+                *output << output_colour;
+            }
+
+            double latency = std::chrono::duration<double, std::milli>(Clock::now() - frame_time).count();
+            latencies.push_back(latency);
+            report << "frame " << latencies.size() << ":\t" << latency << " ms\tlevel " << level
+                   << " (scale " << live_arguments.get_value<double>(Arguments::MATCH_SCALE)
+                   << ", " << live_arguments.get_value<int>(Arguments::NUM_DISPARITIES) << " disparities)\t"
+                   << dropped << " dropped" << std::endl;
+
+            //degrade straight away when over budget, recover only after a run of comfortable frames
+            if (latency > budget.count()) {
+                level = std::min(level + 1, LIVE_LEVEL_COUNT - 1);
+                fast_frames = 0;
+            } else if (latency < budget.count() * LIVE_RECOVER_FRACTION && level > 0) {
+                if (++fast_frames >= LIVE_RECOVER_FRAMES) {
+                    --level;
+                    fast_frames = 0;
+                }
+            } else {
+                fast_frames = 0;
+            }
+        }
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ended = true;
+        }
+        capture_thread.join();
+        std::signal(SIGINT, previous_handler);
+        throw;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ended = true;
+    }
+    capture_thread.join();
+    std::signal(SIGINT, previous_handler);
+
+    if (latencies.empty()) {
+        report << "No frames were processed" << std::endl;
+        return;
+    }
+    std::vector<double> sorted(latencies);
+    std::sort(sorted.begin(), sorted.end());
+    double total = 0;
+    for (double latency : latencies) {
+        total += latency;
+    }
+    report << "Processed " << latencies.size() << " of " << captured_frames << " frames (" << dropped_frames << " dropped). Latency: mean "
+           << total / latencies.size() << " ms, 95th percentile " << sorted[std::min(sorted.size() - 1, sorted.size() * 95 / 100)]
+           << " ms, max " << sorted.back() << " ms" << std::endl;
+}
+
+/**
+ * Capture thread: read frames as they come (or at the native frame rate for paced files) and publish each one in the slot,
+ * replacing a frame that wasn't taken in time. Three buffers rotate between the decoder, the slot and the matcher.
+ */
+void LiveProcessor::capture_frames() {
+    Tracer::name_thread("live capture");
+    cv::Mat grabbed;
+    Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps));
+    Clock::time_point due = Clock::now();
+
+    while (!g_live_interrupted) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (ended) {
+                return;
+            }
+        }
+        {
+            TraceSpan span("capture");
+            if (!source.read(grabbed)) {
+                break;
+            }
+        }
+        if (paced) {
+            due += period;
+            std::this_thread::sleep_until(due);
+        }
+        Clock::time_point now = Clock::now();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (slot_full) {
+            ++dropped_frames;
+        }
+        std::swap(grabbed, slot);
+        slot_time = now;
+        slot_full = true;
+        ++captured_frames;
+        captured.notify_one();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ended = true;
+    captured.notify_one();
+}
+
+/**
+ * Set the matching resolution and disparity range of a degradation level, relative to the configured ones.
+ * The disparity range stays a non-zero multiple of 16.
+ * @param live_arguments The arguments the processor runs on.
+ * @param level The degradation level, 0 for the configured settings.
+ */
+void LiveProcessor::apply_level(Arguments& live_arguments, size_t level) const {
+    const LiveLevel& live_level = LIVE_LEVELS[level];
+    double scale = arguments.get_value<double>(Arguments::MATCH_SCALE) * live_level.scale;
+    int disparities = arguments.get_value<int>(Arguments::NUM_DISPARITIES) / live_level.disparity_divisor;
+    live_arguments.set_value<double>(Arguments::MATCH_SCALE, scale);
+    live_arguments.set_value<int>(Arguments::NUM_DISPARITIES, std::max(16, disparities / 16 * 16));
+}
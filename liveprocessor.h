@@ -0,0 +1,49 @@
+#ifndef LIVEPROCESSOR_H
+#define LIVEPROCESSOR_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#include "opencv2/highgui/highgui.hpp" //VideoCapture
+#include "arguments.hpp"
+
+/**
+ * Runs the processor on a live source (a capture device index, a network stream, or a file paced at its native fps to
+ * stand in for one) within a latency budget.
+ * A capture thread keeps grabbing frames into a single slot, so a frame the matcher hasn't taken by the time the next one
+ * arrives is dropped instead of queueing up. When the end-to-end latency (capture to finished depth map) goes over budget,
+ * matching degrades step by step: a lower match resolution first, then a narrower disparity range. It recovers a step at a
+ * time once frames are comfortably within budget again.
+ */
+class LiveProcessor
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    LiveProcessor(Arguments& args, std::ostream& report);
+
+    void run();
+private:
+    void capture_frames();
+    void apply_level(Arguments& live_arguments, size_t level) const;
+
+    Arguments& arguments;
+    std::ostream& report;
+
+    cv::VideoCapture source;
+    bool paced;
+    double fps;
+
+    //the capture slot: the newest frame that hasn't been taken yet
+    std::mutex mutex;
+    std::condition_variable captured;
+    cv::Mat slot;
+    Clock::time_point slot_time;
+    bool slot_full, ended;
+    size_t captured_frames, dropped_frames;
+};
+
+#endif // LIVEPROCESSOR_H
@@ -7,10 +7,20 @@
 #include "opencv2/calib3d/calib3d.hpp" //StereoSGBM
 
 #include <argp.h>
+#include <fstream> //ifstream
 #include <iostream> //cerr
+#include <sstream> //istringstream
 
 #include "arguments.hpp"
+#include "batchscheduler.h"
+#include "fanout.h"
+#include "liveprocessor.h"
+#include "numaplacement.h"
 #include "processor.h"
+#include "rangeestimator.h"
+#include "rawstream.h"
+#include "regressioncheck.h"
+#include "tracer.h"
 #include "qtopencvdepthmap.h"
 
 const char* argp_program_version = "stereo_to_depthmap 0.1";
@@ -28,6 +38,22 @@ static struct argp_option options[] =
 {"fourcc"           ,    'f',    "CODE", 0,                                                   "Four lettercode for the output codec. Default IYUV.", 1},
 {"infile"           ,    'i',  "INFILE", 0,                               "The video file to read from. Currently required for headless operation.", 1},
 {"outfile"          ,    'o', "OUTFILE", 0,                                                   "The video file to write out to. Default output.avi.", 1},
+{"output-size"      ,   1036,     "WxH", 0,                                  "Scale the written video to WxH. Default the input's display size.", 1},
+{"fan-out"          ,   1037, "OPTIONS", 0,"Headless only, repeatable. Also write another output from the same decode, with its own options (-o, -f, --output-size, matching).", 1},
+{"confidence"       ,   1028, "OUTFILE", 0,         "Also write a per-pixel confidence video (bright is reliable), most informative with --post-filter.", 1},
+{"points"           ,   1029, "OUTFILE", 0,     "Also write each frame as a 3D point cloud, reprojected with the Q matrix of --calibration.", 1},
+{"points-format"    ,   1030,    "NAME", 0,   "Point cloud format: ply (a binary file per frame, OUTFILE may hold %d) or float (one packed stream). Default ply.", 1},
+{"cache"            ,   1039,     "DIR", 0,   "Keep raw matcher output in DIR, so re-exports with the same matching settings skip matching. Default off.", 1},
+{"cache-size"       ,   1040,      "MB", 0,                          "Delete the least recently used cache entries beyond MB. Default 4096, 0 unlimited.", 1},
+{"raw-size"         ,   1041,     "WxH", 0,                     "Read the input (and right eye) file as headerless WxH frames in --pix-fmt, memory mapped.", 1},
+{"right-infile"     ,   1013,  "INFILE", 0,                          "Right eye video file, when the eyes are stored separately. Implies --layout separate.", 1},
+{"layout"           ,   1014,    "NAME", 0,                       "Stereo packing: auto, sbs, half-sbs, tb, half-tb or separate. Default auto (detected from the content).", 1},
+{"stream"           ,   1021,     "WxH", 0,      "Read raw WxH frames from stdin and write raw disparity frames to stdout. Implies --nogui.", 1},
+{"pix-fmt"          ,   1022,    "NAME", 0,                                  "Stream and --raw-size input pixel format: gray, bgr24, rgb24 or yuv420p (--raw-size only). Default bgr24.", 1},
+{"out-pix-fmt"      ,   1023,    "NAME", 0,  "Stream output pixel format: gray (as in the video output) or gray16le (raw 16x disparity). Default gray.", 1},
+{"live"             ,   1024,  "SOURCE", 0, "Process a live source (device index, stream URL, or a file paced at its fps) within --latency. Implies --nogui.", 1},
+{"latency"          ,   1025,      "MS", 0,     "Live only. End-to-end latency budget; matching degrades to stay within it. Default 100.", 1},
+{"calibration"      ,   1012,    "FILE", 0,        "OpenCV YAML/XML stereo calibration (M1 D1 M2 D2, and R1 R2 P1 P2 or R T). Eyes are rectified before matching.", 1},
 {"startFrame"       ,    's',   "INDEX", 0,                                               "Optional starting frame for clip processing. Default 0.", 1},
 {"endFrame"         ,    'e',   "INDEX", 0,                                                 "Optional ending frame for clip processing. Default 0.", 1},
 {"disparity"        ,    'd',   "VALUE", 0,                           "Number of pixels to search across. Needs to be divisible by 16. Default 16.", 2},
@@ -41,6 +67,28 @@ static struct argp_option options[] =
 {"speckleWindowSize",   1003,   "VALUE", 0,                        "Maximum size of smooth disparity regions. Should be 50<=VALUE,=200. Default 0.", 3},
 {"speckleRange"     ,   1004,   "VALUE", 0,                       "Maximum disparity variation within each component. Should be 1 or 2. Default 0.", 3},
 {"fullDP"           ,   1005,         0, 0,    "If run the full-scale two-pass dynamic programming algorithm. Takes lots of memory. Default false.", 3},
+{"auto-range"       ,   1034,         0, 0,  "Headless only. Estimate minDisparity and disparity from frames sampled across the clip before processing. Default false.", 3},
+{"roi"              ,   1035, "WxH+X+Y", 0,   "Only match this region of the left eye (plus the border matching needs). The rest is invalid. Default whole frame.", 3},
+{"match-scale"      ,   1011,"FRACTION", 0,  "Match at this fraction of the input resolution, then upsample guided by the left eye. Default 1.0.", 3},
+{"max-memory"       ,   1010,      "MB", 0,   "Matcher memory budget. Frames that need more are matched in overlapping strips. Default 0 (unlimited).", 3},
+{"both-eyes"        ,   1016,         0, 0,      "Output depth maps for both eyes, matched concurrently and packed like the input. Default false.", 3},
+{"cross-check"      ,   1017,  "PIXELS", 0,"Mask pixels whose left and right eye disparities differ by more than PIXELS (occlusions). Default -1 (off).", 3},
+{"temporal"         ,   1026,  "FRAMES", 0,   "Stabilize flickering disparity over the last FRAMES frames, edge-aware, reset at scene cuts. Default 0 (off).", 3},
+{"post-filter"      ,   1027,  "RADIUS", 0, "Guided filter the disparity with the left eye, removing noise and filling holes, over RADIUS pixels. Default 0 (off).", 3},
+{"luma"             ,   1015,         0, 0,           "Match on the luma only, extracted while splitting the eyes. Faster than colour. Default false.", 3},
+{"engine"           ,   1006,    "NAME", 0, "Stereo matching engine: sgbm, bm (much faster, for previews and drafts) or census (in-house SIMD SGM). Default sgbm.", 2},
+{"textureThreshold" ,   1007,   "VALUE", 0,                   "StereoBM only. Minimum texture in the window for a match to be kept. Default 10.", 4},
+{"preFilterSize"    ,   1008,   "VALUE", 0,                     "StereoBM only. Size of the normalizing pre-filter. Odd, within [5, 255]. Default 9.", 4},
+{"batch"            ,   1018,"MANIFEST", 0,     "Headless only. Process every job in MANIFEST, one line of options (-i, -o, -d, -s, -e, ...) per job.", 0},
+{"jobs"             ,   1019,       "N", 0,             "Batch only. Number of jobs run at once. Default 0 (a quarter of the hardware threads).", 0},
+{"batch-memory"     ,   1043,      "MB", 0, "Batch only. Matcher memory of all running jobs together. A job only starts when it fits. Default 0 (unlimited).", 0},
+{"numa"             ,   1038,    "NODE", 0,"Headless only. Keep threads and frame memory on NUMA node NODE, or auto (batch: spread workers over the nodes). Default off.", 0},
+{"priority"         ,   1020,   "VALUE", 0,                          "Batch only, set per job. Jobs with a higher priority start first. Default 0.", 0},
+{"trace"            ,   1031,    "FILE", 0,    "Record every stage of every frame on every thread to FILE as Chrome trace-event JSON (for Perfetto).", 0},
+{"self-test"        ,   1032,     "DIR", 0,  "Run the quality and speed regression checks against the golden maps and baselines in DIR. Implies --nogui.", 0},
+{"record"           ,   1042,         0, 0,              "Self-test only. Write missing golden maps and baselines instead of failing on them. Default false.", 0},
+{"perf-tolerance"   ,   1033,     "PCT", 0,                    "Self-test only. Fail when frames/s drop more than PCT% below the baseline. Default 20.", 0},
+{"benchmark"        ,   1009,  "FRAMES", 0,         "Headless only. Time every engine on FRAMES frames from startFrame instead of writing output.", 0},
 {0                  ,      0,         0, 0,                                                                                                       0, 0}
 };
 
@@ -69,6 +117,21 @@ parse_opt (int key, char *arg, struct argp_state *state)
         case 'c': //nogui
             arguments->set_value<bool>(Arguments::NOGUI, true);
             break;
+        case 1018: //batch
+            arguments->set_value<std::string>(Arguments::BATCH_FILENAME, std::string(arg));
+            break;
+        case 1038: //numa
+            arguments->set_value<std::string>(Arguments::NUMA, std::string(arg));
+            break;
+        case 1019: //jobs
+            arguments->set_value<int>(Arguments::JOBS, std::stoi(arg));
+            break;
+        case 1020: //priority
+            arguments->set_value<int>(Arguments::PRIORITY, std::stoi(arg));
+            break;
+        case 1009: //benchmark
+            arguments->set_value<int>(Arguments::BENCHMARK, std::stoi(arg));
+            break;
 
         //group 1 - input/output
         case 'f': //fourcc
@@ -80,6 +143,51 @@ parse_opt (int key, char *arg, struct argp_state *state)
         case 'o': //outfile
             arguments->set_value<std::string>(Arguments::OUTPUT_FILENAME, std::string(arg));
             break;
+        case 1036: //output-size
+            arguments->set_value<std::string>(Arguments::OUTPUT_SIZE, std::string(arg));
+            break;
+        case 1037: //fan-out
+            {
+                //one branch per line
+                std::string fan_outs = arguments->get_value<std::string>(Arguments::FAN_OUTS);
+                arguments->set_value<std::string>(Arguments::FAN_OUTS, fan_outs.empty() ? std::string(arg) : fan_outs + "\n" + arg);
+            }
+            break;
+        case 1039: //cache
+            arguments->set_value<std::string>(Arguments::CACHE_DIRECTORY, std::string(arg));
+            break;
+        case 1040: //cache-size
+            arguments->set_value<int>(Arguments::CACHE_SIZE, std::stoi(arg));
+            break;
+        case 1041: //raw-size
+            arguments->set_value<std::string>(Arguments::RAW_SIZE, std::string(arg));
+            break;
+        case 1013: //right-infile
+            arguments->set_value<std::string>(Arguments::RIGHT_FILENAME, std::string(arg));
+            break;
+        case 1014: //layout
+            arguments->set_value<std::string>(Arguments::LAYOUT, std::string(arg));
+            break;
+        case 1021: //stream
+            arguments->set_value<std::string>(Arguments::STREAM_SIZE, std::string(arg));
+            arguments->set_value<bool>(Arguments::NOGUI, true);
+            break;
+        case 1022: //pix-fmt
+            arguments->set_value<std::string>(Arguments::STREAM_FORMAT, std::string(arg));
+            break;
+        case 1023: //out-pix-fmt
+            arguments->set_value<std::string>(Arguments::STREAM_OUTPUT_FORMAT, std::string(arg));
+            break;
+        case 1024: //live
+            arguments->set_value<std::string>(Arguments::LIVE_SOURCE, std::string(arg));
+            arguments->set_value<bool>(Arguments::NOGUI, true);
+            break;
+        case 1025: //latency
+            arguments->set_value<int>(Arguments::LATENCY, std::stoi(arg));
+            break;
+        case 1012: //calibration
+            arguments->set_value<std::string>(Arguments::CALIBRATION_FILENAME, std::string(arg));
+            break;
         case 's': //starting frame number
             arguments->set_value<int>(Arguments::START_FRAME, std::stoi(arg));
             break;
@@ -120,7 +228,70 @@ parse_opt (int key, char *arg, struct argp_state *state)
             arguments->set_value<int>(Arguments::SPECKLE_RANGE, std::stoi(arg));
             break;
         case 1005: //fullDP
-            arguments->set_value<int>(Arguments::FULL_DP, true);
+            arguments->set_value<bool>(Arguments::FULL_DP, true);
+            break;
+        case 1010: //max-memory
+            arguments->set_value<int>(Arguments::MAX_MEMORY, std::stoi(arg));
+            break;
+        case 1011: //match-scale
+            arguments->set_value<double>(Arguments::MATCH_SCALE, std::stod(arg));
+            break;
+        case 1015: //luma
+            arguments->set_value<bool>(Arguments::LUMA, true);
+            break;
+        case 1016: //both-eyes
+            arguments->set_value<bool>(Arguments::BOTH_EYES, true);
+            break;
+        case 1017: //cross-check
+            arguments->set_value<int>(Arguments::CROSS_CHECK, std::stoi(arg));
+            break;
+        case 1026: //temporal
+            arguments->set_value<int>(Arguments::TEMPORAL, std::stoi(arg));
+            break;
+        case 1027: //post-filter
+            arguments->set_value<int>(Arguments::POST_FILTER, std::stoi(arg));
+            break;
+        case 1028: //confidence
+            arguments->set_value<std::string>(Arguments::CONFIDENCE_FILENAME, std::string(arg));
+            break;
+        case 1029: //points
+            arguments->set_value<std::string>(Arguments::POINTS_FILENAME, std::string(arg));
+            break;
+        case 1030: //points-format
+            arguments->set_value<std::string>(Arguments::POINTS_FORMAT, std::string(arg));
+            break;
+        case 1031: //trace
+            arguments->set_value<std::string>(Arguments::TRACE_FILENAME, std::string(arg));
+            break;
+        case 1032: //self-test
+            arguments->set_value<std::string>(Arguments::SELF_TEST_DIRECTORY, std::string(arg));
+            arguments->set_value<bool>(Arguments::NOGUI, true);
+            break;
+        case 1042: //record
+            arguments->set_value<bool>(Arguments::RECORD_REFERENCES, true);
+            break;
+        case 1043: //batch-memory
+            arguments->set_value<int>(Arguments::BATCH_MEMORY, std::stoi(arg));
+            break;
+        case 1033: //perf-tolerance
+            arguments->set_value<int>(Arguments::PERF_TOLERANCE, std::stoi(arg));
+            break;
+        case 1034: //auto-range
+            arguments->set_value<bool>(Arguments::AUTO_RANGE, true);
+            break;
+        case 1035: //roi
+            arguments->set_value<std::string>(Arguments::ROI, std::string(arg));
+            break;
+        case 1006: //engine
+            arguments->set_value<std::string>(Arguments::ENGINE, std::string(arg));
+            break;
+
+        //group 4 - information specific to StereoBM
+        case 1007: //textureThreshold
+            arguments->set_value<int>(Arguments::TEXTURE_THRESHOLD, std::stoi(arg));
+            break;
+        case 1008: //preFilterSize
+            arguments->set_value<int>(Arguments::PRE_FILTER_SIZE, std::stoi(arg));
             break;
         case ARGP_KEY_NO_ARGS:
             //no arguments is valid
@@ -154,6 +325,206 @@ The ARGP structure itself.
 */
 static struct argp argp = {options, parse_opt, args_doc, doc, 0, 0, 0};
 
+/**
+ * Split one manifest line into words. Words are separated by whitespace, and double quotes group words that contain spaces.
+ * @param line The manifest line.
+ * @return The words of the line.
+ */
+static std::vector<std::string> split_manifest_line(const std::string& line) {
+    std::vector<std::string> words;
+    std::string word;
+    bool quoted = false, in_word = false;
+    for (char c : line) {
+        if (c == '"') {
+            quoted = !quoted;
+            in_word = true;
+        } else if (!quoted && (c == ' ' || c == '\t')) {
+            if (in_word) {
+                words.push_back(word);
+                word.clear();
+                in_word = false;
+            }
+        } else {
+            word += c;
+            in_word = true;
+        }
+    }
+    if (in_word) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+/**
+ * Parse words of command-line options (a manifest line or a fan-out branch) on top of existing arguments, and validate them.
+ * Throws std::runtime_error if the options are unknown, malformed or invalid.
+ * @param words The options, as split by split_manifest_line.
+ * @param arguments The arguments to parse into.
+ * @param error The start of the error message, naming where the options came from.
+ */
+static void parse_option_words(std::vector<std::string>& words, Arguments& arguments, const std::string& error) {
+    std::vector<char*> option_argv;
+    option_argv.push_back(const_cast<char*>("stereo_to_depthmap"));
+    for (std::string& word : words) {
+        option_argv.push_back(&word[0]);
+    }
+    option_argv.push_back(0);
+
+    try {
+        if (argp_parse(&argp, option_argv.size() - 1, option_argv.data(), ARGP_NO_EXIT, 0, &arguments) != 0) {
+            throw std::runtime_error(error + " has unknown options");
+        }
+    } catch (std::logic_error& e) {
+        //std::stoi and friends on a malformed value
+        throw std::runtime_error(error + " has a malformed value");
+    }
+    if (!arguments.is_valid(false) && !arguments.is_valid(true)) {
+        throw std::runtime_error(error + " has invalid settings");
+    }
+}
+
+/**
+ * Read a batch manifest and queue its jobs. Each non-empty line that isn't a # comment is one job, written as command-line
+ * options. They're parsed on top of the options given on the actual command line, so those act as defaults for every job.
+ * Throws std::runtime_error if the manifest can't be read or a job's options are invalid.
+ * @param filename The manifest file.
+ * @param defaults The command-line arguments.
+ * @param scheduler Receives the jobs.
+ */
+static void load_manifest(const std::string& filename, const Arguments& defaults, BatchScheduler& scheduler) {
+    std::ifstream manifest(filename.c_str());
+    if (!manifest) {
+        throw std::runtime_error("Error: batch manifest [" + filename + "] cannot be opened for reading");
+    }
+
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(manifest, line)) {
+        ++line_number;
+        std::vector<std::string> words = split_manifest_line(line);
+        if (words.empty() || words[0][0] == '#') {
+            continue;
+        }
+
+        Arguments job_arguments(defaults);
+        job_arguments.set_value<std::string>(Arguments::BATCH_FILENAME, std::string(""));
+        parse_option_words(words, job_arguments, "Error: batch manifest line " + std::to_string(line_number));
+        scheduler.add(job_arguments);
+    }
+}
+
+/**
+ * Parse the --fan-out branches. Each branch's options are parsed on top of the command line's, so a branch only needs to
+ * give what differs (at least its own -o).
+ * Throws std::runtime_error if a branch's options are invalid.
+ * @param arguments The command-line arguments.
+ * @return The arguments of every branch.
+ */
+static std::vector<Arguments> parse_fan_outs(const Arguments& arguments) {
+    std::vector<Arguments> branches;
+    std::istringstream fan_outs(arguments.get_value<std::string>(Arguments::FAN_OUTS));
+    std::string line;
+    while (std::getline(fan_outs, line)) {
+        std::vector<std::string> words = split_manifest_line(line);
+        if (words.empty()) {
+            continue;
+        }
+        Arguments branch_arguments(arguments);
+        branch_arguments.set_value<std::string>(Arguments::FAN_OUTS, std::string(""));
+        parse_option_words(words, branch_arguments, "Error: fan-out " + std::to_string(branches.size() + 1));
+        if (branch_arguments.get_value<std::string>(Arguments::OUTPUT_FILENAME) == arguments.get_value<std::string>(Arguments::OUTPUT_FILENAME)) {
+            throw std::runtime_error("Error: fan-out " + std::to_string(branches.size() + 1) + " needs its own output file (-o)");
+        }
+        branches.push_back(branch_arguments);
+    }
+    return branches;
+}
+
+/**
+ * Pin a single headless run to its --numa node, before OpenCV starts its thread pool so the pool is created on the node
+ * too, and size the pool to the node's CPUs. Batch runs place each worker instead.
+ * Throws std::runtime_error if the node has no CPUs or the affinity can't be set.
+ * @param arguments The parsed and validated arguments.
+ */
+static void place_on_numa_node(const Arguments& arguments) {
+    int node = NumaPlacement::parse(arguments.get_value<std::string>(Arguments::NUMA));
+    if (node == NumaPlacement::OFF || !arguments.get_value<std::string>(Arguments::BATCH_FILENAME).empty()) {
+        return;
+    }
+    if (node == NumaPlacement::AUTO) {
+        node = NumaPlacement::current_node();
+    }
+    if (!NumaPlacement::pin_thread(node)) {
+        throw std::runtime_error("Error: cannot pin to NUMA node " + std::to_string(node));
+    }
+    cv::setNumThreads((int)NumaPlacement::get_nodes()[node].size());
+    //stdout may carry a raw stream
+    std::cerr << "Pinned to " << NumaPlacement::describe(node) << std::endl;
+}
+
+/**
+ * Run every job of a batch manifest in this process.
+ * @param arguments The parsed and validated arguments, used as defaults for every job.
+ * @return True if every job succeeded.
+ */
+static bool process_batch(Arguments& arguments) {
+    size_t memory_budget = (size_t)arguments.get_value<int>(Arguments::BATCH_MEMORY) * 1024 * 1024;
+    BatchScheduler scheduler(arguments.get_value<int>(Arguments::JOBS), memory_budget,
+                             NumaPlacement::parse(arguments.get_value<std::string>(Arguments::NUMA)), std::cout);
+    load_manifest(arguments.get_value<std::string>(Arguments::BATCH_FILENAME), arguments, scheduler);
+    return scheduler.run();
+}
+
+/**
+ * Run a headless job on an opened input feed: either a benchmark, or the clip export with its run statistics.
+ * @param arguments The parsed and validated arguments.
+ * @param feed_src The opened input video feed.
+ */
+static void process_headless(Arguments& arguments, cv::VideoCapture& feed_src) {
+    Processor processor(arguments, feed_src);
+    std::cout << "Stereo layout: " << StereoLayout::to_string(processor.get_layout().get_type()) << std::endl;
+    //the processor reads the disparity range every frame, so setting it now still applies
+    if (arguments.get_value<bool>(Arguments::AUTO_RANGE)) {
+        RangeEstimator(arguments, processor.get_layout(), std::cout).estimate();
+    }
+    int benchmark_frames = arguments.get_value<int>(Arguments::BENCHMARK);
+    if (benchmark_frames > 0) {
+        processor.benchmark({"sgbm", "bm", "census"}, benchmark_frames, std::cout);
+    } else {
+        size_t start_frame = arguments.get_value<int>(Arguments::START_FRAME);
+        size_t end_frame   = arguments.get_value<int>(Arguments::END_FRAME);
+
+        //every extra output is written from the same decode
+        std::vector<Arguments> branches = parse_fan_outs(arguments);
+        if (!branches.empty()) {
+            FanOut fan_out(processor, arguments, branches, std::cout);
+            fan_out.run(start_frame, end_frame);
+        } else {
+            std::shared_ptr<cv::VideoWriter> output = processor.create_writer();
+            size_t range = end_frame + 1 - start_frame;
+
+            size_t counter = 0;
+
+            processor.set_next_frame(start_frame);
+            for (size_t index = start_frame; index <=end_frame; ++index) {
+                ++counter;
+                std::cout << "Processing frame " << counter << " of " << range << " [" << 100*counter/range << "%]\r" << std::flush;
+                processor.process_next_frame(*output);
+            }
+            std::cout << std::endl;
+        }
+        std::cout << "Peak matcher memory: " << processor.get_peak_memory() / (1024 * 1024) << " MB";
+        if (processor.get_strip_count() > 1) {
+            std::cout << " (" << processor.get_strip_count() << " strips)";
+        }
+        std::cout << std::endl;
+        if (processor.get_disparity_cache().is_enabled()) {
+            std::cout << "Disparity cache: " << processor.get_disparity_cache().get_hits() << " frames reused, "
+                      << processor.get_disparity_cache().get_misses() << " matched" << std::endl;
+        }
+    }
+}
+
 /**
  * Main program structure. Sets up command-line arguments, decides whether to run with or without a gui, and then either executes the headless request or fires up the GUI.
  * @param argc Number of command-line arguments.
@@ -178,9 +549,61 @@ int main( int argc, char** argv ) {
         }
     }
 
+    if (EXIT_SUCCESS == retval && arguments.get_value<bool>(Arguments::NOGUI)) {
+        try {
+            place_on_numa_node(arguments);
+        } catch (std::runtime_error& e) {
+            std::cerr << "ERROR:\t" << e.what() << std::endl;
+            retval = EXIT_FAILURE;
+        }
+    }
+
+    std::string trace_filename = arguments.get_value<std::string>(Arguments::TRACE_FILENAME);
+    if (EXIT_SUCCESS == retval && !trace_filename.empty()) {
+        Tracer::start(trace_filename);
+        Tracer::name_thread("main");
+    }
+
     if (EXIT_SUCCESS == retval) {
-        if (arguments.get_value<bool>(Arguments::NOGUI)) {
-            cv::VideoCapture feed_src; //source video feed
+        if (arguments.get_value<bool>(Arguments::NOGUI) && !arguments.get_value<std::string>(Arguments::SELF_TEST_DIRECTORY).empty()) {
+            try {
+                RegressionCheck check(arguments, arguments.get_value<std::string>(Arguments::SELF_TEST_DIRECTORY), std::cout);
+                if (!check.run()) {
+                    retval = EXIT_FAILURE;
+                }
+            } catch (std::runtime_error& e) {
+                std::cerr << "ERROR:\t" << e.what() << std::endl;
+                retval = EXIT_FAILURE;
+            }
+        } else if (arguments.get_value<bool>(Arguments::NOGUI) && !arguments.get_value<std::string>(Arguments::LIVE_SOURCE).empty()) {
+            try {
+                LiveProcessor live(arguments, std::cout);
+                live.run();
+            } catch (std::runtime_error& e) {
+                std::cerr << "ERROR:\t" << e.what() << std::endl;
+                retval = EXIT_FAILURE;
+            }
+        } else if (arguments.get_value<bool>(Arguments::NOGUI) && !arguments.get_value<std::string>(Arguments::STREAM_SIZE).empty()) {
+            //stdout carries the frames, so everything else goes to stderr
+            try {
+                RawStream stream(arguments, stdin, stdout, std::cerr);
+                size_t frames = stream.run();
+                std::cerr << "Streamed " << frames << " frames" << std::endl;
+            } catch (std::runtime_error& e) {
+                std::cerr << "ERROR:\t" << e.what() << std::endl;
+                retval = EXIT_FAILURE;
+            }
+        } else if (arguments.get_value<bool>(Arguments::NOGUI) && !arguments.get_value<std::string>(Arguments::BATCH_FILENAME).empty()) {
+            try {
+                if (!process_batch(arguments)) {
+                    retval = EXIT_FAILURE;
+                }
+            } catch (std::runtime_error& e) {
+                std::cerr << "ERROR:\t" << e.what() << std::endl;
+                retval = EXIT_FAILURE;
+            }
+        } else if (arguments.get_value<bool>(Arguments::NOGUI)) {
+            MappedCapture feed_src(arguments); //source video feed
 
                 std::string input_filename = arguments.get_value<std::string>(Arguments::INPUT_FILENAME);
                 feed_src.open(input_filename);
@@ -188,22 +611,12 @@ int main( int argc, char** argv ) {
                     std::cerr << "ERROR:\tInput file [" << input_filename << "] cannot be opened for reading" << std::endl;
                     retval = EXIT_FAILURE;
                 } else {
-                    Processor processor(arguments, feed_src);
-                    std::shared_ptr<cv::VideoWriter> output = processor.create_writer();
-
-                    size_t start_frame = arguments.get_value<int>(Arguments::START_FRAME);
-                    size_t end_frame   = arguments.get_value<int>(Arguments::END_FRAME);
-                    size_t range = end_frame + 1 - start_frame;
-
-                    size_t counter = 0;
-
-                    processor.set_next_frame(start_frame);
-                    for (size_t index = start_frame; index <=end_frame; ++index) {
-                        ++counter;
-                        std::cout << "Processing frame " << counter << " of " << range << " [" << 100*counter/range << "%]\r" << std::flush;
-                        processor.process_next_frame(*output);
+                    try {
+                        process_headless(arguments, feed_src);
+                    } catch (std::runtime_error& e) {
+                        std::cerr << "ERROR:\t" << e.what() << std::endl;
+                        retval = EXIT_FAILURE;
                     }
-                    std::cout << std::endl;
                 }
         } else {
 
@@ -227,6 +640,14 @@ int main( int argc, char** argv ) {
         }
     }
 
+    //every worker thread has been joined by now, so the trace is complete
+    try {
+        Tracer::stop();
+    } catch (std::runtime_error& e) {
+        std::cerr << "ERROR:\t" << e.what() << std::endl;
+        retval = EXIT_FAILURE;
+    }
+
     return retval;
 }
 
@@ -0,0 +1,450 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h> //open
+#include <sys/mman.h> //mmap, madvise
+#include <sys/stat.h> //fstat
+#include <unistd.h> //close, sysconf
+
+#include "opencv2/imgproc/imgproc.hpp" //cvtColor
+
+#include "mappedcapture.h"
+
+namespace {
+
+const char Y4M_MAGIC[] = "YUV4MPEG2";
+const char Y4M_FRAME[] = "FRAME";
+
+//raw files carry no frame rate; this is the rate ffmpeg assumes for rawvideo
+const double RAW_FPS = 25.0;
+
+}
+
+/**
+ * Constructor for a closed capture.
+ * @param args The arguments --raw-size, --pix-fmt and --luma are read from when a file is opened.
+ */
+MappedCapture::MappedCapture(const Arguments& args)
+    : arguments(args), mapping(0), mapping_size(0)
+{
+    release();
+}
+
+/**
+ * Constructor that opens a file, see open().
+ * @param args The arguments --raw-size, --pix-fmt and --luma are read from.
+ * @param filename The file to open.
+ */
+MappedCapture::MappedCapture(const Arguments& args, const std::string& filename)
+    : arguments(args), mapping(0), mapping_size(0)
+{
+    open(filename);
+}
+
+MappedCapture::~MappedCapture() {
+    if (mapping) {
+        munmap(mapping, mapping_size);
+    }
+}
+
+/**
+ * Open a file: Y4M files and, with --raw-size, every other file are mapped. Anything that can't be mapped is handed to
+ * VideoCapture to decode.
+ * @param filename The file to open.
+ * @return True if the file is open.
+ */
+bool MappedCapture::open(const std::string& filename) {
+    release();
+
+    char magic[sizeof(Y4M_MAGIC) - 1] = {0};
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    bool y4m = file.read(magic, sizeof(magic)) && std::memcmp(magic, Y4M_MAGIC, sizeof(magic)) == 0;
+    file.close();
+    bool raw = !y4m && !arguments.get_value<std::string>(Arguments::RAW_SIZE).empty();
+
+    if ((y4m || raw) && map_file(filename)) {
+        luma = arguments.get_value<bool>(Arguments::LUMA);
+        if (y4m ? parse_y4m() : parse_raw()) {
+            return true;
+        }
+        release();
+    }
+    //headerless files can't be decoded, there's nothing to fall back to
+    return !raw && cv::VideoCapture::open(filename);
+}
+
+/**
+ * @return True if a file is open, mapped or decoded.
+ */
+bool MappedCapture::isOpened() const {
+    return mapping || cv::VideoCapture::isOpened();
+}
+
+/**
+ * Close the file. Views of mapped frames are invalid from here on.
+ */
+void MappedCapture::release() {
+    if (mapping) {
+        munmap(mapping, mapping_size);
+    }
+    mapping = 0;
+    mapping_size = 0;
+    format = GRAY;
+    luma = false;
+    size = cv::Size();
+    fps = 0;
+    first_frame = 0;
+    frame_header = 0;
+    frame_bytes = 0;
+    frame_count = 0;
+    offsets.clear();
+    position = 0;
+    grabbed = 0;
+    cv::VideoCapture::release();
+}
+
+/**
+ * Take the next frame. The following frame is prefetched, so sequential reads don't wait on the disk.
+ * @return False at the end of the file.
+ */
+bool MappedCapture::grab() {
+    if (!mapping) {
+        return cv::VideoCapture::grab();
+    }
+    if (position >= frame_count) {
+        grabbed = frame_count;
+        return false;
+    }
+    grabbed = position++;
+
+    if (position < frame_count) {
+        const uchar* next = frame_data(position);
+        if (next) {
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            size_t start = (size_t)(next - mapping) / page * page;
+            madvise(mapping + start, (size_t)(next - mapping) + frame_bytes - start, MADV_WILLNEED);
+        }
+    }
+    return true;
+}
+
+/**
+ * Get the grabbed frame.
+ * @param image Receives the CV_8UC3 BGR frame, or the CV_8UC1 frame for gray input and for YUV input with --luma. Frames
+ * that need no conversion are views into the mapping.
+ * @param channel Passed on to VideoCapture for decoded files.
+ * @return False if no frame was grabbed.
+ */
+bool MappedCapture::retrieve(cv::Mat& image, int channel) {
+    if (!mapping) {
+        return cv::VideoCapture::retrieve(image, channel);
+    }
+    const uchar* data = grabbed < frame_count ? frame_data(grabbed) : 0;
+    if (!data) {
+        image.release();
+        return false;
+    }
+    //the mapping is private, so a stray write to a view changes this process's copy of the page, never the file
+    uchar* samples = const_cast<uchar*>(data);
+    switch (format) {
+        case GRAY:
+            image = cv::Mat(size, CV_8UC1, samples);
+            break;
+        case BGR:
+            image = cv::Mat(size, CV_8UC3, samples);
+            break;
+        case RGB:
+            //a new buffer, the caller may still hold the last frame
+            image.release();
+            cvtColor(cv::Mat(size, CV_8UC3, samples), image, CV_RGB2BGR);
+            break;
+        case I420:
+            if (luma) {
+                image = cv::Mat(size, CV_8UC1, samples);
+            } else {
+                image.release();
+                cvtColor(cv::Mat(size.height * 3 / 2, size.width, CV_8UC1, samples), image, CV_YUV2BGR_I420);
+            }
+            break;
+    }
+    return true;
+}
+
+/**
+ * Grab and retrieve the next frame.
+ * @param image Receives the frame, see retrieve(). Empty at the end of the file.
+ * @return False at the end of the file.
+ */
+bool MappedCapture::read(cv::Mat& image) {
+    if (grab()) {
+        retrieve(image);
+    } else {
+        image.release();
+    }
+    return !image.empty();
+}
+
+/**
+ * Read the next frame, see read().
+ */
+cv::VideoCapture& MappedCapture::operator>>(cv::Mat& image) {
+    read(image);
+    return *this;
+}
+
+/**
+ * @param property A CV_CAP_PROP_* property. Mapped files know their size, rate, frame count and position.
+ * @return The property's value, 0 if it isn't known.
+ */
+double MappedCapture::get(int property) {
+    if (!mapping) {
+        return cv::VideoCapture::get(property);
+    }
+    switch (property) {
+        case CV_CAP_PROP_FRAME_WIDTH:
+            return size.width;
+        case CV_CAP_PROP_FRAME_HEIGHT:
+            return size.height;
+        case CV_CAP_PROP_FPS:
+            return fps;
+        case CV_CAP_PROP_FRAME_COUNT:
+            return (double)frame_count;
+        case CV_CAP_PROP_POS_FRAMES:
+            return (double)position;
+        case CV_CAP_PROP_POS_MSEC:
+            return fps > 0 ? 1000.0 * position / fps : 0;
+        case CV_CAP_PROP_POS_AVI_RATIO:
+            return frame_count > 0 ? (double)position / frame_count : 0;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Seek. For mapped files this only sets the next frame to read, and is exact.
+ * @param property CV_CAP_PROP_POS_FRAMES, CV_CAP_PROP_POS_MSEC or CV_CAP_PROP_POS_AVI_RATIO.
+ * @param value The position.
+ * @return True if the property was set.
+ */
+bool MappedCapture::set(int property, double value) {
+    if (!mapping) {
+        return cv::VideoCapture::set(property, value);
+    }
+    double frame;
+    switch (property) {
+        case CV_CAP_PROP_POS_FRAMES:
+            frame = value;
+            break;
+        case CV_CAP_PROP_POS_MSEC:
+            frame = value * fps / 1000.0;
+            break;
+        case CV_CAP_PROP_POS_AVI_RATIO:
+            frame = value * frame_count;
+            break;
+        default:
+            return false;
+    }
+    position = (size_t)std::min(std::max(std::floor(frame + 0.5), 0.0), (double)frame_count);
+    grabbed = frame_count;
+    return true;
+}
+
+/**
+ * @return True if the open file is mapped rather than decoded.
+ */
+bool MappedCapture::is_mapped() const {
+    return mapping != 0;
+}
+
+/**
+ * @param capture Any capture.
+ * @return True if it is a MappedCapture with a mapped file, which seeks exactly without a FrameIndex.
+ */
+bool MappedCapture::is_mapped(const cv::VideoCapture& capture) {
+    const MappedCapture* mapped = dynamic_cast<const MappedCapture*>(&capture);
+    return mapped && mapped->is_mapped();
+}
+
+/**
+ * Map a whole file.
+ * @param filename The file.
+ * @return False if it can't be opened, is empty, or can't be mapped.
+ */
+bool MappedCapture::map_file(const std::string& filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    //private and writable, so frames can be handed out as ordinary Mats without ever writing to the file
+    void* address = mmap(0, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+        return false;
+    }
+    mapping = static_cast<uchar*>(address);
+    mapping_size = (size_t)info.st_size;
+    return true;
+}
+
+/**
+ * Read the stream header of a mapped Y4M file and locate its frames.
+ * @return False if the header is broken or the samples aren't 8-bit 4:2:0 or mono (VideoCapture decodes those instead).
+ */
+bool MappedCapture::parse_y4m() {
+    const uchar* end = static_cast<const uchar*>(std::memchr(mapping, '\n', mapping_size));
+    if (!end) {
+        return false;
+    }
+    std::string header(reinterpret_cast<const char*>(mapping), end - mapping);
+    first_frame = (size_t)(end - mapping) + 1;
+
+    //space separated tags after the magic, each a letter followed by its value
+    std::string colour_space = "420jpeg";
+    int width = 0, height = 0, rate_num = 0, rate_den = 0;
+    size_t start = sizeof(Y4M_MAGIC) - 1;
+    while (start < header.size()) {
+        size_t stop = header.find(' ', start);
+        if (stop == std::string::npos) {
+            stop = header.size();
+        }
+        std::string tag = header.substr(start, stop - start);
+        if (!tag.empty()) {
+            std::string value = tag.substr(1);
+            switch (tag[0]) {
+                case 'W':
+                    width = std::atoi(value.c_str());
+                    break;
+                case 'H':
+                    height = std::atoi(value.c_str());
+                    break;
+                case 'F':
+                    std::sscanf(value.c_str(), "%d:%d", &rate_num, &rate_den);
+                    break;
+                case 'C':
+                    colour_space = value;
+                    break;
+            }
+        }
+        start = stop + 1;
+    }
+    if (width <= 0 || height <= 0) {
+        return false;
+    }
+    size = cv::Size(width, height);
+    fps = rate_num > 0 && rate_den > 0 ? (double)rate_num / rate_den : 0;
+
+    //the 4:2:0 variants differ only in chroma siting, which the conversion doesn't look at
+    if (colour_space == "mono") {
+        format = GRAY;
+        frame_bytes = (size_t)width * height;
+    } else if ((colour_space == "420jpeg" || colour_space == "420paldv" || colour_space == "420mpeg2" || colour_space == "420")
+               && width % 2 == 0 && height % 2 == 0) {
+        format = I420;
+        frame_bytes = (size_t)width * height * 3 / 2;
+    } else {
+        return false;
+    }
+
+    //frame headers are almost always a bare "FRAME", so frames are at a fixed stride
+    frame_count = 0;
+    if (first_frame < mapping_size) {
+        const uchar* header_end = static_cast<const uchar*>(std::memchr(mapping + first_frame, '\n', mapping_size - first_frame));
+        if (!header_end || std::memcmp(mapping + first_frame, Y4M_FRAME, sizeof(Y4M_FRAME) - 1) != 0) {
+            return false;
+        }
+        frame_header = (size_t)(header_end - mapping) + 1 - first_frame;
+        frame_count = (mapping_size - first_frame) / (frame_header + frame_bytes);
+        if (frame_count > 0 && !is_frame_header(first_frame + (frame_count - 1) * (frame_header + frame_bytes))) {
+            scan_frames();
+        }
+    }
+    return true;
+}
+
+/**
+ * Set up a mapped headerless file from --raw-size and --pix-fmt. A partial frame at the end is ignored.
+ * @return False if the size or format can't be used.
+ */
+bool MappedCapture::parse_raw() {
+    int width = 0, height = 0;
+    std::sscanf(arguments.get_value<std::string>(Arguments::RAW_SIZE).c_str(), "%dx%d", &width, &height);
+    std::string pixel_format = arguments.get_value<std::string>(Arguments::STREAM_FORMAT);
+    if (width <= 0 || height <= 0) {
+        return false;
+    }
+    size = cv::Size(width, height);
+    fps = RAW_FPS;
+
+    if (pixel_format == "gray") {
+        format = GRAY;
+        frame_bytes = (size_t)width * height;
+    } else if (pixel_format == "bgr24" || pixel_format == "rgb24") {
+        format = pixel_format == "bgr24" ? BGR : RGB;
+        frame_bytes = (size_t)width * height * 3;
+    } else if (pixel_format == "yuv420p" && width % 2 == 0 && height % 2 == 0) {
+        format = I420;
+        frame_bytes = (size_t)width * height * 3 / 2;
+    } else {
+        return false;
+    }
+    first_frame = 0;
+    frame_header = 0;
+    frame_count = mapping_size / frame_bytes;
+    return true;
+}
+
+/**
+ * @param offset Where a Y4M frame header of the usual length should start.
+ * @return True if one is there.
+ */
+bool MappedCapture::is_frame_header(size_t offset) const {
+    return offset + frame_header + frame_bytes <= mapping_size
+            && std::memcmp(mapping + offset, Y4M_FRAME, sizeof(Y4M_FRAME) - 1) == 0
+            && std::memchr(mapping + offset, '\n', frame_header) == mapping + offset + frame_header - 1;
+}
+
+/**
+ * Walk a Y4M file's frame headers and record where each frame's samples start. Only needed when the headers vary in
+ * length (they carry per-frame tags), as the fixed stride doesn't hold then.
+ */
+void MappedCapture::scan_frames() {
+    offsets.clear();
+    size_t offset = first_frame;
+    while (offset + sizeof(Y4M_FRAME) - 1 <= mapping_size
+           && std::memcmp(mapping + offset, Y4M_FRAME, sizeof(Y4M_FRAME) - 1) == 0) {
+        const uchar* header_end = static_cast<const uchar*>(std::memchr(mapping + offset, '\n', mapping_size - offset));
+        if (!header_end || (size_t)(header_end - mapping) + 1 + frame_bytes > mapping_size) {
+            break;
+        }
+        offsets.push_back((size_t)(header_end - mapping) + 1);
+        offset = offsets.back() + frame_bytes;
+    }
+    frame_count = offsets.size();
+    position = std::min(position, frame_count);
+}
+
+/**
+ * @param frame A frame below frame_count.
+ * @return Where the frame's samples start in the mapping, null if the file turns out to be shorter.
+ */
+const uchar* MappedCapture::frame_data(size_t frame) {
+    if (offsets.empty() && frame_header > 0) {
+        size_t offset = first_frame + frame * (frame_header + frame_bytes);
+        if (is_frame_header(offset)) {
+            return mapping + offset + frame_header;
+        }
+        scan_frames();
+    } else if (offsets.empty()) {
+        return mapping + first_frame + frame * frame_bytes;
+    }
+    return frame < offsets.size() ? mapping + offsets[frame] : 0;
+}
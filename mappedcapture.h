@@ -0,0 +1,77 @@
+#ifndef MAPPEDCAPTURE_H
+#define MAPPEDCAPTURE_H
+
+#include <string>
+#include <vector>
+
+#include "opencv2/highgui/highgui.hpp" //VideoCapture
+#include "arguments.hpp"
+
+/**
+ * A VideoCapture that memory maps uncompressed intermediate files instead of decoding them: Y4M (8-bit 4:2:0 or mono),
+ * and headerless raw frames when --raw-size is set (in the --pix-fmt format).
+ * Frames are located by arithmetic, so seeking is O(1) and exact. Frames that need no conversion (gray, bgr24, and the Y plane
+ * of YUV input with --luma) are returned as views into the mapping, without copying, and the eye views split from them point
+ * into it too. They stay valid until the capture is released or reopened. Other frames are converted into a new Mat each read.
+ * Anything else, including Y4M files in other sample formats, is opened by the regular VideoCapture.
+ */
+class MappedCapture : public cv::VideoCapture
+{
+public:
+    MappedCapture(const Arguments& args);
+    MappedCapture(const Arguments& args, const std::string& filename);
+    virtual ~MappedCapture();
+
+    using cv::VideoCapture::open;
+    virtual bool open(const std::string& filename);
+    virtual bool isOpened() const;
+    virtual void release();
+    virtual bool grab();
+    virtual bool retrieve(cv::Mat& image, int channel = 0);
+    virtual bool read(cv::Mat& image);
+    virtual cv::VideoCapture& operator>>(cv::Mat& image);
+    virtual double get(int property);
+    virtual bool set(int property, double value);
+
+    bool is_mapped() const;
+    static bool is_mapped(const cv::VideoCapture& capture);
+private:
+    /**
+     * Sample layouts that can be mapped.
+     */
+    enum Format {
+        GRAY, //also mono Y4M
+        BGR,
+        RGB,
+        I420  //planar 4:2:0, Y then U then V
+    };
+
+    MappedCapture(const MappedCapture&);
+    MappedCapture& operator=(const MappedCapture&);
+
+    bool map_file(const std::string& filename);
+    bool parse_y4m();
+    bool parse_raw();
+    bool is_frame_header(size_t offset) const;
+    void scan_frames();
+    const uchar* frame_data(size_t frame);
+
+    const Arguments& arguments;
+
+    uchar* mapping;
+    size_t mapping_size;
+
+    Format format;
+    bool luma;           //hand out the Y plane of YUV input as it is
+    cv::Size size;
+    double fps;
+    size_t first_frame;  //offset of the first frame's header (its data, for raw files)
+    size_t frame_header; //length of a Y4M frame header, 0 for raw files
+    size_t frame_bytes;  //of the samples of one frame
+    size_t frame_count;
+    std::vector<size_t> offsets; //data offset of each frame, only when Y4M frame headers vary in length
+    size_t position;     //next frame grab() takes
+    size_t grabbed;      //frame retrieve() returns, frame_count when nothing was grabbed
+};
+
+#endif // MAPPEDCAPTURE_H
@@ -0,0 +1,186 @@
+#include <stdexcept>
+
+#include "opencv2/imgproc/imgproc.hpp" //cvtColor
+
+#include "matcher.h"
+#include "censusmatcher.h"
+
+/**
+ * Destructor.
+ */
+Matcher::~Matcher() {
+}
+
+/**
+ * Construct the matching engine with the given name.
+ * @param engine The engine name as accepted by --engine ("sgbm", "bm" or "census").
+ * @return A shared pointer to the new, unconfigured engine.
+ */
+std::shared_ptr<Matcher> Matcher::create(const std::string& engine) {
+    std::shared_ptr<Matcher> matcher;
+    if (engine == "sgbm") {
+        matcher.reset(new SGBMMatcher());
+    } else if (engine == "bm") {
+        matcher.reset(new BMMatcher());
+    } else if (engine == "census") {
+        matcher.reset(new CensusSGMMatcher());
+    } else {
+        throw std::runtime_error("Error: unknown matching engine [" + engine + "]");
+    }
+    return matcher;
+}
+
+/**
+ * Construct and configure the matching engine selected in the arguments.
+ * @param args The arguments that contain the engine name and the processing parameters.
+ * @return A shared pointer to the new, configured engine.
+ */
+std::shared_ptr<Matcher> Matcher::create(const Arguments& args) {
+    std::shared_ptr<Matcher> matcher = create(args.get_value<std::string>(Arguments::ENGINE));
+    matcher->configure(args);
+    return matcher;
+}
+
+/**
+ * @return The engine name as accepted by --engine.
+ */
+std::string SGBMMatcher::name() const {
+    return "sgbm";
+}
+
+/**
+ * Copy the StereoSGBM parameters from the arguments.
+ * @param args The arguments that contain the processing parameters.
+ */
+void SGBMMatcher::configure(const Arguments& args) {
+    mapper.minDisparity        = args.get_value<int>  (Arguments::MIN_DISPARITY);
+    mapper.numberOfDisparities = args.get_value<int>  (Arguments::NUM_DISPARITIES);
+    mapper.SADWindowSize       = args.get_value<int>  (Arguments::SAD_WINDOW_SIZE);
+    mapper.P1                  = args.get_value<int>  (Arguments::P1);
+    mapper.P2                  = args.get_value<int>  (Arguments::P2);
+    mapper.disp12MaxDiff       = args.get_value<int>  (Arguments::DISP12_MAX_DIFF);
+    mapper.preFilterCap        = args.get_value<int>  (Arguments::PRE_FILTER_CAP);
+    mapper.uniquenessRatio     = args.get_value<int>  (Arguments::UNIQUENESS);
+    mapper.speckleWindowSize   = args.get_value<int>  (Arguments::SPECKLE_WINDOW_SIZE);
+    mapper.speckleRange        = args.get_value<int>  (Arguments::SPECKLE_RANGE);
+    mapper.fullDP              = args.get_value<bool> (Arguments::FULL_DP);
+}
+
+/**
+ * Compute the disparity between two eye frames.
+ * @param left_eye The left eye frame (1 or 3 channel, 8-bit).
+ * @param right_eye The right eye frame, same size and type as left_eye.
+ * @param disparity Receives the CV_16SC1 disparity map.
+ */
+void SGBMMatcher::compute(const cv::Mat& left_eye, const cv::Mat& right_eye, cv::Mat& disparity) {
+    mapper(left_eye, right_eye, disparity);
+}
+
+/**
+ * Estimate the peak working memory of one compute() call. Mirrors the buffer layout of StereoSGBM in OpenCV 2.4.
+ * With fullDP the whole-image cost and path-sum buffers dominate, growing with width * height * numberOfDisparities.
+ * @param size Size of one eye frame.
+ * @param channels Number of channels of the eye frames.
+ * @return The estimated size in bytes, including the output disparity map.
+ */
+size_t SGBMMatcher::memory_estimate(const cv::Size& size, int channels) const {
+    const size_t NR2 = 8, NLR = 2, LR_BORDER = NLR - 1;
+    const size_t cost_size = sizeof(short), disp_size = sizeof(short);
+
+    int disparities = std::max(16, mapper.numberOfDisparities);
+    int min_x = std::max(mapper.minDisparity + disparities, 0);
+    int max_x = size.width + std::min(mapper.minDisparity, 0);
+    size_t width1 = (size_t)std::max(max_x - min_x, 0);
+    size_t window = mapper.SADWindowSize > 0 ? mapper.SADWindowSize : 5;
+
+    size_t cost_buffer = width1 * disparities;
+    size_t cs_buffer = cost_buffer * (mapper.fullDP ? size.height : 1);
+    size_t min_lr = (width1 + LR_BORDER * 2) * NR2;
+    size_t lr = min_lr * (disparities + 16);
+    size_t hsum_rows = (window / 2) * 2 + 2;
+
+    return (lr + min_lr) * NLR * cost_size
+            + cs_buffer * 2 * cost_size
+            + cost_buffer * (hsum_rows + 1) * cost_size
+            + size.width * 16 * channels
+            + size.width * (cost_size + disp_size)
+            + (size_t)size.area() * disp_size
+            + 1024;
+}
+
+/**
+ * @return The engine name as accepted by --engine.
+ */
+std::string BMMatcher::name() const {
+    return "bm";
+}
+
+/**
+ * Copy the StereoBM parameters from the arguments.
+ * StereoBM is stricter than StereoSGBM about its ranges, so values that SGBM accepts are clamped here rather than failing mid-run.
+ * This runs every frame, so the state (and with it StereoBM's working buffers) is only recreated when the disparity range or
+ * window size change; everything else is updated in place.
+ * @param args The arguments that contain the processing parameters.
+ */
+void BMMatcher::configure(const Arguments& args) {
+    //force a value to be odd and inside [5, 255] as StereoBM requires for its window sizes
+    auto odd_window = [](int value) {
+        value = std::min(std::max(value, 5), 255);
+        return value % 2 ? value : value + 1;
+    };
+
+    int num_disparities = args.get_value<int>(Arguments::NUM_DISPARITIES);
+    int pre_filter_cap  = args.get_value<int>(Arguments::PRE_FILTER_CAP);
+
+    int disparities = std::max(16, num_disparities);
+    int window = odd_window(args.get_value<int>(Arguments::SAD_WINDOW_SIZE));
+    if (mapper.state.empty() || mapper.state->numberOfDisparities != disparities || mapper.state->SADWindowSize != window) {
+        mapper.init(cv::StereoBM::BASIC_PRESET, disparities, window);
+        preset_pre_filter_cap = mapper.state->preFilterCap;
+    }
+
+    mapper.state->minDisparity      = args.get_value<int>(Arguments::MIN_DISPARITY);
+    mapper.state->disp12MaxDiff     = args.get_value<int>(Arguments::DISP12_MAX_DIFF);
+    mapper.state->uniquenessRatio   = args.get_value<int>(Arguments::UNIQUENESS);
+    mapper.state->speckleWindowSize = args.get_value<int>(Arguments::SPECKLE_WINDOW_SIZE);
+    mapper.state->speckleRange      = args.get_value<int>(Arguments::SPECKLE_RANGE);
+    mapper.state->textureThreshold  = args.get_value<int>(Arguments::TEXTURE_THRESHOLD);
+    mapper.state->preFilterSize     = odd_window(args.get_value<int>(Arguments::PRE_FILTER_SIZE));
+    //0 means "engine default" for SGBM, keep the preset's value in that case
+    mapper.state->preFilterCap = pre_filter_cap > 0 ? std::min(pre_filter_cap, 63) : preset_pre_filter_cap;
+}
+
+/**
+ * Compute the disparity between two eye frames.
+ * @param left_eye The left eye frame (1 or 3 channel, 8-bit).
+ * @param right_eye The right eye frame, same size and type as left_eye.
+ * @param disparity Receives the CV_16SC1 disparity map.
+ */
+void BMMatcher::compute(const cv::Mat& left_eye, const cv::Mat& right_eye, cv::Mat& disparity) {
+    if (left_eye.channels() == 1) {
+        mapper(left_eye, right_eye, disparity, CV_16S);
+    } else {
+        cvtColor(left_eye, left_gray, CV_BGR2GRAY);
+        cvtColor(right_eye, right_gray, CV_BGR2GRAY);
+        mapper(left_gray, right_gray, disparity, CV_16S);
+    }
+}
+
+/**
+ * Estimate the peak working memory of one compute() call: gray copies, the two pre-filtered images,
+ * the cost and output maps, and one row-stripe buffer per worker thread.
+ * @param size Size of one eye frame.
+ * @param channels Number of channels of the eye frames.
+ * @return The estimated size in bytes, including the output disparity map.
+ */
+size_t BMMatcher::memory_estimate(const cv::Size& size, int channels) const {
+    size_t area = (size_t)size.area();
+    size_t disparities = mapper.state->numberOfDisparities;
+    size_t window = mapper.state->SADWindowSize;
+    size_t stripe = (size.height + window + 2) * disparities * (window + 1 + 2 * sizeof(int));
+
+    return (channels > 1 ? 2 * area : 0)
+            + 2 * area
+            + area * 2 * sizeof(short)
+            + stripe * std::max(1, cv::getNumThreads());
+}
@@ -0,0 +1,59 @@
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <memory>
+#include <string>
+
+#include "opencv2/calib3d/calib3d.hpp" //StereoSGBM, StereoBM
+#include "arguments.hpp"
+
+/**
+ * Abstract interface for a stereo correspondence engine.
+ * Every engine produces a CV_16SC1 disparity map scaled by 16, as StereoSGBM does, so callers don't need to care which one is in use.
+ */
+class Matcher
+{
+public:
+    virtual ~Matcher();
+
+    static std::shared_ptr<Matcher> create(const std::string& engine);
+    static std::shared_ptr<Matcher> create(const Arguments& args);
+
+    virtual std::string name() const = 0;
+    virtual void configure(const Arguments& args) = 0;
+    virtual void compute(const cv::Mat& left_eye, const cv::Mat& right_eye, cv::Mat& disparity) = 0;
+    virtual size_t memory_estimate(const cv::Size& size, int channels) const = 0;
+};
+
+/**
+ * Semi-global block matching engine backed by cv::StereoSGBM. Best quality, slowest.
+ */
+class SGBMMatcher : public Matcher
+{
+public:
+    std::string name() const;
+    void configure(const Arguments& args);
+    void compute(const cv::Mat& left_eye, const cv::Mat& right_eye, cv::Mat& disparity);
+    size_t memory_estimate(const cv::Size& size, int channels) const;
+private:
+    cv::StereoSGBM mapper;
+};
+
+/**
+ * Block matching engine backed by cv::StereoBM. Many times faster than SGBM, meant for previews and draft renders.
+ */
+class BMMatcher : public Matcher
+{
+public:
+    std::string name() const;
+    void configure(const Arguments& args);
+    void compute(const cv::Mat& left_eye, const cv::Mat& right_eye, cv::Mat& disparity);
+    size_t memory_estimate(const cv::Size& size, int channels) const;
+private:
+    cv::StereoBM mapper;
+    int preset_pre_filter_cap = 0; //restored when --preFilterCap goes back to 0, as the state isn't recreated
+    //StereoBM only accepts single channel 8-bit input
+    cv::Mat left_gray, right_gray;
+};
+
+#endif // MATCHER_H
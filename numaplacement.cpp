@@ -0,0 +1,142 @@
+#include <cstdlib> //strtol
+#include <fstream>
+#include <sstream>
+
+#include <pthread.h> //pthread_setaffinity_np
+#include <sched.h> //sched_getcpu, CPU_SET
+#include <unistd.h> //sysconf
+
+#include "numaplacement.h"
+
+namespace {
+
+//highest node number looked for in sysfs
+const int MAX_NODES = 64;
+
+}
+
+/**
+ * @param setting The --numa setting: off, auto, or a node number.
+ * @return The node, OFF, or AUTO. Anything else is OFF (Arguments rejects it earlier).
+ */
+int NumaPlacement::parse(const std::string& setting) {
+    if (setting == "auto") {
+        return AUTO;
+    }
+    char* end = 0;
+    long node = std::strtol(setting.c_str(), &end, 10);
+    if (setting.empty() || *end != 0 || node < 0) {
+        return OFF;
+    }
+    return (int)node;
+}
+
+/**
+ * @return The CPUs of every node, indexed by node number (nodes missing from the numbering have no CPUs).
+ */
+std::vector<std::vector<int> > NumaPlacement::get_nodes() {
+    std::vector<std::vector<int> > nodes;
+    for (int node = 0; node < MAX_NODES; ++node) {
+        std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!cpulist) {
+            continue;
+        }
+        std::string list;
+        std::getline(cpulist, list);
+        nodes.resize(node + 1);
+        nodes[node] = parse_cpu_list(list);
+    }
+
+    if (nodes.empty()) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nodes.resize(1);
+        for (long cpu = 0; cpu < cpus; ++cpu) {
+            nodes[0].push_back((int)cpu);
+        }
+    }
+    return nodes;
+}
+
+/**
+ * @return The node of the CPU the calling thread is running on, 0 if it can't be told.
+ */
+int NumaPlacement::current_node() {
+    int cpu = sched_getcpu();
+    std::vector<std::vector<int> > nodes = get_nodes();
+    for (size_t node = 0; node < nodes.size(); ++node) {
+        for (int node_cpu : nodes[node]) {
+            if (node_cpu == cpu) {
+                return (int)node;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Pin the calling thread to the CPUs of a node. Threads it creates from now on inherit the placement.
+ * @param node The node number.
+ * @return False if the node has no CPUs or the affinity can't be set.
+ */
+bool NumaPlacement::pin_thread(int node) {
+    std::vector<std::vector<int> > nodes = get_nodes();
+    if (node < 0 || node >= (int)nodes.size()) {
+        return false;
+    }
+    return pin_thread(nodes[node]);
+}
+
+/**
+ * Pin the calling thread to a set of CPUs.
+ * @param cpus The CPUs the thread may run on.
+ * @return False if the set is empty or the affinity can't be set.
+ */
+bool NumaPlacement::pin_thread(const std::vector<int>& cpus) {
+    if (cpus.empty()) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+/**
+ * @param node The node number.
+ * @return A line describing the node and its CPUs, for the logs.
+ */
+std::string NumaPlacement::describe(int node) {
+    std::vector<std::vector<int> > nodes = get_nodes();
+    std::ostringstream text;
+    text << "NUMA node " << node << " of " << nodes.size();
+    if (node >= 0 && node < (int)nodes.size()) {
+        text << " (" << nodes[node].size() << " CPUs)";
+    }
+    return text.str();
+}
+
+/**
+ * @param list A sysfs CPU list such as "0-7,16-23".
+ * @return The CPUs in the list.
+ */
+std::vector<int> NumaPlacement::parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    std::istringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        char* end = 0;
+        int first = (int)std::strtol(range.c_str(), &end, 10);
+        if (end == range.c_str()) {
+            continue;
+        }
+        int last = *end == '-' ? (int)std::strtol(end + 1, 0, 10) : first;
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
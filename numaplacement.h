@@ -0,0 +1,32 @@
+#ifndef NUMAPLACEMENT_H
+#define NUMAPLACEMENT_H
+
+#include <string>
+#include <vector>
+
+/**
+ * Keeps threads, and through them memory, on one NUMA node (--numa). Linux only: the topology is read from sysfs, and
+ * threads are pinned with their CPU affinity. There is no explicit node allocator; Linux places a page on the node of the
+ * thread that first touches it, so buffers allocated and filled by pinned threads (decoded frames, matcher scratch, maps)
+ * end up local. Threads inherit their creator's affinity, so pinning the main thread before OpenCV starts its pool keeps
+ * the pool, the right eye matcher and everything else on the node too.
+ * Machines with a single node, or without the sysfs topology, are treated as one node of every online CPU.
+ */
+class NumaPlacement
+{
+public:
+    static const int OFF = -1;
+    static const int AUTO = -2;
+
+    static int parse(const std::string& setting);
+    static std::vector<std::vector<int> > get_nodes();
+    static int current_node();
+
+    static bool pin_thread(int node);
+    static bool pin_thread(const std::vector<int>& cpus);
+    static std::string describe(int node);
+private:
+    static std::vector<int> parse_cpu_list(const std::string& list);
+};
+
+#endif // NUMAPLACEMENT_H
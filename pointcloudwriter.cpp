@@ -0,0 +1,310 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include "pointcloudwriter.h"
+
+namespace {
+
+//rows per parallel band. Each band packs its own points, and the bands are written in order.
+const int BAND_ROWS = 64;
+
+//bytes per point: x y z float, plus red green blue uchar for PLY
+const size_t PLY_RECORD = 3 * sizeof(float) + 3;
+const size_t FLOAT_RECORD = 3 * sizeof(float);
+
+//stdio buffer size, so the many band writes of a frame go out as a few large writes
+const size_t WRITE_BUFFER = 4 * 1024 * 1024;
+
+//homogeneous coordinates closer to zero than this are points at infinity
+const float MIN_W = 1e-6f;
+
+/**
+ * Find the frame number placeholder of a PLY filename: one %d or %0Nd, with %% for a literal percent sign.
+ * The filename is never used as a format string, only the number is formatted.
+ * @param pattern The filename.
+ * @param start Receives where the placeholder starts, std::string::npos if there is none.
+ * @param length Receives its length.
+ * @param width Receives its zero-padded width, 0 for plain %d.
+ * @return False if the filename holds any other conversion or more than one placeholder.
+ */
+bool find_placeholder(const std::string& pattern, size_t& start, size_t& length, int& width) {
+    start = std::string::npos;
+    length = 0;
+    width = 0;
+    for (size_t at = pattern.find('%'); at != std::string::npos; at = pattern.find('%', at)) {
+        if (at + 1 < pattern.size() && pattern[at + 1] == '%') {
+            at += 2;
+            continue;
+        }
+        size_t end = at + 1;
+        bool padded = end < pattern.size() && pattern[end] == '0';
+        if (padded) {
+            ++end;
+        }
+        size_t digits = end;
+        while (end < pattern.size() && std::isdigit((unsigned char)pattern[end])) {
+            ++end;
+        }
+        if (end >= pattern.size() || pattern[end] != 'd' || start != std::string::npos || (padded && digits == end) || end - digits > 2) {
+            return false;
+        }
+        start = at;
+        length = end + 1 - at;
+        width = digits < end ? std::atoi(pattern.substr(digits, end - digits).c_str()) : 0;
+        at = end + 1;
+    }
+    return true;
+}
+
+/**
+ * @return The filename with %% turned into %.
+ */
+std::string unescape_percent(const std::string& text) {
+    std::string result;
+    for (size_t at = 0; at < text.size(); ++at) {
+        result += text[at];
+        if (text[at] == '%' && at + 1 < text.size() && text[at + 1] == '%') {
+            ++at;
+        }
+    }
+    return result;
+}
+
+/**
+ * Reprojects bands of rows. For each row the homogeneous coordinates are computed for the whole row first (a loop the compiler
+ * can vectorize), then the valid points are packed into the band's output.
+ */
+class ReprojectBody : public cv::ParallelLoopBody
+{
+public:
+    ReprojectBody(const cv::Mat& disparity, const cv::Mat& colour, const float (&Q)[4][4], short invalid, size_t record,
+                  std::vector<std::vector<char> >& bands, std::vector<size_t>& band_sizes)
+        : disparity(disparity), colour(colour), Q(Q), invalid(invalid), record(record), bands(bands), band_sizes(band_sizes) {}
+
+    void operator()(const cv::Range& range) const {
+        const int width = disparity.cols;
+        std::vector<float> coordinates(4 * width);
+        float* X = &coordinates[0];
+        float* Y = X + width;
+        float* Z = Y + width;
+        float* W = Z + width;
+
+        for (int band = range.start; band < range.end; ++band) {
+            int start = band * BAND_ROWS;
+            int end = std::min(start + BAND_ROWS, disparity.rows);
+            char* out = &bands[band][0];
+            size_t used = 0;
+
+            for (int y = start; y < end; ++y) {
+                const short* values = disparity.ptr<short>(y);
+                //[X Y Z W] = Q [x y d 1], with the y terms constant along the row
+                float row_X = Q[0][1] * y + Q[0][3];
+                float row_Y = Q[1][1] * y + Q[1][3];
+                float row_Z = Q[2][1] * y + Q[2][3];
+                float row_W = Q[3][1] * y + Q[3][3];
+                for (int x = 0; x < width; ++x) {
+                    float d = (float)values[x] * (1.0f / 16);
+                    float w = Q[3][0] * x + Q[3][2] * d + row_W;
+                    float inverse = 1.0f / (std::fabs(w) > MIN_W ? w : 1.0f);
+                    X[x] = (Q[0][0] * x + Q[0][2] * d + row_X) * inverse;
+                    Y[x] = (Q[1][0] * x + Q[1][2] * d + row_Y) * inverse;
+                    Z[x] = (Q[2][0] * x + Q[2][2] * d + row_Z) * inverse;
+                    W[x] = w;
+                }
+
+                const uchar* pixels = colour.empty() ? 0 : colour.ptr<uchar>(y);
+                int channels = colour.channels();
+                for (int x = 0; x < width; ++x) {
+                    if (values[x] <= invalid || std::fabs(W[x]) <= MIN_W) {
+                        continue;
+                    }
+                    float point[3] = {X[x], Y[x], Z[x]};
+                    std::memcpy(out + used, point, sizeof(point));
+                    if (record == PLY_RECORD) {
+                        uchar* rgb = reinterpret_cast<uchar*>(out + used + sizeof(point));
+                        if (!pixels) {
+                            rgb[0] = rgb[1] = rgb[2] = 255;
+                        } else if (channels == 1) {
+                            rgb[0] = rgb[1] = rgb[2] = pixels[x];
+                        } else {
+                            //the eyes are BGR
+                            rgb[0] = pixels[x * channels + 2];
+                            rgb[1] = pixels[x * channels + 1];
+                            rgb[2] = pixels[x * channels];
+                        }
+                    }
+                    used += record;
+                }
+            }
+            band_sizes[band] = used;
+        }
+    }
+private:
+    const cv::Mat& disparity;
+    const cv::Mat& colour;
+    const float (&Q)[4][4];
+    short invalid;
+    size_t record;
+    std::vector<std::vector<char> >& bands;
+    std::vector<size_t>& band_sizes;
+};
+
+}
+
+/**
+ * Convert the --points-format argument.
+ * @param name "ply" or "float".
+ * @return The format.
+ */
+PointCloudWriter::Format PointCloudWriter::parse_format(const std::string& name) {
+    if (name == "float") {
+        return FLOAT;
+    }
+    return PLY;
+}
+
+/**
+ * Constructor. The float stream is opened here, PLY files are opened per frame.
+ * Throws std::runtime_error if Q isn't a 4x4 matrix or the stream can't be opened.
+ * @param filename The output file, or the pattern of the per-frame PLY files.
+ * @param format The output format.
+ * @param Q The 4x4 disparity-to-depth matrix of the rectified eyes.
+ */
+PointCloudWriter::PointCloudWriter(const std::string& filename, Format format, const cv::Mat& Q)
+    : filename(filename), format(format), stream(0), buffer(WRITE_BUFFER), frame_count(0)
+{
+    if (Q.rows != 4 || Q.cols != 4) {
+        throw std::runtime_error("Error: point clouds need the Q matrix of a calibration file (--calibration)");
+    }
+    cv::Mat Q_double;
+    Q.convertTo(Q_double, CV_64F);
+    for (int row = 0; row < 4; ++row) {
+        for (int col = 0; col < 4; ++col) {
+            this->Q[row][col] = Q_double.at<double>(row, col);
+        }
+    }
+
+    size_t start, length;
+    int width;
+    if (format == PLY && !find_placeholder(filename, start, length, width)) {
+        throw std::runtime_error("Error: point cloud file [" + filename + "] may only hold one %d or %0Nd frame number placeholder (%% for a percent sign)");
+    }
+
+    if (format == FLOAT) {
+        stream = open(filename);
+    }
+}
+
+/**
+ * Destructor. Flushes and closes the float stream.
+ */
+PointCloudWriter::~PointCloudWriter() {
+    if (stream) {
+        std::fclose(stream);
+    }
+}
+
+/**
+ * Reproject one disparity frame and write its points.
+ * Throws std::runtime_error if the points can't be written.
+ * @param disparity The CV_16SC1 disparity map of the rectified left eye.
+ * @param colour The rectified left eye (BGR or gray) the points are coloured from, at the same size.
+ * @param invalid The disparity value of invalid pixels.
+ */
+void PointCloudWriter::write(const cv::Mat& disparity, const cv::Mat& colour, short invalid) {
+    size_t record = format == PLY ? PLY_RECORD : FLOAT_RECORD;
+    size_t band_count = (disparity.rows + BAND_ROWS - 1) / BAND_ROWS;
+    size_t band_capacity = (size_t)BAND_ROWS * disparity.cols * record;
+    if (bands.size() != band_count || (band_count > 0 && bands[0].size() != band_capacity)) {
+        bands.assign(band_count, std::vector<char>(band_capacity));
+        band_sizes.assign(band_count, 0);
+    }
+
+    float Q_float[4][4];
+    for (int row = 0; row < 4; ++row) {
+        for (int col = 0; col < 4; ++col) {
+            Q_float[row][col] = (float)Q[row][col];
+        }
+    }
+    cv::parallel_for_(cv::Range(0, (int)band_count), ReprojectBody(disparity, colour, Q_float, invalid, record, bands, band_sizes));
+
+    uint64_t points = 0;
+    for (size_t size : band_sizes) {
+        points += size / record;
+    }
+
+    std::FILE* file = stream;
+    if (format == PLY) {
+        file = open(frame_filename(frame_count));
+        std::fprintf(file, "ply\nformat binary_little_endian 1.0\ncomment stereo_to_depthmap frame %zu\nelement vertex %llu\n"
+                           "property float x\nproperty float y\nproperty float z\n"
+                           "property uchar red\nproperty uchar green\nproperty uchar blue\nend_header\n",
+                     frame_count, (unsigned long long)points);
+    } else {
+        uint32_t count = (uint32_t)points;
+        std::fwrite(&count, sizeof(count), 1, file);
+    }
+
+    bool written = true;
+    for (size_t band = 0; band < band_count; ++band) {
+        written = written && std::fwrite(&bands[band][0], 1, band_sizes[band], file) == band_sizes[band];
+    }
+    if (format == PLY) {
+        written = std::fclose(file) == 0 && written;
+    }
+    if (!written) {
+        throw std::runtime_error("Error: point cloud could not be written to [" + (format == PLY ? frame_filename(frame_count) : filename) + "]");
+    }
+    ++frame_count;
+}
+
+/**
+ * @return The number of frames written.
+ */
+size_t PointCloudWriter::get_frame_count() const {
+    return frame_count;
+}
+
+/**
+ * Open an output file with the large write buffer.
+ * Throws std::runtime_error if the file can't be opened.
+ * @param path The file to create.
+ * @return The open file.
+ */
+std::FILE* PointCloudWriter::open(const std::string& path) {
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error("Error: point cloud file [" + path + "] cannot be opened for writing");
+    }
+    std::setvbuf(file, &buffer[0], _IOFBF, buffer.size());
+    return file;
+}
+
+/**
+ * @param frame The 0-indexed number of the written frame.
+ * @return The PLY filename of the frame.
+ */
+std::string PointCloudWriter::frame_filename(size_t frame) const {
+    size_t start, length;
+    int width;
+    find_placeholder(filename, start, length, width);
+    if (start != std::string::npos) {
+        char number[32];
+        std::snprintf(number, sizeof(number), "%0*zu", width, frame);
+        return unescape_percent(filename.substr(0, start)) + number + unescape_percent(filename.substr(start + length));
+    }
+    char number[32];
+    std::snprintf(number, sizeof(number), "_%06zu", frame);
+    std::string filename = unescape_percent(this->filename);
+    size_t slash = filename.find_last_of('/');
+    size_t dot = filename.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return filename + number + ".ply";
+    }
+    return filename.substr(0, dot) + number + filename.substr(dot);
+}
@@ -0,0 +1,48 @@
+#ifndef POINTCLOUDWRITER_H
+#define POINTCLOUDWRITER_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+/**
+ * Streams disparity frames out as 3D point clouds, reprojected through the calibration's Q matrix like reprojectImageTo3D.
+ * Reprojection runs in parallel bands of rows, each band packing its valid points straight into the bytes written to the file,
+ * and the bands are written in order with large buffered writes. Invalid pixels and points at infinity are skipped.
+ * Formats:
+ *  *) ply: one binary PLY file per frame (x y z as float, red green blue as uchar). The filename is a printf pattern for the
+ *     frame number as an int (e.g. cloud_%05d.ply), or gets _NNNNNN inserted before its extension.
+ *  *) float: a single stream; per frame a uint32 point count, then x y z as packed little-endian float32 per point.
+ */
+class PointCloudWriter
+{
+public:
+    enum Format {
+        PLY,
+        FLOAT
+    };
+
+    static Format parse_format(const std::string& name);
+
+    PointCloudWriter(const std::string& filename, Format format, const cv::Mat& Q);
+    ~PointCloudWriter();
+
+    void write(const cv::Mat& disparity, const cv::Mat& colour, short invalid);
+    size_t get_frame_count() const;
+private:
+    std::FILE* open(const std::string& filename);
+    std::string frame_filename(size_t frame) const;
+
+    std::string filename;
+    Format format;
+    double Q[4][4];
+    std::FILE* stream;          //the float stream, open for the writer's lifetime
+    std::vector<char> buffer;   //stdio buffer of the open file
+    std::vector<std::vector<char> > bands; //packed points of each band of rows, reused every frame
+    std::vector<size_t> band_sizes;        //bytes used in each band
+    size_t frame_count;
+};
+
+#endif // POINTCLOUDWRITER_H
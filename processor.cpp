@@ -1,28 +1,193 @@
 #include <iostream> //TODO: remove this
+#include <cstdio> //sscanf
+#include <cstdlib> //abs
+#include <exception>
+#include <thread>
 
 #include "opencv2/imgproc/imgproc.hpp" //CV_Gray2RGB cvtColor
-#include "opencv2/calib3d/calib3d.hpp" //StereoSGBM
 #include "opencv2/highgui/highgui.hpp" //CV_FOURCC, VideoCapture
 
 #include "processor.h"
+#include "censusmatcher.h"
+#include "tracer.h"
+#include "numaplacement.h"
+
+namespace {
+
+/**
+ * @param sad_window_size The matching window size.
+ * @return Rows matched above and below a strip or region and then dropped, so the matcher's paths settle before the kept rows.
+ */
+int settle_rows(int sad_window_size) {
+    return std::max(64, 4 * sad_window_size);
+}
+
+/**
+ * Open the seek index of a video file, building it if needed.
+ * @param filename The video file.
+ * @return The index, or null if the file can't be indexed (seeking then falls back to the capture's own).
+ */
+std::shared_ptr<FrameIndex> open_index(const std::string& filename) {
+    if (filename.empty()) {
+        return std::shared_ptr<FrameIndex>();
+    }
+    try {
+        return FrameIndex::open(filename);
+    } catch (std::runtime_error&) {
+        return std::shared_ptr<FrameIndex>();
+    }
+}
+
+/**
+ * Left-right consistency check of one band of rows. A pixel is kept only if the other eye's disparity, at the pixel it maps to,
+ * agrees within the allowed difference. Everything else (mostly occlusions and mismatches) is marked invalid in the output.
+ */
+class CrossCheckBody : public cv::ParallelLoopBody
+{
+public:
+    CrossCheckBody(const cv::Mat& left_disparity, const cv::Mat& right_disparity, cv::Mat& left_checked, cv::Mat& right_checked,
+                   int max_difference, short invalid)
+        : left_disparity(left_disparity), right_disparity(right_disparity), left_checked(left_checked), right_checked(right_checked),
+          max_difference(max_difference * 16), invalid(invalid)
+    {
+    }
+
+    void operator()(const cv::Range& range) const {
+        const int width = left_disparity.cols;
+        for (int y = range.start; y < range.end; ++y) {
+            const short* left = left_disparity.ptr<short>(y);
+            const short* right = right_disparity.ptr<short>(y);
+            short* left_out = left_checked.ptr<short>(y);
+            short* right_out = right_checked.ptr<short>(y);
+            for (int x = 0; x < width; ++x) {
+                //the left eye pixel x is seen at x - d in the right eye, and the right eye pixel x at x + d in the left eye
+                left_out[x] = consistent(left[x], right, x - shift(left[x]), width) ? left[x] : invalid;
+                right_out[x] = consistent(right[x], left, x + shift(right[x]), width) ? right[x] : invalid;
+            }
+        }
+    }
+private:
+    static int shift(short disparity) {
+        return (disparity + 8) >> 4;
+    }
+
+    bool consistent(short disparity, const short* other, int other_x, int width) const {
+        return disparity > invalid && other_x >= 0 && other_x < width && other[other_x] > invalid
+               && std::abs(other[other_x] - disparity) <= max_difference;
+    }
+
+    const cv::Mat& left_disparity;
+    const cv::Mat& right_disparity;
+    cv::Mat& left_checked;
+    cv::Mat& right_checked;
+    int max_difference;
+    short invalid;
+};
+
+}
 
 /**
  * Sets up the processing object with all the information it needs to process a video feed.
+ * Resolves the stereo layout, detecting it from the content if it's set to auto, and opens (or builds) the seek index of the
+ * input files.
+ * Throws std::runtime_error if the right eye file or a calibration file is set but can't be loaded, or the region of interest lies
+ * outside the eye.
  * @param args The arguments that contain the processing parameters.
  * @param input_feed The video feed to process.
  */
 Processor::Processor(Arguments& args, cv::VideoCapture& input_feed)
-    : arguments(args), input(input_feed)
+    : arguments(args), input(input_feed), right_input(args)
 {
-    input_width   = (size_t)input.get(CV_CAP_PROP_FRAME_WIDTH);
-    input_height  = (size_t)input.get(CV_CAP_PROP_FRAME_HEIGHT);
-    split_width   = input_width / 2;
-    output_width  = split_width;
-    output_height = input_height;
+    std::string right_filename = arguments.get_value<std::string>(Arguments::RIGHT_FILENAME);
+    StereoLayout::Type layout_type = StereoLayout::from_string(arguments.get_value<std::string>(Arguments::LAYOUT));
+    if (!right_filename.empty()) {
+        layout_type = StereoLayout::SEPARATE;
+        if (!right_input.open(right_filename)) {
+            throw std::runtime_error("Error: right eye file [" + right_filename + "] cannot be opened for reading");
+        }
+    } else if (layout_type == StereoLayout::SEPARATE) {
+        throw std::runtime_error("Error: the separate layout needs a right eye file");
+    } else if (layout_type == StereoLayout::AUTO) {
+        layout_type = StereoLayout::detect(input);
+    }
+
+    //exact seeking, where the files can be indexed; mapped files already seek exactly
+    if (!MappedCapture::is_mapped(input)) {
+        index = open_index(arguments.get_value<std::string>(Arguments::INPUT_FILENAME));
+    }
+    if (right_input.isOpened() && !right_input.is_mapped()) {
+        right_index = open_index(right_filename);
+    }
+
+    disparity_cache.open(arguments.get_value<std::string>(Arguments::CACHE_DIRECTORY),
+                         (size_t)arguments.get_value<int>(Arguments::CACHE_SIZE) * 1024 * 1024,
+                         arguments.get_value<std::string>(Arguments::INPUT_FILENAME), right_filename);
+
+    setup(cv::Size(input.get(CV_CAP_PROP_FRAME_WIDTH), input.get(CV_CAP_PROP_FRAME_HEIGHT)), layout_type);
 }
 
 /**
- * Prepare the output stream.
+ * Sets up the processing object for frames that don't come from a video feed (e.g. a raw stream), which are handed to
+ * compute_depth() directly. The feed-reading functions have nothing to read.
+ * Throws std::runtime_error if a calibration file is set but can't be loaded, or the region of interest lies outside the eye.
+ * @param args The arguments that contain the processing parameters.
+ * @param frame_size The size of every frame.
+ * @param layout_type The stereo layout of the frames, already resolved (not AUTO). For SEPARATE, the right eye is handed in too.
+ */
+Processor::Processor(Arguments& args, const cv::Size& frame_size, StereoLayout::Type layout_type)
+    : arguments(args), input(no_input), right_input(args)
+{
+    setup(frame_size, layout_type);
+}
+
+/**
+ * Work out the eye and output sizes and create the matcher. Shared by the constructors.
+ * @param frame_size The size of one input frame.
+ * @param layout_type The resolved stereo layout.
+ */
+void Processor::setup(const cv::Size& frame_size, StereoLayout::Type layout_type) {
+    input_width   = frame_size.width;
+    input_height  = frame_size.height;
+    layout = StereoLayout(layout_type, frame_size);
+
+    output_width  = layout.get_output_size().width;
+    output_height = layout.get_output_size().height;
+    //both depth maps are packed the same way the eyes came in: top-bottom for top-bottom input, side-by-side otherwise
+    if (arguments.get_value<bool>(Arguments::BOTH_EYES)) {
+        if (layout_type == StereoLayout::TB || layout_type == StereoLayout::HALF_TB) {
+            output_height *= 2;
+        } else {
+            output_width *= 2;
+        }
+    }
+    video_size    = cv::Size(output_width, output_height);
+    std::string output_size = arguments.get_value<std::string>(Arguments::OUTPUT_SIZE);
+    if (!output_size.empty()) {
+        std::sscanf(output_size.c_str(), "%dx%d", &video_size.width, &video_size.height);
+    }
+    mapper        = Matcher::create(arguments);
+    peak_memory   = 0;
+    frame_number  = 0;
+    strip_count   = 0;
+
+    std::string calibration_filename = arguments.get_value<std::string>(Arguments::CALIBRATION_FILENAME);
+    if (!calibration_filename.empty()) {
+        rectifier.load(calibration_filename, layout.get_eye_size());
+    }
+
+    //the eye size is only known here; a region of interest that misses the eye would otherwise process the whole frame
+    std::string roi = arguments.get_value<std::string>(Arguments::ROI);
+    int width = 0, height = 0, x = 0, y = 0;
+    if (std::sscanf(roi.c_str(), "%dx%d+%d+%d", &width, &height, &x, &y) == 4
+            && (cv::Rect(x, y, width, height) & cv::Rect(cv::Point(0, 0), layout.get_eye_size())).area() == 0) {
+        throw std::runtime_error("Error: the region of interest [" + roi + "] lies outside the " + std::to_string(layout.get_eye_size().width)
+                                 + "x" + std::to_string(layout.get_eye_size().height) + " eye");
+    }
+}
+
+/**
+ * Prepare the output stream, and the confidence and point cloud outputs when they are set.
+ * Throws std::runtime_error if an extra output can't be opened (point clouds also need a calibration with Q).
  * @return a shared pointer to a video output stream.
  */
 std::shared_ptr<cv::VideoWriter> Processor::create_writer() {
@@ -30,10 +195,26 @@ std::shared_ptr<cv::VideoWriter> Processor::create_writer() {
     std::string output_filename = arguments.get_value<std::string>(Arguments::OUTPUT_FILENAME);
     int output_fourcc           = arguments.get_value<int>(Arguments::OUTPUT_FOURCC);
 
-    double fps = input.get(CV_CAP_PROP_FPS);
+    double fps = get_fps();
 
     std::shared_ptr<cv::VideoWriter> output_feed(new cv::VideoWriter());
-    output_feed->open(output_filename, output_fourcc, fps, cv::Size(output_width, output_height), true);
+    output_feed->open(output_filename, output_fourcc, fps, video_size, true);
+
+    //the confidence video goes along with whatever is written to the output
+    std::string confidence_filename = arguments.get_value<std::string>(Arguments::CONFIDENCE_FILENAME);
+    if (!confidence_filename.empty()) {
+        confidence_feed.reset(new cv::VideoWriter());
+        confidence_feed->open(confidence_filename, output_fourcc, fps, layout.get_output_size(), true);
+        if (!confidence_feed->isOpened()) {
+            throw std::runtime_error("Error: confidence file [" + confidence_filename + "] cannot be opened for writing");
+        }
+    }
+    std::string points_filename = arguments.get_value<std::string>(Arguments::POINTS_FILENAME);
+    if (!points_filename.empty()) {
+        point_cloud.reset(new PointCloudWriter(points_filename,
+                                               PointCloudWriter::parse_format(arguments.get_value<std::string>(Arguments::POINTS_FORMAT)),
+                                               rectifier.get_Q()));
+    }
 
     return output_feed;
 }
@@ -43,8 +224,24 @@ std::shared_ptr<cv::VideoWriter> Processor::create_writer() {
  * @param frame_index which frame to display and process next.
  */
 void Processor::set_next_frame(size_t frame_index) {
+    TraceSpan span("seek", frame_index);
+    frame_number = frame_index;
     //set our specified starting frame to be the next captured
-    input.set(CV_CAP_PROP_POS_FRAMES, frame_index);
+    if (index) {
+        index->seek(input, frame_index);
+    } else {
+        input.set(CV_CAP_PROP_POS_FRAMES, frame_index);
+    }
+    if (right_input.isOpened()) {
+        if (right_index) {
+            right_index->seek(right_input, frame_index);
+        } else {
+            right_input.set(CV_CAP_PROP_POS_FRAMES, frame_index);
+        }
+    }
+    //frames before the jump say nothing about the ones after it
+    temporal_filter.reset();
+    right_temporal_filter.reset();
 }
 
 /**
@@ -59,41 +256,662 @@ std::shared_ptr<cv::Mat> Processor::process_frame(size_t frame_index) {
 
 /**
  * Process the next frame (set in set_next_frame or process_frame).
- * @return A matrix containing the processed image data.
+ * @return A matrix containing the processed image data, empty if no more frames could be read.
  */
 std::shared_ptr<cv::Mat> Processor::process_next_frame() {
-    //Update mapper arguments
-
-    mapper.minDisparity        = arguments.get_value<int>  (Arguments::MIN_DISPARITY);
-    mapper.numberOfDisparities = arguments.get_value<int>  (Arguments::NUM_DISPARITIES);
-    mapper.SADWindowSize       = arguments.get_value<int>  (Arguments::SAD_WINDOW_SIZE);
-    mapper.P1                  = arguments.get_value<int>  (Arguments::P1);
-    mapper.P2                  = arguments.get_value<int>  (Arguments::P2);
-    mapper.disp12MaxDiff       = arguments.get_value<int>  (Arguments::DISP12_MAX_DIFF);
-    mapper.preFilterCap        = arguments.get_value<int>  (Arguments::PRE_FILTER_CAP);
-    mapper.uniquenessRatio     = arguments.get_value<int>  (Arguments::UNIQUENESS);
-    mapper.speckleWindowSize   = arguments.get_value<int>  (Arguments::SPECKLE_WINDOW_SIZE);
-    mapper.speckleRange        = arguments.get_value<int>  (Arguments::SPECKLE_RANGE);
-    mapper.fullDP              = arguments.get_value<bool> (Arguments::FULL_DP);
-
-    cv::Mat frame_src, left_eye, right_eye, frame_dst_16_gray, frame_dst_8_gray;
+    cv::Mat frame_src, right_src, frame_dst_16_output;
     std::shared_ptr<cv::Mat> output_frame(new cv::Mat());
 
     //capture current frame to matrix
-    input >> frame_src;
+    if (!read_frame(frame_src, right_src)) {
+        return output_frame;
+    }
 
-    //split the source frame into left and right eye frames
-    left_eye = frame_src.colRange(0, split_width);
-    right_eye = frame_src.colRange(split_width, input_width);
+    compute_depth(frame_src, right_src, frame_dst_16_output);
+    to_video_frame(frame_dst_16_output, video_size, *output_frame);
 
-    //use mapper settings to preform a disparity calculation
-    mapper(left_eye, right_eye, frame_dst_16_gray);
+    return output_frame;
+}
 
+/**
+ * Turn a disparity map into a frame of the output video.
+ * @param disparity The CV_16SC1 disparity map at the output size, from compute_depth().
+ * @param size The size of the video frame, see get_video_size().
+ * @param video_frame Receives the CV_8UC3 frame.
+ */
+void Processor::to_video_frame(const cv::Mat& disparity, const cv::Size& size, cv::Mat& video_frame) const {
     //the disparity mapper outputs CV_16UC1 when we need it in CV_8UC1
-    frame_dst_16_gray.convertTo(frame_dst_8_gray, CV_8UC1);
-    cvtColor(frame_dst_8_gray, *output_frame, CV_GRAY2RGB);
+    cv::Mat gray, scaled;
+    disparity.convertTo(gray, CV_8UC1);
+    //scaled while still one channel
+    if (gray.size() != size) {
+        resize(gray, scaled, size, 0, 0, size.area() < gray.size().area() ? cv::INTER_AREA : cv::INTER_LINEAR);
+        gray = scaled;
+    }
+    cvtColor(gray, video_frame, CV_GRAY2RGB);
+}
 
-    return output_frame;
+/**
+ * Compute the output disparity map of one decoded frame: split the eyes, rectify, match, and bring the result to the
+ * output size (with the right eye's map packed next to it for --both-eyes).
+ * @param frame_src The decoded input frame.
+ * @param right_src The decoded right eye frame for separate files, ignored otherwise.
+ * @param disparity Receives the CV_16SC1 disparity map at the output size.
+ */
+void Processor::compute_depth(const cv::Mat& frame_src, const cv::Mat& right_src, cv::Mat& disparity) {
+    //Update mapper arguments
+    double match_scale = arguments.get_value<double>(Arguments::MATCH_SCALE);
+    configure_mapper(match_scale);
+
+    //spans are tagged with the frame number, and the frame is counted as done even if a stage throws
+    int64_t frame = frame_number++;
+    TraceSpan depth_span("depth", frame);
+
+    cv::Mat left_eye, right_eye, left_rectified, right_rectified, frame_dst_16_gray, frame_dst_16_output;
+
+    //take views of the left and right eyes
+    {
+        TraceSpan span("split", frame);
+        split_eyes(frame_src, right_src, left_eye, right_eye);
+    }
+
+    //correct lens distortion and camera misalignment right before matching
+    if (rectifier.is_enabled()) {
+        TraceSpan span("rectify", frame);
+        rectifier.rectify(left_eye, right_eye, left_rectified, right_rectified);
+        left_eye = left_rectified;
+        right_eye = right_rectified;
+    }
+
+    //with a region of interest only the region, and the border its matching windows and disparity search reach into, is matched
+    cv::Size eye_size = left_eye.size();
+    cv::Rect roi = get_roi(arguments, eye_size);
+    cv::Rect region(cv::Point(0, 0), eye_size);
+    cv::Mat left_full = left_eye;
+    if (roi.area() > 0) {
+        region = get_match_region(arguments, roi, eye_size, arguments.get_value<bool>(Arguments::BOTH_EYES) || arguments.get_value<int>(Arguments::CROSS_CHECK) >= 0);
+        left_eye = left_eye(region);
+        right_eye = right_eye(region);
+    }
+
+    //use mapper settings to preform a disparity calculation. The right eye's map, when it's wanted, is matched on its own thread
+    //from the same decoded and preprocessed eyes, and the memory budget is split between the two.
+    bool both_eyes = arguments.get_value<bool>(Arguments::BOTH_EYES);
+    int max_difference = arguments.get_value<int>(Arguments::CROSS_CHECK);
+    bool right_wanted = both_eyes || max_difference >= 0;
+    size_t budget = (size_t)arguments.get_value<int>(Arguments::MAX_MEMORY) * 1024 * 1024;
+    if (right_wanted) {
+        budget /= 2;
+    }
+
+    cv::Mat right_dst_16_gray, right_dst_16_output;
+    MatchStats left_stats, right_stats;
+    //a cached frame skips matching altogether
+    bool cached = false;
+    if (disparity_cache.is_enabled()) {
+        TraceSpan span("cache lookup", frame);
+        cached = disparity_cache.load(arguments, region, right_wanted, frame, frame_dst_16_gray, right_dst_16_gray);
+    }
+    if (!cached) {
+        if (right_wanted) {
+            std::exception_ptr right_error;
+            std::thread right_thread([&]() {
+                try {
+                    Tracer::name_thread("right eye matcher");
+                    TraceSpan span("match right", frame);
+                    compute_right_disparity(*right_mapper, left_eye, right_eye, match_scale, budget, right_dst_16_gray, right_stats);
+                } catch (...) {
+                    right_error = std::current_exception();
+                }
+            });
+            try {
+                TraceSpan span("match", frame);
+                compute_disparity(*mapper, left_eye, right_eye, match_scale, budget, frame_dst_16_gray, left_stats);
+            } catch (...) {
+                right_thread.join();
+                throw;
+            }
+            {
+                TraceSpan span("wait right eye", frame);
+                right_thread.join();
+            }
+            if (right_error) {
+                std::rethrow_exception(right_error);
+            }
+        } else {
+            TraceSpan span("match", frame);
+            compute_disparity(*mapper, left_eye, right_eye, match_scale, budget, frame_dst_16_gray, left_stats);
+        }
+        if (disparity_cache.is_enabled()) {
+            TraceSpan span("cache store", frame);
+            disparity_cache.store(arguments, region, right_wanted, frame, frame_dst_16_gray, right_dst_16_gray);
+        }
+    }
+    if (right_wanted && max_difference >= 0) {
+        TraceSpan span("cross-check", frame);
+        cross_check(frame_dst_16_gray, right_dst_16_gray, max_difference);
+    }
+    //the two directions run at the same time, so their memory adds up
+    peak_memory = std::max(peak_memory, left_stats.peak_memory + right_stats.peak_memory);
+    strip_count = std::max(strip_count, std::max(left_stats.strip_count, right_stats.strip_count));
+
+    {
+        TraceSpan span("post-filter", frame);
+        refine(left_eye, right_eye, frame_dst_16_gray, right_dst_16_gray, right_wanted);
+    }
+    {
+        TraceSpan span("temporal", frame);
+        stabilize(left_eye, right_eye, frame_dst_16_gray, right_dst_16_gray, right_wanted);
+    }
+
+    //put the region back into full eye maps, invalid outside the region of interest
+    if (roi.area() > 0) {
+        cv::Mat pasted;
+        paste_roi(arguments, frame_dst_16_gray, roi, region, eye_size, pasted);
+        frame_dst_16_gray = pasted;
+        if (right_wanted) {
+            paste_roi(arguments, right_dst_16_gray, roi, region, eye_size, pasted);
+            right_dst_16_gray = pasted;
+        }
+        //no confidence outside the region of interest
+        if (!confidence.empty()) {
+            cv::Mat full_confidence = cv::Mat::zeros(eye_size, confidence.type());
+            cv::Mat kept = full_confidence(roi);
+            confidence(roi - region.tl()).copyTo(kept);
+            confidence = full_confidence;
+        }
+        left_eye = left_full;
+    }
+    if (!confidence.empty() && confidence.size() != layout.get_output_size()) {
+        cv::Mat output_confidence;
+        resize(confidence, output_confidence, layout.get_output_size(), 0, 0, cv::INTER_NEAREST);
+        confidence = output_confidence;
+    }
+
+    //reproject the rectified eye's map, before it's stretched to the display aspect
+    if (point_cloud) {
+        TraceSpan span("points", frame);
+        point_cloud->write(frame_dst_16_gray, left_eye, (short)((arguments.get_value<int>(Arguments::MIN_DISPARITY) - 1) * 16));
+    }
+
+    if (confidence_feed && !confidence.empty()) {
+        TraceSpan span("encode confidence", frame);
+        cv::Mat confidence_rgb;
+        cvtColor(confidence, confidence_rgb, CV_GRAY2RGB);
+        *confidence_feed << confidence_rgb;
+    }
+
+    //stretch anamorphic eyes back to their display aspect
+    TraceSpan output_span("output", frame);
+    layout.to_output(frame_dst_16_gray, frame_dst_16_output);
+    if (both_eyes) {
+        layout.to_output(right_dst_16_gray, right_dst_16_output);
+        cv::Mat packed;
+        if (layout.get_type() == StereoLayout::TB || layout.get_type() == StereoLayout::HALF_TB) {
+            cv::vconcat(frame_dst_16_output, right_dst_16_output, packed);
+        } else {
+            cv::hconcat(frame_dst_16_output, right_dst_16_output, packed);
+        }
+        frame_dst_16_output = packed;
+    }
+    disparity = frame_dst_16_output;
+}
+
+/**
+ * Parse --roi and clip it to the eye.
+ * @param args The arguments holding the region.
+ * @param eye_size The size of the (rectified) left eye.
+ * @return The region of interest in left eye pixels, empty for the whole frame.
+ */
+cv::Rect Processor::get_roi(const Arguments& args, const cv::Size& eye_size) {
+    std::string roi = args.get_value<std::string>(Arguments::ROI);
+    int width = 0, height = 0, x = 0, y = 0;
+    if (roi.empty() || std::sscanf(roi.c_str(), "%dx%d+%d+%d", &width, &height, &x, &y) != 4) {
+        return cv::Rect();
+    }
+    cv::Rect clipped = cv::Rect(x, y, width, height) & cv::Rect(cv::Point(0, 0), eye_size);
+    //a region covering the whole eye saves nothing
+    if (clipped.size() == eye_size) {
+        return cv::Rect();
+    }
+    return clipped;
+}
+
+/**
+ * Grow the region of interest by what matching it needs: the disparity search reaches sideways into the other eye
+ * (both ways when the right eye's map is wanted too), and the matching window and filters reach a few pixels around it.
+ * Above and below, it gets the same settling rows as a strip (plus the filter's reach), so inside the region of interest
+ * the result is the same as matching the whole frame.
+ * @param args The matching arguments.
+ * @param roi The region of interest.
+ * @param eye_size The size of the eye.
+ * @param right_wanted Whether the right eye's map is computed too.
+ * @return The region to match, inside the eye.
+ */
+cv::Rect Processor::get_match_region(const Arguments& args, const cv::Rect& roi, const cv::Size& eye_size, bool right_wanted) {
+    int min_disparity = args.get_value<int>(Arguments::MIN_DISPARITY);
+    int max_disparity = min_disparity + args.get_value<int>(Arguments::NUM_DISPARITIES);
+    //the matching window and the guided filter's window reach out too
+    int border = args.get_value<int>(Arguments::SAD_WINDOW_SIZE) / 2 + args.get_value<int>(Arguments::POST_FILTER) + 2;
+    int rows = settle_rows(args.get_value<int>(Arguments::SAD_WINDOW_SIZE)) + args.get_value<int>(Arguments::POST_FILTER);
+
+    //a left eye pixel at x is found in the right eye between x - max_disparity and x - min_disparity
+    int left_reach = std::max(0, max_disparity);
+    int right_reach = std::max(0, -min_disparity);
+    if (right_wanted) {
+        left_reach = right_reach = std::max(std::abs(min_disparity), std::abs(max_disparity));
+    }
+
+    cv::Rect region(roi.x - left_reach - border, roi.y - rows,
+                    roi.width + left_reach + right_reach + 2 * border, roi.height + 2 * rows);
+    return region & cv::Rect(cv::Point(0, 0), eye_size);
+}
+
+/**
+ * Paste the region of interest of a map matched over the match region into a full eye map.
+ * @param args The matching arguments, for the invalid value.
+ * @param region_disparity The CV_16SC1 map of the match region.
+ * @param roi The region of interest.
+ * @param region The match region the map covers.
+ * @param eye_size The size of the eye.
+ * @param disparity Receives a map of the eye's size, invalid outside the region of interest.
+ */
+void Processor::paste_roi(const Arguments& args, const cv::Mat& region_disparity, const cv::Rect& roi, const cv::Rect& region,
+                          const cv::Size& eye_size, cv::Mat& disparity) {
+    disparity.create(eye_size, CV_16SC1);
+    disparity.setTo(cv::Scalar((args.get_value<int>(Arguments::MIN_DISPARITY) - 1) * 16));
+    cv::Mat kept = disparity(roi);
+    region_disparity(roi - region.tl()).copyTo(kept);
+}
+
+/**
+ * Read the next frame. For separate files, the right eye is read from its own file.
+ * @param frame_src Receives the decoded frame.
+ * @param right_src Receives the decoded right eye frame for separate files.
+ * @return False if no frame could be read.
+ */
+bool Processor::read_frame(cv::Mat& frame_src, cv::Mat& right_src) {
+    TraceSpan span("decode", frame_number);
+    input >> frame_src;
+    if (right_input.isOpened()) {
+        right_input >> right_src;
+    }
+    return !frame_src.empty() && !(right_input.isOpened() && right_src.empty());
+}
+
+/**
+ * Split a decoded frame into eye views, without copying.
+ * With --luma the eyes are instead converted to gray while splitting, into contiguous buffers that are reused every frame
+ * (the returned eyes stay valid until the next split). Sources that are all gray already are split into views all the same.
+ * @param frame_src The decoded frame that the eye views point into.
+ * @param right_src The decoded right eye frame for separate files.
+ * @param left_eye Receives the left eye view.
+ * @param right_eye Receives the right eye view.
+ */
+void Processor::split_eyes(const cv::Mat& frame_src, const cv::Mat& right_src, cv::Mat& left_eye, cv::Mat& right_eye) {
+    bool gray_sources = frame_src.channels() == 1 && (right_src.empty() || right_src.channels() == 1);
+    if (arguments.get_value<bool>(Arguments::LUMA) && gray_sources) {
+        //already luma, e.g. the Y plane of a mapped file: the views are enough. A colour right eye still goes through split_luma
+        right_eye = right_src;
+        layout.split(frame_src, left_eye, right_eye);
+    } else if (arguments.get_value<bool>(Arguments::LUMA)) {
+        layout.split_luma(frame_src, right_src, left_luma, right_luma);
+        left_eye = left_luma;
+        right_eye = right_luma;
+    } else {
+        right_eye = right_src;
+        layout.split(frame_src, left_eye, right_eye);
+    }
+}
+
+/**
+ * Update the mapper from the arguments. When matching below full resolution, the disparity range is scaled to match.
+ * @param scale The fraction of the input resolution that matching runs at.
+ */
+void Processor::configure_mapper(double scale) {
+    int min_disparity   = arguments.get_value<int>(Arguments::MIN_DISPARITY);
+    int num_disparities = arguments.get_value<int>(Arguments::NUM_DISPARITIES);
+
+    //the right eye gets its own matcher (and its own buffers) so the two directions can run concurrently
+    bool right_wanted = arguments.get_value<bool>(Arguments::BOTH_EYES) || arguments.get_value<int>(Arguments::CROSS_CHECK) >= 0;
+    if (right_wanted && !right_mapper) {
+        right_mapper = Matcher::create(arguments);
+    }
+
+    if (scale >= 1.0) {
+        match_min_disparity = min_disparity;
+        mapper->configure(arguments);
+        if (right_wanted) {
+            right_mapper->configure(arguments);
+        }
+    } else {
+        //disparity is measured in pixels, so the search range shrinks with the image. Keep it a non-zero multiple of 16.
+        Arguments scaled_arguments(arguments);
+        match_min_disparity = (int)std::floor(min_disparity * scale);
+        scaled_arguments.set_value<int>(Arguments::MIN_DISPARITY, match_min_disparity);
+        scaled_arguments.set_value<int>(Arguments::NUM_DISPARITIES, std::max(16, (int)std::ceil(num_disparities * scale / 16.0) * 16));
+        mapper->configure(scaled_arguments);
+        if (right_wanted) {
+            right_mapper->configure(scaled_arguments);
+        }
+    }
+}
+
+/**
+ * Compute the left eye's disparity map, at reduced resolution if --match-scale asks for it.
+ * @param matcher The matcher to use.
+ * @param left_eye The left eye frame.
+ * @param right_eye The right eye frame.
+ * @param scale The fraction of the input resolution to match at.
+ * @param budget Matcher memory budget in bytes, 0 for unlimited.
+ * @param disparity Receives the CV_16SC1 disparity map.
+ * @param stats Updated with the memory and strips used.
+ */
+void Processor::compute_disparity(Matcher& matcher, const cv::Mat& left_eye, const cv::Mat& right_eye, double scale, size_t budget,
+                                  cv::Mat& disparity, MatchStats& stats) {
+    if (scale < 1.0) {
+        match_scaled(matcher, left_eye, right_eye, scale, budget, disparity, stats);
+    } else {
+        match(matcher, left_eye, right_eye, budget, disparity, stats);
+    }
+}
+
+/**
+ * Compute the right eye's disparity map with the same matcher settings, by matching the mirrored eyes with their roles swapped.
+ * Mirroring turns the right eye into a left eye of the same geometry, so disparity keeps its sign and range and every engine
+ * works unchanged. The result is mirrored back.
+ * @param matcher The matcher to use (not the one matching the left eye at the same time).
+ * @param left_eye The left eye frame.
+ * @param right_eye The right eye frame.
+ * @param scale The fraction of the input resolution to match at.
+ * @param budget Matcher memory budget in bytes, 0 for unlimited.
+ * @param disparity Receives the CV_16SC1 disparity map of the right eye.
+ * @param stats Updated with the memory and strips used.
+ */
+void Processor::compute_right_disparity(Matcher& matcher, const cv::Mat& left_eye, const cv::Mat& right_eye, double scale, size_t budget,
+                                        cv::Mat& disparity, MatchStats& stats) {
+    cv::Mat left_mirrored, right_mirrored, mirrored_disparity;
+    cv::flip(left_eye, left_mirrored, 1);
+    cv::flip(right_eye, right_mirrored, 1);
+    compute_disparity(matcher, right_mirrored, left_mirrored, scale, budget, mirrored_disparity, stats);
+    cv::flip(mirrored_disparity, disparity, 1);
+}
+
+/**
+ * Mask the pixels of both disparity maps that fail the left-right consistency check.
+ * @param left_disparity The left eye's CV_16SC1 disparity map, updated in place.
+ * @param right_disparity The right eye's CV_16SC1 disparity map, updated in place.
+ * @param max_difference Largest allowed difference between the two eyes' disparities, in pixels.
+ */
+void Processor::cross_check(cv::Mat& left_disparity, cv::Mat& right_disparity, int max_difference) const {
+    short invalid = (short)((arguments.get_value<int>(Arguments::MIN_DISPARITY) - 1) * 16);
+    cv::Mat left_checked(left_disparity.size(), CV_16SC1), right_checked(right_disparity.size(), CV_16SC1);
+    cv::parallel_for_(cv::Range(0, left_disparity.rows),
+                      CrossCheckBody(left_disparity, right_disparity, left_checked, right_checked, max_difference, invalid));
+    left_disparity = left_checked;
+    right_disparity = right_checked;
+}
+
+/**
+ * Clean up the disparity maps with --post-filter, guided by the eyes they were matched from, and work out the left eye's
+ * confidence for --confidence.
+ * @param left_eye The (rectified) left eye frame.
+ * @param right_eye The (rectified) right eye frame.
+ * @param left_disparity The left eye's CV_16SC1 disparity map, replaced by the filtered map.
+ * @param right_disparity The right eye's CV_16SC1 disparity map, replaced by the filtered map.
+ * @param right_wanted True if the right eye's map was computed.
+ */
+void Processor::refine(const cv::Mat& left_eye, const cv::Mat& right_eye, cv::Mat& left_disparity, cv::Mat& right_disparity,
+                       bool right_wanted) {
+    int radius = arguments.get_value<int>(Arguments::POST_FILTER);
+    bool confidence_wanted = !arguments.get_value<std::string>(Arguments::CONFIDENCE_FILENAME).empty();
+    post_filter.configure(radius);
+    right_post_filter.configure(radius);
+    if (!post_filter.is_enabled() && !confidence_wanted) {
+        return;
+    }
+
+    short invalid = (short)((arguments.get_value<int>(Arguments::MIN_DISPARITY) - 1) * 16);
+    cv::Mat filtered, eye_confidence;
+    post_filter.filter(left_disparity, left_eye, invalid, filtered, confidence_wanted ? &eye_confidence : 0);
+    left_disparity = filtered;
+    if (right_wanted && right_post_filter.is_enabled()) {
+        cv::Mat right_filtered;
+        right_post_filter.filter(right_disparity, right_eye, invalid, right_filtered);
+        right_disparity = right_filtered;
+    }
+
+    //brought to the output size once the region of interest is back in place
+    if (confidence_wanted) {
+        confidence = eye_confidence;
+    }
+}
+
+/**
+ * Smooth the disparity maps over time with --temporal, guided by the eyes they were matched from.
+ * Does nothing when the filter is off.
+ * @param left_eye The (rectified) left eye frame.
+ * @param right_eye The (rectified) right eye frame.
+ * @param left_disparity The left eye's CV_16SC1 disparity map, replaced by the stabilized map.
+ * @param right_disparity The right eye's CV_16SC1 disparity map, replaced by the stabilized map.
+ * @param right_wanted True if the right eye's map was computed.
+ */
+void Processor::stabilize(const cv::Mat& left_eye, const cv::Mat& right_eye, cv::Mat& left_disparity, cv::Mat& right_disparity,
+                          bool right_wanted) {
+    int window = arguments.get_value<int>(Arguments::TEMPORAL);
+    temporal_filter.configure(window);
+    right_temporal_filter.configure(right_wanted ? window : 0);
+    if (!temporal_filter.is_enabled()) {
+        return;
+    }
+
+    short invalid = (short)((arguments.get_value<int>(Arguments::MIN_DISPARITY) - 1) * 16);
+    cv::Mat stabilized;
+    temporal_filter.filter(left_disparity, left_eye, invalid, stabilized);
+    left_disparity = stabilized;
+    if (right_temporal_filter.is_enabled()) {
+        cv::Mat right_stabilized;
+        right_temporal_filter.filter(right_disparity, right_eye, invalid, right_stabilized);
+        right_disparity = right_stabilized;
+    }
+}
+
+/**
+ * Match a reduced resolution copy of the eye pair, then upsample the result to full resolution guided by the left eye.
+ * Matching cost falls with the pixel count and the disparity range, roughly with the cube of the scale.
+ * @param matcher The matcher to use.
+ * @param left_eye The full resolution left eye frame.
+ * @param right_eye The full resolution right eye frame.
+ * @param scale The fraction of the input resolution to match at, within (0, 1).
+ * @param budget Matcher memory budget in bytes, 0 for unlimited.
+ * @param disparity Receives the full resolution CV_16SC1 disparity map.
+ * @param stats Updated with the memory and strips used.
+ */
+void Processor::match_scaled(Matcher& matcher, const cv::Mat& left_eye, const cv::Mat& right_eye, double scale, size_t budget,
+                             cv::Mat& disparity, MatchStats& stats) {
+    cv::Mat low_left, low_right, low_disparity, guide, low_guide;
+    cv::Size low_size(std::max(1, (int)std::lround(left_eye.cols * scale)), std::max(1, (int)std::lround(left_eye.rows * scale)));
+
+    resize(left_eye, low_left, low_size, 0, 0, cv::INTER_AREA);
+    resize(right_eye, low_right, low_size, 0, 0, cv::INTER_AREA);
+    match(matcher, low_left, low_right, budget, low_disparity, stats);
+
+    if (left_eye.channels() == 1) {
+        guide = left_eye;
+        low_guide = low_left;
+    } else {
+        cvtColor(left_eye, guide, CV_BGR2GRAY);
+        cvtColor(low_left, low_guide, CV_BGR2GRAY);
+    }
+
+    int min_disparity = arguments.get_value<int>(Arguments::MIN_DISPARITY);
+    upsampler.upsample(low_disparity, (short)((match_min_disparity - 1) * 16), low_guide, guide,
+                       (double)left_eye.cols / low_size.width, (short)((min_disparity - 1) * 16), disparity);
+}
+
+/**
+ * Run the matcher on one eye pair, within the --max-memory budget if one is set.
+ * When the whole frame would exceed the budget, it is matched in horizontal strips. Each strip is padded with overlapping
+ * rows above and below, so the vertical and diagonal paths have settled before they reach the rows that are kept.
+ * @param matcher The matcher to use.
+ * @param left_eye The left eye frame.
+ * @param right_eye The right eye frame.
+ * @param budget Matcher memory budget in bytes, 0 for unlimited.
+ * @param disparity Receives the CV_16SC1 disparity map for the whole frame.
+ * @param stats Updated with the memory and strips used.
+ */
+void Processor::match(Matcher& matcher, const cv::Mat& left_eye, const cv::Mat& right_eye, size_t budget, cv::Mat& disparity, MatchStats& stats) {
+    cv::Size size = left_eye.size();
+    int channels = left_eye.channels();
+
+    //the matcher's estimate includes its output map, which is the frame's disparity map here
+    size_t whole_frame = matcher.memory_estimate(size, channels);
+    if (budget == 0 || whole_frame <= budget) {
+        stats.peak_memory = std::max(stats.peak_memory, whole_frame);
+        stats.strip_count = std::max(stats.strip_count, (size_t)1);
+        matcher.compute(left_eye, right_eye, disparity);
+        return;
+    }
+
+    size_t overlap = settle_rows(arguments.get_value<int>(Arguments::SAD_WINDOW_SIZE));
+    size_t rows = choose_strip_rows(matcher, size, channels, budget, overlap);
+    size_t height = size.height;
+
+    cv::Mat strip_disparity;
+    disparity.create(size, CV_16SC1);
+    size_t strips = 0;
+    for (size_t y0 = 0; y0 < height; y0 += rows) {
+        size_t y1 = std::min(height, y0 + rows);
+        size_t top = y0 > overlap ? y0 - overlap : 0;
+        size_t bottom = std::min(height, y1 + overlap);
+
+        stats.peak_memory = std::max(stats.peak_memory, matcher.memory_estimate(cv::Size(size.width, bottom - top), channels) + disparity.total() * disparity.elemSize());
+        matcher.compute(left_eye.rowRange(top, bottom), right_eye.rowRange(top, bottom), strip_disparity);
+        cv::Mat kept_rows = disparity.rowRange(y0, y1);
+        strip_disparity.rowRange(y0 - top, y1 - top).copyTo(kept_rows);
+        ++strips;
+    }
+    stats.strip_count = std::max(stats.strip_count, strips);
+}
+
+/**
+ * Find the tallest strip whose matcher memory, including its overlap rows, stays within the budget.
+ * If even a single row is over budget, the smallest strip is used anyway.
+ * @param matcher The matcher the strips are for.
+ * @param size Size of one eye frame.
+ * @param channels Number of channels of the eye frames.
+ * @param budget The memory budget in bytes.
+ * @param overlap Number of extra rows matched above and below each strip.
+ * @return The number of kept rows per strip.
+ */
+size_t Processor::choose_strip_rows(const Matcher& matcher, const cv::Size& size, int channels, size_t budget, size_t overlap) const {
+    //the output disparity map is held for the whole frame on top of each strip
+    size_t output = (size_t)size.area() * sizeof(short);
+    size_t low = 1, high = size.height;
+    while (low < high) {
+        size_t rows = (low + high + 1) / 2;
+        size_t strip_height = std::min((size_t)size.height, rows + 2 * overlap);
+        if (matcher.memory_estimate(cv::Size(size.width, strip_height), channels) + output <= budget) {
+            low = rows;
+        } else {
+            high = rows - 1;
+        }
+    }
+    return low;
+}
+
+/**
+ * Estimate the matcher memory one frame needs with the current arguments, before any frame is read.
+ * Match scale, luma, a second eye and the --max-memory strip budget are all taken into account.
+ * @return The estimated peak matcher memory in bytes.
+ */
+size_t Processor::memory_estimate() {
+    double match_scale = arguments.get_value<double>(Arguments::MATCH_SCALE);
+    configure_mapper(match_scale);
+
+    cv::Size size = layout.get_eye_size();
+    if (match_scale < 1.0) {
+        size = cv::Size(std::max(1, (int)std::lround(size.width * match_scale)), std::max(1, (int)std::lround(size.height * match_scale)));
+    }
+    int channels = arguments.get_value<bool>(Arguments::LUMA) ? 1 : 3;
+    size_t directions = (arguments.get_value<bool>(Arguments::BOTH_EYES) || arguments.get_value<int>(Arguments::CROSS_CHECK) >= 0) ? 2 : 1;
+
+    //strip matching keeps each direction within its share of the budget
+    size_t estimate = mapper->memory_estimate(size, channels);
+    size_t budget = (size_t)arguments.get_value<int>(Arguments::MAX_MEMORY) * 1024 * 1024;
+    if (budget > 0) {
+        estimate = std::min(estimate, budget / directions);
+    }
+    //the temporal filter keeps a 16-bit disparity map and an 8-bit guide per frame of its window, at eye size
+    cv::Size eye_size = layout.get_eye_size();
+    estimate += (size_t)arguments.get_value<int>(Arguments::TEMPORAL) * eye_size.area() * 3;
+    return estimate * directions;
+}
+
+/**
+ * @return The number of input frames: exact if the input is indexed, the container's estimate otherwise.
+ */
+size_t Processor::get_frame_count() const {
+    if (index) {
+        return index->frame_count();
+    }
+    return (size_t)input.get(CV_CAP_PROP_FRAME_COUNT);
+}
+
+/**
+ * @return The cache of matcher output, for its statistics.
+ */
+const DisparityCache& Processor::get_disparity_cache() const {
+    return disparity_cache;
+}
+
+/**
+ * @return The size of the input frames.
+ */
+cv::Size Processor::get_input_size() const {
+    return cv::Size(input_width, input_height);
+}
+
+/**
+ * @return The size of the output frames.
+ */
+cv::Size Processor::get_output_size() const {
+    return cv::Size(output_width, output_height);
+}
+
+/**
+ * @return The size of the written video: --output-size if it's set, the output size otherwise.
+ */
+cv::Size Processor::get_video_size() const {
+    return video_size;
+}
+
+/**
+ * @return The frame rate of the input feed, 0 if frames are handed in directly.
+ */
+double Processor::get_fps() const {
+    return input.get(CV_CAP_PROP_FPS);
+}
+
+/**
+ * @return The stereo layout in use, after auto detection.
+ */
+const StereoLayout& Processor::get_layout() const {
+    return layout;
+}
+
+/**
+ * @return The highest estimated matcher memory use of any frame so far, in bytes.
+ */
+size_t Processor::get_peak_memory() const {
+    return peak_memory;
+}
+
+/**
+ * @return The highest number of strips a frame has been split into to stay within --max-memory.
+ */
+size_t Processor::get_strip_count() const {
+    return strip_count;
 }
 
 /**
@@ -111,7 +929,12 @@ void Processor::process_frame(size_t frame_index, cv::VideoWriter& output_feed)
  * @param output_feed The feed to write the next processed image data to.
  */
 void Processor::process_next_frame(cv::VideoWriter& output_feed) {
-    output_feed << *(process_next_frame());
+    std::shared_ptr<cv::Mat> output_frame = process_next_frame();
+    //past the end of the input there is nothing to write
+    if (!output_frame->empty()) {
+        TraceSpan span("encode", frame_number - 1);
+        output_feed << *output_frame;
+    }
 }
 
 /**
@@ -137,3 +960,183 @@ void Processor::process_clip(cv::VideoWriter& output_feed) {
     size_t end_frame   = arguments.get_value<int>(Arguments::END_FRAME);
     process_range(start_frame, end_frame, output_feed);
 }
+
+/**
+ * Time each matching engine on the same decoded frames (starting at START_FRAME) and report the speed relative to the first engine.
+ * Decoding isn't timed, and every engine gets one untimed warm-up frame so buffer allocation doesn't count.
+ * @param engines The engine names to compare, baseline first.
+ * @param frame_count How many frames to time each engine on.
+ * @param report The stream to write the results to.
+ */
+void Processor::benchmark(const std::vector<std::string>& engines, size_t frame_count, std::ostream& report) {
+    std::vector<cv::Mat> left_eyes, right_eyes;
+
+    set_next_frame(arguments.get_value<int>(Arguments::START_FRAME));
+    for (size_t index = 0; index < frame_count; ++index) {
+        cv::Mat frame_src, right_src, left_eye, right_eye;
+        if (!read_frame(frame_src, right_src)) {
+            break;
+        }
+        split_eyes(frame_src, right_src, left_eye, right_eye);
+        //luma eyes live in buffers that the next read overwrites
+        left_eyes.push_back(left_eye.data == left_luma.data ? left_eye.clone() : left_eye);
+        right_eyes.push_back(right_eye.data == right_luma.data ? right_eye.clone() : right_eye);
+    }
+
+    if (left_eyes.empty()) {
+        report << "No frames could be read for benchmarking" << std::endl;
+        return;
+    }
+
+    report << "Benchmarking " << left_eyes.size() << " frames of " << left_eyes[0].cols << "x" << left_eyes[0].rows
+           << ", " << arguments.get_value<int>(Arguments::NUM_DISPARITIES) << " disparities" << std::endl;
+
+    double baseline = 0;
+    for (const std::string& engine : engines) {
+        std::shared_ptr<Matcher> matcher = Matcher::create(engine);
+        matcher->configure(arguments);
+
+        cv::Mat disparity;
+        matcher->compute(left_eyes[0], right_eyes[0], disparity);
+
+        double start = (double)cv::getTickCount();
+        for (size_t index = 0; index < left_eyes.size(); ++index) {
+            matcher->compute(left_eyes[index], right_eyes[index], disparity);
+        }
+        double seconds = ((double)cv::getTickCount() - start) / cv::getTickFrequency();
+
+        double msec_per_frame = 1000.0 * seconds / left_eyes.size();
+        if (baseline == 0) {
+            baseline = msec_per_frame;
+        }
+
+        report << engine << ":\t" << msec_per_frame << " ms/frame\t" << left_eyes.size() / seconds << " fps\t"
+               << baseline / msec_per_frame << "x";
+        if (engine == "census") {
+            report << "\t[" << CensusSGMMatcher::instruction_set(std::max(16, arguments.get_value<int>(Arguments::NUM_DISPARITIES))) << "]";
+        }
+        report << std::endl;
+    }
+
+    int radius = arguments.get_value<int>(Arguments::POST_FILTER);
+    if (radius > 0 && !engines.empty()) {
+        benchmark_post_filter(engines[0], left_eyes, right_eyes, radius, report);
+    }
+    if (NumaPlacement::parse(arguments.get_value<std::string>(Arguments::NUMA)) != NumaPlacement::OFF && !engines.empty()) {
+        benchmark_numa(engines[0], left_eyes, right_eyes, report);
+    }
+}
+
+/**
+ * Time the baseline engine on frames held in this node's memory, against the same frames held in another node's memory,
+ * which is what unpinned runs on a multi-socket machine end up doing much of the time. The matching threads are the
+ * pinned ones either way, so only where the frames live differs.
+ * @param engine The baseline engine.
+ * @param left_eyes The decoded left eye frames, allocated by this (pinned) thread.
+ * @param right_eyes The decoded right eye frames.
+ * @param report The stream to write the results to.
+ */
+void Processor::benchmark_numa(const std::string& engine, const std::vector<cv::Mat>& left_eyes, const std::vector<cv::Mat>& right_eyes,
+                               std::ostream& report) {
+    std::vector<std::vector<int> > nodes = NumaPlacement::get_nodes();
+    int local_node = NumaPlacement::current_node();
+    int remote_node = -1;
+    for (size_t node = 0; node < nodes.size() && remote_node < 0; ++node) {
+        if ((int)node != local_node && !nodes[node].empty()) {
+            remote_node = (int)node;
+        }
+    }
+    if (remote_node < 0) {
+        report << "numa:\tonly one node with CPUs, nothing to compare" << std::endl;
+        return;
+    }
+
+    //pages go to the node of the thread that first touches them, so the remote copies are made by a thread pinned there;
+    //the local ones are copied too, so both are laid out alike
+    std::vector<cv::Mat> local_left(left_eyes.size()), local_right(right_eyes.size());
+    for (size_t index = 0; index < left_eyes.size(); ++index) {
+        local_left[index] = left_eyes[index].clone();
+        local_right[index] = right_eyes[index].clone();
+    }
+    std::vector<cv::Mat> remote_left(left_eyes.size()), remote_right(right_eyes.size());
+    bool pinned = false;
+    std::thread copier([&]() {
+        pinned = NumaPlacement::pin_thread(remote_node);
+        for (size_t index = 0; index < left_eyes.size(); ++index) {
+            remote_left[index] = left_eyes[index].clone();
+            remote_right[index] = right_eyes[index].clone();
+        }
+    });
+    copier.join();
+    if (!pinned) {
+        report << "numa:\tcannot place frames on node " << remote_node << std::endl;
+        return;
+    }
+
+    std::shared_ptr<Matcher> matcher = Matcher::create(engine);
+    matcher->configure(arguments);
+    cv::Mat disparity;
+    matcher->compute(local_left[0], local_right[0], disparity);
+    double timings[2];
+    const std::vector<cv::Mat>* lefts[2] = {&local_left, &remote_left};
+    const std::vector<cv::Mat>* rights[2] = {&local_right, &remote_right};
+    for (int placement = 0; placement < 2; ++placement) {
+        double start = (double)cv::getTickCount();
+        for (size_t index = 0; index < left_eyes.size(); ++index) {
+            matcher->compute((*lefts[placement])[index], (*rights[placement])[index], disparity);
+        }
+        timings[placement] = 1000.0 * ((double)cv::getTickCount() - start) / cv::getTickFrequency() / left_eyes.size();
+    }
+    report << "numa local (node " << local_node << "):\t" << timings[0] << " ms/frame" << std::endl;
+    report << "numa remote (node " << remote_node << "):\t" << timings[1] << " ms/frame\t" << timings[0] / timings[1] << "x" << std::endl;
+}
+
+/**
+ * Time the guided post-filter on the baseline engine's maps, against the alternative of matching with a window widened by
+ * the same radius. The filter's cost doesn't grow with its radius, the matcher's does.
+ * @param engine The baseline engine.
+ * @param left_eyes The decoded left eye frames.
+ * @param right_eyes The decoded right eye frames.
+ * @param radius The post-filter radius.
+ * @param report The stream to write the results to.
+ */
+void Processor::benchmark_post_filter(const std::string& engine, const std::vector<cv::Mat>& left_eyes,
+                                      const std::vector<cv::Mat>& right_eyes, int radius, std::ostream& report) {
+    short invalid = (short)((arguments.get_value<int>(Arguments::MIN_DISPARITY) - 1) * 16);
+    std::shared_ptr<Matcher> matcher = Matcher::create(engine);
+    matcher->configure(arguments);
+    std::vector<cv::Mat> disparities(left_eyes.size());
+    for (size_t index = 0; index < left_eyes.size(); ++index) {
+        matcher->compute(left_eyes[index], right_eyes[index], disparities[index]);
+    }
+
+    GuidedFilter filter;
+    filter.configure(radius);
+    cv::Mat filtered, filter_confidence;
+    filter.filter(disparities[0], left_eyes[0], invalid, filtered, &filter_confidence);
+
+    double start = (double)cv::getTickCount();
+    for (size_t index = 0; index < left_eyes.size(); ++index) {
+        filter.filter(disparities[index], left_eyes[index], invalid, filtered, &filter_confidence);
+    }
+    double filter_msec = 1000.0 * ((double)cv::getTickCount() - start) / cv::getTickFrequency() / left_eyes.size();
+    report << "post-filter r=" << radius << ":\t" << filter_msec << " ms/frame\t"
+           << left_eyes[0].total() / (filter_msec * 1000.0) << " Mpixel/s" << std::endl;
+
+    Arguments wide_arguments(arguments);
+    int window = arguments.get_value<int>(Arguments::SAD_WINDOW_SIZE);
+    wide_arguments.set_value<int>(Arguments::SAD_WINDOW_SIZE, window + 2 * radius);
+    wide_arguments.is_valid(Arguments::SAD_WINDOW_SIZE, true);
+    std::shared_ptr<Matcher> wide_matcher = Matcher::create(engine);
+    wide_matcher->configure(wide_arguments);
+    cv::Mat disparity;
+    wide_matcher->compute(left_eyes[0], right_eyes[0], disparity);
+
+    start = (double)cv::getTickCount();
+    for (size_t index = 0; index < left_eyes.size(); ++index) {
+        wide_matcher->compute(left_eyes[index], right_eyes[index], disparity);
+    }
+    double wide_msec = 1000.0 * ((double)cv::getTickCount() - start) / cv::getTickFrequency() / left_eyes.size();
+    report << engine << " window " << wide_arguments.get_value<int>(Arguments::SAD_WINDOW_SIZE) << ":\t" << wide_msec << " ms/frame\t"
+           << wide_msec / filter_msec << "x the post-filter" << std::endl;
+}
@@ -1,11 +1,24 @@
 #ifndef PROCESSOR_H
 #define PROCESSOR_H
 
+#include <cstdint>
 #include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
 
 #include "opencv2/highgui/highgui.hpp" //VideoCapture
-#include "opencv2/calib3d/calib3d.hpp" //StereoSGBM
 #include "arguments.hpp"
+#include "matcher.h"
+#include "upsampler.h"
+#include "rectifier.h"
+#include "stereolayout.h"
+#include "frameindex.h"
+#include "temporalfilter.h"
+#include "guidedfilter.h"
+#include "pointcloudwriter.h"
+#include "disparitycache.h"
+#include "mappedcapture.h"
 
 /**
  * This class handles the processing of the input video feed according to the application arguments.
@@ -14,6 +27,7 @@ class Processor
 {
 public:
     Processor(Arguments& args, cv::VideoCapture& input_feed);
+    Processor(Arguments& args, const cv::Size& frame_size, StereoLayout::Type layout_type);
 
     std::shared_ptr<cv::VideoWriter> create_writer();
 
@@ -25,14 +39,81 @@ public:
     void process_frame(size_t frame_index, cv::VideoWriter& output_feed);
     void process_next_frame(cv::VideoWriter& output_feed);
 
+    bool read_frame(cv::Mat& frame_src, cv::Mat& right_src);
+    void compute_depth(const cv::Mat& frame_src, const cv::Mat& right_src, cv::Mat& disparity);
+    void to_video_frame(const cv::Mat& disparity, const cv::Size& size, cv::Mat& video_frame) const;
+
     void process_range(size_t start_frame, size_t end_frame, cv::VideoWriter& output_feed);
     void process_clip(cv::VideoWriter& output_feed);
+
+    void benchmark(const std::vector<std::string>& engines, size_t frame_count, std::ostream& report);
+
+    size_t memory_estimate();
+    size_t get_frame_count() const;
+    cv::Size get_input_size() const;
+    cv::Size get_output_size() const;
+    cv::Size get_video_size() const;
+    double get_fps() const;
+    const StereoLayout& get_layout() const;
+    size_t get_peak_memory() const;
+    size_t get_strip_count() const;
+    const DisparityCache& get_disparity_cache() const;
+
+    static cv::Rect get_roi(const Arguments& args, const cv::Size& eye_size);
+    static cv::Rect get_match_region(const Arguments& args, const cv::Rect& roi, const cv::Size& eye_size, bool right_wanted);
+    static void paste_roi(const Arguments& args, const cv::Mat& region_disparity, const cv::Rect& roi, const cv::Rect& region,
+                          const cv::Size& eye_size, cv::Mat& disparity);
 private:
+    /**
+     * Memory and strip statistics of the matching done for one eye, kept apart so both eyes can be matched concurrently.
+     */
+    struct MatchStats {
+        size_t peak_memory;
+        size_t strip_count;
+        MatchStats() : peak_memory(0), strip_count(0) {}
+    };
+
+    void setup(const cv::Size& frame_size, StereoLayout::Type layout_type);
+    void split_eyes(const cv::Mat& frame_src, const cv::Mat& right_src, cv::Mat& left_eye, cv::Mat& right_eye);
+    void configure_mapper(double scale);
+    void benchmark_post_filter(const std::string& engine, const std::vector<cv::Mat>& left_eyes, const std::vector<cv::Mat>& right_eyes,
+                               int radius, std::ostream& report);
+    void benchmark_numa(const std::string& engine, const std::vector<cv::Mat>& left_eyes, const std::vector<cv::Mat>& right_eyes,
+                        std::ostream& report);
+    void compute_disparity(Matcher& matcher, const cv::Mat& left_eye, const cv::Mat& right_eye, double scale, size_t budget,
+                           cv::Mat& disparity, MatchStats& stats);
+    void compute_right_disparity(Matcher& matcher, const cv::Mat& left_eye, const cv::Mat& right_eye, double scale, size_t budget,
+                                 cv::Mat& disparity, MatchStats& stats);
+    void match_scaled(Matcher& matcher, const cv::Mat& left_eye, const cv::Mat& right_eye, double scale, size_t budget,
+                      cv::Mat& disparity, MatchStats& stats);
+    void match(Matcher& matcher, const cv::Mat& left_eye, const cv::Mat& right_eye, size_t budget, cv::Mat& disparity, MatchStats& stats);
+    size_t choose_strip_rows(const Matcher& matcher, const cv::Size& size, int channels, size_t budget, size_t overlap) const;
+    void cross_check(cv::Mat& left_disparity, cv::Mat& right_disparity, int max_difference) const;
+    void refine(const cv::Mat& left_eye, const cv::Mat& right_eye, cv::Mat& left_disparity, cv::Mat& right_disparity, bool right_wanted);
+    void stabilize(const cv::Mat& left_eye, const cv::Mat& right_eye, cv::Mat& left_disparity, cv::Mat& right_disparity, bool right_wanted);
+
     Arguments& arguments;
+    cv::VideoCapture no_input; //stands in for the feed when frames are handed in directly
     cv::VideoCapture& input;
-    cv::StereoSGBM mapper;
+    MappedCapture right_input;
+    std::shared_ptr<FrameIndex> index, right_index;
+    StereoLayout layout;
+    std::shared_ptr<Matcher> mapper, right_mapper;
+    Upsampler upsampler;
+    Rectifier rectifier;
+    GuidedFilter post_filter, right_post_filter;
+    TemporalFilter temporal_filter, right_temporal_filter;
+    cv::Mat confidence; //of the last frame, at the output size, when --confidence is set
+    std::shared_ptr<cv::VideoWriter> confidence_feed;
+    std::shared_ptr<PointCloudWriter> point_cloud;
+    DisparityCache disparity_cache; //only for frames read from files, which have an identity to key on
+    int match_min_disparity;
+    cv::Mat left_luma, right_luma;
 
-    size_t input_width, input_height, split_width, output_width, output_height;
+    size_t input_width, input_height, output_width, output_height;
+    cv::Size video_size; //of the written video, --output-size or the output size
+    size_t peak_memory, strip_count;
+    int64_t frame_number; //of the next frame read or computed, for tracing
 };
 
 #endif // PROCESSOR_H
@@ -1,11 +1,15 @@
 #include <QFileDialog>
 #include <QProgressDialog>
 #include <QMessageBox>
+#include <algorithm>
 #include <iostream>
+#include <stdexcept>
 
 #include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/calib3d/calib3d.hpp" //filterSpeckles
 
 #include "processor.h"
+#include "tracer.h"
 #include "qtopencvdepthmap.h"
 #include "ui_qtopencvdepthmap.h"
 
@@ -17,11 +21,21 @@
 QtOpenCVDepthmap::QtOpenCVDepthmap(Arguments& args, QWidget *parent) :
     QMainWindow(parent),
     arguments(args),
-    ui(new Ui::QtOpenCVDepthmap)
+    ui(new Ui::QtOpenCVDepthmap),
+    feed_src(args),
+    right_feed_src(args)
 {
     first_load = true;
+    preview_frame = 1;
     args_to_mapper();
     ui->setupUi(this);
+    build_preview();
+
+    QString engine = QString::fromStdString(arguments.get_value<std::string>(Arguments::ENGINE));
+    ui->input_engine->setCurrentIndex(ui->input_engine->findText(engine));
+    ui->input_textureThreshold->setValue(arguments.get_value<int>(Arguments::TEXTURE_THRESHOLD));
+    ui->input_preFilterSize->setValue(arguments.get_value<int>(Arguments::PRE_FILTER_SIZE));
+    update_engine_controls();
 
     set_active(false);
 
@@ -57,6 +71,9 @@ void QtOpenCVDepthmap::set_active(bool isActive) {
     ui->input_speckleWindowSize->setEnabled(isActive);
     ui->input_speckleRange->setEnabled(isActive);
     ui->input_fullDP->setEnabled(isActive);
+    ui->input_engine->setEnabled(isActive);
+    ui->input_textureThreshold->setEnabled(isActive);
+    ui->input_preFilterSize->setEnabled(isActive);
     //set position inputs enabled/disabled
     ui->horizontalSlider->setEnabled(isActive);
     ui->spinBox_clip_start->setEnabled(isActive);
@@ -80,17 +97,41 @@ void QtOpenCVDepthmap::set_active(bool isActive) {
  * Set the appropriate depthmap settings from the application arguments.
  */
 void QtOpenCVDepthmap::args_to_mapper() {
-    mapper.numberOfDisparities = arguments.get_value<int>(Arguments::NUM_DISPARITIES);
-    mapper.disp12MaxDiff = arguments.get_value<int>(Arguments::DISP12_MAX_DIFF);
-    mapper.fullDP = arguments.get_value<bool>(Arguments::FULL_DP);
-    mapper.minDisparity = arguments.get_value<int>(Arguments::MIN_DISPARITY);
-    mapper.P1 = arguments.get_value<int>(Arguments::P1);
-    mapper.P2 = arguments.get_value<int>(Arguments::P2);
-    mapper.preFilterCap = arguments.get_value<int>(Arguments::PRE_FILTER_CAP);
-    mapper.SADWindowSize = arguments.get_value<int>(Arguments::SAD_WINDOW_SIZE);
-    mapper.speckleRange = arguments.get_value<int>(Arguments::SPECKLE_RANGE);
-    mapper.speckleWindowSize = arguments.get_value<int>(Arguments::SPECKLE_WINDOW_SIZE);
-    mapper.uniquenessRatio = arguments.get_value<int>(Arguments::UNIQUENESS);
+    std::string engine = arguments.get_value<std::string>(Arguments::ENGINE);
+    //only rebuild the engine if a different one was selected
+    if (!mapper || mapper->name() != engine) {
+        mapper = Matcher::create(engine);
+    }
+    //speckles are filtered as a preview stage of their own, so speckle settings don't need a rematch
+    Arguments raw_arguments(arguments);
+    raw_arguments.set_value<int>(Arguments::SPECKLE_WINDOW_SIZE, 0);
+    mapper->configure(raw_arguments);
+}
+
+/**
+ * Show only the controls that apply to the selected matching engine.
+ */
+void QtOpenCVDepthmap::update_engine_controls() {
+    std::string engine = arguments.get_value<std::string>(Arguments::ENGINE);
+    bool is_bm = engine == "bm";
+    bool is_census = engine == "census";
+    //window based engines only, the census window is fixed
+    ui->label_SADWindowSize->setVisible(!is_census);
+    ui->input_SADWindowSize->setVisible(!is_census);
+    ui->label_preFilterCap->setVisible(!is_census);
+    ui->input_preFilterCap->setVisible(!is_census);
+    //semi-global engines only
+    ui->label_P1->setVisible(!is_bm);
+    ui->input_P1->setVisible(!is_bm);
+    ui->label_P2->setVisible(!is_bm);
+    ui->input_P2->setVisible(!is_bm);
+    ui->label_fullDP->setVisible(!is_bm);
+    ui->input_fullDP->setVisible(!is_bm);
+    //StereoBM only
+    ui->label_textureThreshold->setVisible(is_bm);
+    ui->input_textureThreshold->setVisible(is_bm);
+    ui->label_preFilterSize->setVisible(is_bm);
+    ui->input_preFilterSize->setVisible(is_bm);
 }
 
 /**
@@ -98,10 +139,25 @@ void QtOpenCVDepthmap::args_to_mapper() {
  * @param filename The video file to process.
  */
 void QtOpenCVDepthmap::open_filename(const std::string& filename) {
+    //frames of a mapped file point into its mapping, which reopening unmaps, so nothing may keep them past this point
+    ui->sbs_view->clearImage();
+    frame_src.release();
+    right_src.release();
+    left_eye.release();
+    right_eye.release();
+    preview.invalidate_all();
+
     feed_src.open(filename);
     if (feed_src.isOpened()) {
         arguments.set_value(Arguments::INPUT_FILENAME, filename);
 
+        //one demux pass in the background (or a quick sidecar read) gives exact frame counts and seeking; mapped files have both already
+        frame_index.reset();
+        pending_index = std::future<std::shared_ptr<FrameIndex> >();
+        if (!feed_src.is_mapped()) {
+            pending_index = std::async(std::launch::async, &FrameIndex::open, filename);
+        }
+
         current_pos_msec = feed_src.get(CV_CAP_PROP_POS_MSEC);
         current_pos_frame = feed_src.get(CV_CAP_PROP_POS_FRAMES);
         current_pos_radio = feed_src.get(CV_CAP_PROP_POS_AVI_RATIO);
@@ -109,12 +165,43 @@ void QtOpenCVDepthmap::open_filename(const std::string& filename) {
         input_width = feed_src.get(CV_CAP_PROP_FRAME_WIDTH);
         input_height = feed_src.get(CV_CAP_PROP_FRAME_HEIGHT);
         input_fps = feed_src.get(CV_CAP_PROP_FPS);
-        split_width = input_width * 0.5;
 
-        output_width = split_width;
-        output_height = input_height;
+        //resolve the stereo layout the same way the export will
+        std::string right_filename = arguments.get_value<std::string>(Arguments::RIGHT_FILENAME);
+        StereoLayout::Type layout_type = StereoLayout::from_string(arguments.get_value<std::string>(Arguments::LAYOUT));
+        right_feed_src.release();
+        right_frame_index.reset();
+        pending_right_index = std::future<std::shared_ptr<FrameIndex> >();
+        if (!right_filename.empty() && right_feed_src.open(right_filename)) {
+            layout_type = StereoLayout::SEPARATE;
+            //the right eye seeks through its own index, so both eyes land on the same frame
+            if (!right_feed_src.is_mapped()) {
+                pending_right_index = std::async(std::launch::async, &FrameIndex::open, right_filename);
+            }
+        } else if (layout_type == StereoLayout::AUTO || layout_type == StereoLayout::SEPARATE) {
+            layout_type = StereoLayout::detect(feed_src);
+        }
+        layout = StereoLayout(layout_type, cv::Size(input_width, input_height));
+        ui->statusBar->showMessage(QString("Stereo layout: ") + QString::fromStdString(StereoLayout::to_string(layout_type)));
+
+        output_width = layout.get_output_size().width;
+        output_height = layout.get_output_size().height;
         output_fps = input_fps;
 
+        //preview with the same rectification the export will use
+        rectifier = Rectifier();
+        std::string calibration_filename = arguments.get_value<std::string>(Arguments::CALIBRATION_FILENAME);
+        if (!calibration_filename.empty()) {
+            try {
+                rectifier.load(calibration_filename, layout.get_eye_size());
+            } catch (std::runtime_error& e) {
+                QMessageBox msgBox;
+                msgBox.setText(QString(e.what()) + "\nThe preview will not be rectified.");
+                msgBox.setIcon(QMessageBox::Warning);
+                msgBox.exec();
+            }
+        }
+
         int start_frame = arguments.get_value<int>(Arguments::START_FRAME);
         int end_frame = arguments.get_value<int>(Arguments::END_FRAME);
         if (!first_load) {
@@ -147,6 +234,8 @@ void QtOpenCVDepthmap::open_filename(const std::string& filename) {
 
         fetch_frame(start_frame);
     } else {
+        //the previous file is closed, there's nothing left to preview
+        set_active(false);
         QMessageBox msgBox;
         msgBox.setText(QString::fromStdString(filename) + " could not be opened for reading.");
         msgBox.setIcon(QMessageBox::Critical);
@@ -161,29 +250,170 @@ void QtOpenCVDepthmap::open_filename(const std::string& filename) {
  */
 void QtOpenCVDepthmap::fetch_frame(int index) {
     if (is_active) {
-        //fetch and display source frame (0-indexed)
-        feed_src.set(CV_CAP_PROP_POS_FRAMES, index-1);
-        feed_src >> frame_src;
-        ui->sbs_view->showImage(frame_src);
+        adopt_frame_index();
 
+        preview_frame = index;
+        preview.invalidate(decode_stage);
         update_depthmap();
     }
 }
 
 /**
- * Take the current input frame, process it, and display the depthmap.
+ * Start using the seek index once the background build has finished. The container's frame count estimate is replaced
+ * with the exact count. Files that can't be indexed keep using the capture's own seeking.
+ */
+void QtOpenCVDepthmap::adopt_frame_index() {
+    //the right eye's index only changes how it seeks; the frame count shown is the left eye's
+    if (pending_right_index.valid() && pending_right_index.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        try {
+            right_frame_index = pending_right_index.get();
+        } catch (std::runtime_error&) {
+            right_frame_index.reset();
+        }
+    }
+
+    if (!pending_index.valid() || pending_index.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return;
+    }
+    try {
+        frame_index = pending_index.get();
+    } catch (std::runtime_error& e) {
+        ui->statusBar->showMessage(QString(e.what()));
+        return;
+    }
+
+    input_frame_count = frame_index->frame_count();
+    ui->horizontalSlider->setMaximum(input_frame_count);
+    ui->spinBox_clip_start->setMaximum(input_frame_count);
+    ui->spinBox_clip_end->setMaximum(input_frame_count);
+    ui->spinBox_current_frame->setMaximum(input_frame_count);
+    ui->label_total_frames->setText(QString::number(input_frame_count));
+}
+
+/**
+ * Bring the preview up to date: recompute the stages whose inputs or settings changed since the last update, and nothing else.
+ * A stage that fails, such as a seek that can't reach the frame, is reported in the status bar and retried next update.
  */
 void QtOpenCVDepthmap::update_depthmap() {
-    //compute depth map with current settings and display it
-    left_eye = frame_src.colRange(0, split_width);
-    right_eye = frame_src.colRange(split_width, input_width);
-    mapper(left_eye, right_eye, frame_dst_16_gray);
-    //the disparity mapper outputs CV_16UC1 when we need it in CV_8UC1
-    frame_dst_16_gray.convertTo(frame_dst_8_gray, CV_8UC1);
-    cvtColor(frame_dst_8_gray, frame_dst_8_colour, CV_GRAY2RGB);
+    TraceSpan preview_span("preview");
+    try {
+        preview.update();
+    } catch (std::runtime_error& e) {
+        ui->statusBar->showMessage(QString(e.what()));
+    }
+}
 
-    //display depthmap frame
-    ui->depth_view->showImage(frame_dst_8_colour);
+/**
+ * Invalidate the preview stages a changed setting feeds, and update the preview. Speckle filtering settings only
+ * redo the filter and the display, matcher settings rematch, and settings no stage reads (the clip range) change nothing.
+ * @param arg The setting that changed.
+ */
+void QtOpenCVDepthmap::setting_changed(const Arguments::Arg& arg) {
+    switch (arg) {
+        case Arguments::SPECKLE_WINDOW_SIZE:
+        case Arguments::SPECKLE_RANGE:
+            preview.invalidate(speckle_stage);
+            break;
+        case Arguments::MIN_DISPARITY:
+        case Arguments::NUM_DISPARITIES:
+        case Arguments::SAD_WINDOW_SIZE:
+        case Arguments::P1:
+        case Arguments::P2:
+        case Arguments::DISP12_MAX_DIFF:
+        case Arguments::PRE_FILTER_CAP:
+        case Arguments::UNIQUENESS:
+        case Arguments::FULL_DP:
+        case Arguments::ENGINE:
+        case Arguments::TEXTURE_THRESHOLD:
+        case Arguments::PRE_FILTER_SIZE:
+            args_to_mapper();
+            preview.invalidate(match_stage);
+            break;
+        default:
+            return;
+    }
+    if (is_active) {
+        update_depthmap();
+    }
+}
+
+/**
+ * Set up the stages of the preview. Each keeps its output in the frame members, so a stage only reruns when a stage it
+ * reads or one of its own settings changed.
+ */
+void QtOpenCVDepthmap::build_preview() {
+    //fetch and display source frame (0-indexed)
+    decode_stage = preview.add("preview decode", [this]() {
+        if (frame_index) {
+            frame_index->seek(feed_src, preview_frame-1);
+        } else {
+            feed_src.set(CV_CAP_PROP_POS_FRAMES, preview_frame-1);
+        }
+        feed_src >> frame_src;
+        if (right_feed_src.isOpened()) {
+            if (right_frame_index) {
+                right_frame_index->seek(right_feed_src, preview_frame-1);
+            } else {
+                right_feed_src.set(CV_CAP_PROP_POS_FRAMES, preview_frame-1);
+            }
+            right_feed_src >> right_src;
+        }
+        ui->sbs_view->showImage(frame_src);
+        //outline a region of interest given on the command line over the left eye
+        cv::Rect roi = Processor::get_roi(arguments, layout.get_eye_size());
+        ui->sbs_view->setRoi(roi.x, roi.y, roi.width, roi.height);
+    });
+
+    split_stage = preview.add("preview split", [this]() {
+        if (arguments.get_value<bool>(Arguments::LUMA)) {
+            layout.split_luma(frame_src, right_src, left_luma, right_luma);
+            left_eye = left_luma;
+            right_eye = right_luma;
+        } else {
+            if (right_feed_src.isOpened()) {
+                right_eye = right_src;
+            }
+            layout.split(frame_src, left_eye, right_eye);
+        }
+        if (rectifier.is_enabled()) {
+            rectifier.rectify(left_eye, right_eye, left_rectified, right_rectified);
+            left_eye = left_rectified;
+            right_eye = right_rectified;
+        }
+    }, {decode_stage});
+
+    //only the region of interest and the border it needs are matched, the rest is left invalid
+    match_stage = preview.add("preview match", [this]() {
+        cv::Rect roi = Processor::get_roi(arguments, left_eye.size());
+        if (roi.area() > 0) {
+            cv::Rect region = Processor::get_match_region(arguments, roi, left_eye.size(), false);
+            cv::Mat region_disparity;
+            mapper->compute(left_eye(region), right_eye(region), region_disparity);
+            Processor::paste_roi(arguments, region_disparity, roi, region, left_eye.size(), frame_dst_16_raw);
+        } else {
+            mapper->compute(left_eye, right_eye, frame_dst_16_raw);
+        }
+    }, {split_stage});
+
+    //the same filtering the engines do themselves when they are given the speckle settings
+    speckle_stage = preview.add("preview speckles", [this]() {
+        frame_dst_16_raw.copyTo(frame_dst_16_gray);
+        int speckle_window_size = arguments.get_value<int>(Arguments::SPECKLE_WINDOW_SIZE);
+        if (speckle_window_size > 0) {
+            cv::filterSpeckles(frame_dst_16_gray, (arguments.get_value<int>(Arguments::MIN_DISPARITY) - 1) * 16, speckle_window_size,
+                               16 * arguments.get_value<int>(Arguments::SPECKLE_RANGE), speckle_buffer);
+        }
+    }, {match_stage});
+
+    display_stage = preview.add("preview display", [this]() {
+        layout.to_output(frame_dst_16_gray, frame_dst_16_output);
+        //the disparity mapper outputs CV_16UC1 when we need it in CV_8UC1
+        frame_dst_16_output.convertTo(frame_dst_8_gray, CV_8UC1);
+        cvtColor(frame_dst_8_gray, frame_dst_8_colour, CV_GRAY2RGB);
+
+        //display depthmap frame
+        ui->depth_view->showImage(frame_dst_8_colour);
+    }, {speckle_stage});
 }
 
 /**
@@ -304,6 +534,34 @@ void QtOpenCVDepthmap::on_input_fullDP_stateChanged(int arg1)
     update_mapper_value<bool>(Arguments::FULL_DP, (arg1 != 0) );
 }
 
+/**
+ * Switch to a different matching engine and show its controls.
+ * @param index The index of the selected engine in the combo box.
+ */
+void QtOpenCVDepthmap::on_input_engine_currentIndexChanged(int index)
+{
+    update_mapper_value<std::string>(Arguments::ENGINE, ui->input_engine->itemText(index).toStdString());
+    update_engine_controls();
+}
+
+/**
+ * Change the specified parameter.
+ * @param arg1 the new value.
+ */
+void QtOpenCVDepthmap::on_input_textureThreshold_valueChanged(int arg1)
+{
+    update_mapper_value<int>(Arguments::TEXTURE_THRESHOLD, arg1);
+}
+
+/**
+ * Change the specified parameter.
+ * @param arg1 the new value.
+ */
+void QtOpenCVDepthmap::on_input_preFilterSize_valueChanged(int arg1)
+{
+    update_mapper_value<int>(Arguments::PRE_FILTER_SIZE, arg1);
+}
+
 /**
  * The user has changed the current preview frame.
  * @param frame_index The new frame to display.
@@ -419,24 +677,36 @@ void QtOpenCVDepthmap::on_actionExport_triggered()
         QString exportLabel = "Exporting ";
         exportLabel.append(filename);
 
-        Processor processor(arguments, this->feed_src);
-        std::shared_ptr<cv::VideoWriter> output = processor.create_writer();
-
-        size_t start_frame = arguments.get_value<int>(Arguments::START_FRAME);
-        size_t end_frame   = arguments.get_value<int>(Arguments::END_FRAME);
-        size_t range = end_frame + 1 - start_frame;
-
-        //set up progress dialog
-        QProgressDialog progress(exportLabel, "Cancel", 0, range, this);
-        progress.setWindowModality(Qt::WindowModal);
-
-        processor.set_next_frame(start_frame);
-
-        for (size_t index = start_frame; index <= end_frame && !progress.wasCanceled(); ++index) {
-            progress.setValue(index - start_frame);
-            processor.process_next_frame(*output);
+        try {
+            Processor processor(arguments, this->feed_src);
+            std::shared_ptr<cv::VideoWriter> output = processor.create_writer();
+
+            size_t start_frame = arguments.get_value<int>(Arguments::START_FRAME);
+            size_t end_frame   = arguments.get_value<int>(Arguments::END_FRAME);
+            size_t range = end_frame + 1 - start_frame;
+
+            //set up progress dialog
+            QProgressDialog progress(exportLabel, "Cancel", 0, range, this);
+            progress.setWindowModality(Qt::WindowModal);
+
+            processor.set_next_frame(start_frame);
+
+            for (size_t index = start_frame; index <= end_frame && !progress.wasCanceled(); ++index) {
+                progress.setValue(index - start_frame);
+                processor.process_next_frame(*output);
+            }
+            progress.setValue(range);
+            if (processor.get_disparity_cache().is_enabled()) {
+                ui->statusBar->showMessage(QString("Disparity cache: %1 frames reused, %2 matched")
+                                           .arg(processor.get_disparity_cache().get_hits())
+                                           .arg(processor.get_disparity_cache().get_misses()));
+            }
+        } catch (std::runtime_error& e) {
+            QMessageBox msgBox;
+            msgBox.setText(QString(e.what()));
+            msgBox.setIcon(QMessageBox::Critical);
+            msgBox.exec();
         }
-        progress.setValue(range);
     }
 }
 
@@ -455,3 +725,35 @@ void QtOpenCVDepthmap::on_button_set_clip_end_clicked()
 {
     check_end_frame(ui->horizontalSlider->value());
 }
+
+/**
+ * Use the region dragged out on the source view as the region of interest, for the preview and the export.
+ * A region drawn over the right eye is taken as the same region of the left eye.
+ * @param x The region's left column in the source frame.
+ * @param y The region's top row in the source frame.
+ * @param w The region's width, 0 to clear the region.
+ * @param h The region's height, 0 to clear the region.
+ */
+void QtOpenCVDepthmap::on_sbs_view_roiSelected(int x, int y, int w, int h)
+{
+    if (w <= 0 || h <= 0) {
+        arguments.set_value<std::string>(Arguments::ROI, "");
+    } else {
+        cv::Size eye_size = layout.get_eye_size();
+        StereoLayout::Type type = layout.get_type();
+        if ((type == StereoLayout::SBS || type == StereoLayout::HALF_SBS) && x >= eye_size.width) {
+            x -= eye_size.width;
+        } else if ((type == StereoLayout::TB || type == StereoLayout::HALF_TB) && y >= eye_size.height) {
+            y -= eye_size.height;
+        }
+        //a drag across both eyes stops at the eye's edge
+        w = std::min(w, eye_size.width - x);
+        h = std::min(h, eye_size.height - y);
+        arguments.set_value<std::string>(Arguments::ROI,
+            std::to_string(w) + "x" + std::to_string(h) + "+" + std::to_string(x) + "+" + std::to_string(y));
+    }
+    preview.invalidate(match_stage);
+    if (!frame_src.empty()) {
+        update_depthmap();
+    }
+}
@@ -2,11 +2,18 @@
 #define QTOPENCVDEPTHMAP_H
 
 #include <QMainWindow>
+#include <future>
+#include <memory>
 
 #include <opencv2/highgui/highgui.hpp>
-#include <opencv2/calib3d/calib3d.hpp>
 
 #include "arguments.hpp"
+#include "matcher.h"
+#include "rectifier.h"
+#include "stereolayout.h"
+#include "frameindex.h"
+#include "mappedcapture.h"
+#include "stagegraph.h"
 
 namespace Ui {
     class QtOpenCVDepthmap;
@@ -26,9 +33,12 @@ class QtOpenCVDepthmap : public QMainWindow
         void set_active(bool isActive);
 
         void args_to_mapper();
+        void update_engine_controls();
         void open_filename(const std::string &filename);
         void fetch_frame(int index);
+        void adopt_frame_index();
         void update_depthmap();
+        void setting_changed(const Arguments::Arg& arg);
 
         template<typename Val>
         bool update_mapper_value(const Arguments::Arg &arg, const Val &val) {
@@ -50,10 +60,7 @@ class QtOpenCVDepthmap : public QMainWindow
             }
             //only update depthmap if it changed.
             if (current != previous) {
-                args_to_mapper();
-                if (is_active) {
-                    update_depthmap();
-                }
+                setting_changed(arg);
             }
             return req_update;
         }
@@ -93,6 +100,12 @@ class QtOpenCVDepthmap : public QMainWindow
 
         void on_input_fullDP_stateChanged(int arg1);
 
+        void on_input_engine_currentIndexChanged(int index);
+
+        void on_input_textureThreshold_valueChanged(int arg1);
+
+        void on_input_preFilterSize_valueChanged(int arg1);
+
         void on_horizontalSlider_valueChanged(int value);
 
 
@@ -104,21 +117,38 @@ class QtOpenCVDepthmap : public QMainWindow
 
         void on_button_set_clip_end_clicked();
 
+        void on_sbs_view_roiSelected(int x, int y, int w, int h);
+
 private:
+        void build_preview();
+
         Arguments& arguments;
 
         Ui::QtOpenCVDepthmap *ui;
         bool first_load;
         bool is_active;
 
-        cv::StereoSGBM mapper;
+        std::shared_ptr<Matcher> mapper; //configured without speckle filtering, the preview filters separately
+        Rectifier rectifier;
+        StereoLayout layout;
+
+        //the seek index is built in the background when a file is opened, and used once it's ready
+        std::future<std::shared_ptr<FrameIndex> > pending_index;
+        std::shared_ptr<FrameIndex> frame_index;
+        std::future<std::shared_ptr<FrameIndex> > pending_right_index;
+        std::shared_ptr<FrameIndex> right_frame_index;
+
+        //the preview: decode, split (and rectify), raw match, speckle filter, display. Each stage keeps its output below
+        StageGraph preview;
+        size_t decode_stage, split_stage, match_stage, speckle_stage, display_stage;
+        int preview_frame; //1-indexed
 
         //this chunk of variables handle video frame data
-        cv::VideoCapture feed_src;
-        cv::Mat frame_src, left_eye, right_eye, frame_dst_16_gray, frame_dst_8_gray, frame_dst_8_colour;
+        MappedCapture feed_src, right_feed_src;
+        cv::Mat frame_src, right_src, left_eye, right_eye, left_luma, right_luma, left_rectified, right_rectified, frame_dst_16_raw, frame_dst_16_gray, frame_dst_16_output, frame_dst_8_gray, frame_dst_8_colour, speckle_buffer;
 
         //this chunk of variables handle video metadata
-        double input_width, split_width, input_height, input_fps, output_width, output_height, output_fps,
+        double input_width, input_height, input_fps, output_width, output_height, output_fps,
         current_pos_msec, current_pos_frame, current_pos_radio, input_frame_count;
 };
 
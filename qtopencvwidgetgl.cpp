@@ -1,5 +1,19 @@
+#include <algorithm>
+#include <cstdlib>
+
 #include "qtopencvwidgetgl.h"
 
+//GL 1.2 formats, missing from some GL 1.1 headers (they're supported by every driver we care about, llvmpipe included)
+#ifndef GL_BGR
+#define GL_BGR 0x80E0
+#endif
+#ifndef GL_BGRA
+#define GL_BGRA 0x80E1
+#endif
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+
 /**
  * Constructor.
  * @param parent Standard QWidget parent.
@@ -8,6 +22,11 @@ QtOpenCVWidgetGL::QtOpenCVWidgetGL(QWidget *parent) :
     QGLWidget(parent)
 {
     mSceneChanged = false;
+    mImageChanged = false;
+    mTexture = 0;
+    mTexW = 0;
+    mTexH = 0;
+    mTexType = -1;
     mBgColor = QColor::fromRgb(150, 150, 150);
 
     mOutH = 0;
@@ -16,15 +35,38 @@ QtOpenCVWidgetGL::QtOpenCVWidgetGL(QWidget *parent) :
 
     mPosX = 0;
     mPosY = 0;
+
+    mDragging = false;
+}
+
+/**
+ * Destructor. Releases the texture.
+ */
+QtOpenCVWidgetGL::~QtOpenCVWidgetGL()
+{
+    if (mTexture) {
+        makeCurrent();
+        glDeleteTextures(1, &mTexture);
+    }
 }
 
 /**
- * Initialize the widget and clear the GL canvas.
+ * Initialize the widget, clear the GL canvas and create the texture the frames are streamed into.
  */
 void QtOpenCVWidgetGL::initializeGL()
 {
     makeCurrent();
     qglClearColor(mBgColor.darker());
+
+    glGenTextures(1, &mTexture);
+    glBindTexture(GL_TEXTURE_2D, mTexture);
+    //scaling to the widget is left to texture filtering
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    mTexType = -1;
 }
 
 /**
@@ -92,7 +134,50 @@ void QtOpenCVWidgetGL::paintGL()
 }
 
 /**
- * Render the current CV matrix to the viewport using OpenGL.
+ * Stream the current CV matrix into the texture. The texture storage is only reallocated when the size or format changes,
+ * otherwise the pixels are replaced in place with glTexSubImage2D. BGR/BGRA/gray are handled by the upload format, and
+ * padded rows (views into larger matrices) by the unpack row length, so the matrix is read directly without any copy.
+ */
+void QtOpenCVWidgetGL::uploadImage()
+{
+    GLenum format;
+    GLint internalFormat;
+    switch (mOrigImage.type()) {
+        case CV_8UC1:
+            format = GL_LUMINANCE;
+            internalFormat = GL_LUMINANCE;
+            break;
+        case CV_8UC3:
+            format = GL_BGR;
+            internalFormat = GL_RGB;
+            break;
+        case CV_8UC4:
+            format = GL_BGRA;
+            internalFormat = GL_RGBA;
+            break;
+        default:
+            return;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, mTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)(mOrigImage.step / mOrigImage.elemSize()));
+
+    if (mOrigImage.cols != mTexW || mOrigImage.rows != mTexH || mOrigImage.type() != mTexType) {
+        mTexW = mOrigImage.cols;
+        mTexH = mOrigImage.rows;
+        mTexType = mOrigImage.type();
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, mTexW, mTexH, 0, format, GL_UNSIGNED_BYTE, mOrigImage.data);
+    } else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, mTexW, mTexH, format, GL_UNSIGNED_BYTE, mOrigImage.data);
+    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+/**
+ * Render the current texture to the viewport using OpenGL, as a quad scaled to the centred output area.
  */
 void QtOpenCVWidgetGL::renderImage()
 {
@@ -100,42 +185,31 @@ void QtOpenCVWidgetGL::renderImage()
 
     glClear(GL_COLOR_BUFFER_BIT);
 
-    if (!mRenderQtImg.isNull())
+    if (mImageChanged) {
+        uploadImage();
+        mImageChanged = false;
+    }
+
+    if (mTexType != -1)
     {
         glLoadIdentity();
 
-        QImage image; // the image rendered
-
         glPushMatrix();
         {
-            int imW = mRenderQtImg.width();
-            int imH = mRenderQtImg.height();
-
-            // The image is to be resized to fit the widget?
-            if( imW != this->size().width() &&
-                    imH != this->size().height() )
-            {
-
-                image = mRenderQtImg.scaled( //this->size(),
-                                             QSize(mOutW,mOutH),
-                                             Qt::IgnoreAspectRatio,
-                                             Qt::SmoothTransformation
-                                             );
-
-                //qDebug( QString( "Image size: (%1x%2)").arg(imW).arg(imH).toAscii() );
-            }
-            else
-                image = mRenderQtImg;
+            glEnable(GL_TEXTURE_2D);
+            glBindTexture(GL_TEXTURE_2D, mTexture);
 
-            // ---> Centering image in draw area
+            //image row 0 is the top, GL's y axis points up
+            glBegin(GL_QUADS);
+            glTexCoord2f(0.0f, 1.0f); glVertex2i(mPosX,         mPosY);
+            glTexCoord2f(1.0f, 1.0f); glVertex2i(mPosX + mOutW, mPosY);
+            glTexCoord2f(1.0f, 0.0f); glVertex2i(mPosX + mOutW, mPosY + mOutH);
+            glTexCoord2f(0.0f, 0.0f); glVertex2i(mPosX,         mPosY + mOutH);
+            glEnd();
 
-            glRasterPos2i( mPosX, mPosY );
-            // <--- Centering image in draw area
+            glDisable(GL_TEXTURE_2D);
 
-            imW = image.width();
-            imH = image.height();
-
-            glDrawPixels( imW, imH, GL_RGBA, GL_UNSIGNED_BYTE, image.bits());
+            renderRoi();
         }
         glPopMatrix();
 
@@ -145,28 +219,143 @@ void QtOpenCVWidgetGL::renderImage()
 }
 
 /**
- *
- * @param image The image to display.
- * @return True if the function executed without error.
+ * Outline the region of interest over the image, if there is one.
  */
-bool QtOpenCVWidgetGL::showImage( const cv::Mat &image )
+void QtOpenCVWidgetGL::renderRoi()
+{
+    if (mRoi.isEmpty() || mTexW == 0 || mTexH == 0)
+        return;
+
+    //image pixels to GL coordinates, whose y axis points up from the bottom of the output area
+    float scaleX = (float)mOutW / mTexW;
+    float scaleY = (float)mOutH / mTexH;
+    float left = mPosX + mRoi.x() * scaleX;
+    float right = mPosX + (mRoi.x() + mRoi.width()) * scaleX;
+    float top = mPosY + mOutH - mRoi.y() * scaleY;
+    float bottom = mPosY + mOutH - (mRoi.y() + mRoi.height()) * scaleY;
+
+    glColor3f(1.0f, 0.8f, 0.0f);
+    glBegin(GL_LINE_LOOP);
+    glVertex2f(left,  bottom);
+    glVertex2f(right, bottom);
+    glVertex2f(right, top);
+    glVertex2f(left,  top);
+    glEnd();
+    glColor3f(1.0f, 1.0f, 1.0f);
+}
+
+/**
+ * Map a widget position to the image pixel under it, clamped to the image.
+ * @param point The position in widget coordinates.
+ * @return The image pixel.
+ */
+QPoint QtOpenCVWidgetGL::toImage(const QPoint &point) const
+{
+    if (mOutW == 0 || mOutH == 0)
+        return QPoint(0, 0);
+    //the output area is centred, so its top is mPosY from the widget's top too
+    int x = (point.x() - mPosX) * mTexW / mOutW;
+    int y = (point.y() - mPosY) * mTexH / mOutH;
+    return QPoint(std::max(0, std::min(x, mTexW)), std::max(0, std::min(y, mTexH)));
+}
+
+/**
+ * Start dragging out a region with the left button, or clear it with the right button.
+ */
+void QtOpenCVWidgetGL::mousePressEvent(QMouseEvent *event)
 {
-    image.copyTo(mOrigImage);
+    if (mTexType == -1)
+        return;
+
+    if (event->button() == Qt::LeftButton) {
+        mDragging = true;
+        mDragStart = toImage(event->pos());
+        mRoi = QRect();
+    } else if (event->button() == Qt::RightButton) {
+        mDragging = false;
+        mRoi = QRect();
+        mSceneChanged = true;
+        updateScene();
+        emit roiSelected(0, 0, 0, 0);
+    }
+}
+
+/**
+ * Follow the drag with the outline.
+ */
+void QtOpenCVWidgetGL::mouseMoveEvent(QMouseEvent *event)
+{
+    if (!mDragging)
+        return;
+
+    QPoint end = toImage(event->pos());
+    mRoi = QRect(std::min(mDragStart.x(), end.x()), std::min(mDragStart.y(), end.y()),
+                 std::abs(end.x() - mDragStart.x()), std::abs(end.y() - mDragStart.y()));
+    mSceneChanged = true;
+    updateScene();
+}
+
+/**
+ * Finish the drag and report the region. A click without a drag selects nothing.
+ */
+void QtOpenCVWidgetGL::mouseReleaseEvent(QMouseEvent *event)
+{
+    if (!mDragging || event->button() != Qt::LeftButton)
+        return;
+
+    mDragging = false;
+    QPoint end = toImage(event->pos());
+    mRoi = QRect(std::min(mDragStart.x(), end.x()), std::min(mDragStart.y(), end.y()),
+                 std::abs(end.x() - mDragStart.x()), std::abs(end.y() - mDragStart.y()));
+    mSceneChanged = true;
+    updateScene();
+    emit roiSelected(mRoi.x(), mRoi.y(), mRoi.width(), mRoi.height());
+}
+
+/**
+ * Outline a region of the image, for a region of interest set elsewhere.
+ * @param x The region's left column, in image pixels.
+ * @param y The region's top row, in image pixels.
+ * @param w The region's width; 0 removes the outline.
+ * @param h The region's height; 0 removes the outline.
+ */
+void QtOpenCVWidgetGL::setRoi( int x, int y, int w, int h )
+{
+    mRoi = (w > 0 && h > 0) ? QRect(x, y, w, h) : QRect();
+    mSceneChanged = true;
+    updateScene();
+}
 
-    mImgRatio = (float)image.cols/(float)image.rows;
+/**
+ * Let go of the shown matrix, so the memory it points into can be freed or unmapped. The uploaded texture keeps being
+ * drawn until the next showImage().
+ */
+void QtOpenCVWidgetGL::clearImage()
+{
+    mOrigImage.release();
+    mImageChanged = false;
+}
 
-    if( mOrigImage.channels() == 3)
-        mRenderQtImg = QImage((const unsigned char*)(mOrigImage.data),
-                              mOrigImage.cols, mOrigImage.rows,
-                              mOrigImage.step, QImage::Format_RGB888).rgbSwapped();
-    else if( mOrigImage.channels() == 1)
-        mRenderQtImg = QImage((const unsigned char*)(mOrigImage.data),
-                              mOrigImage.cols, mOrigImage.rows,
-                              mOrigImage.step, QImage::Format_Indexed8);
-    else
+/**
+ * Show a new image. The matrix isn't copied: it's kept by reference and streamed into the texture on the next repaint.
+ * @param image The image to display, 8-bit BGR, BGRA or gray.
+ * @return True if the function executed without error.
+ */
+bool QtOpenCVWidgetGL::showImage( const cv::Mat &image )
+{
+    if (image.depth() != CV_8U || (image.channels() != 1 && image.channels() != 3 && image.channels() != 4))
         return false;
 
-    mRenderQtImg = QGLWidget::convertToGLFormat(mRenderQtImg);
+    mOrigImage = image;
+    mImageChanged = true;
+
+    float ratio = (float)image.cols/(float)image.rows;
+    if (ratio != mImgRatio) {
+        mImgRatio = ratio;
+        //a hidden widget gets its layout from the resize event when it's first shown
+        if (this->isVisible())
+            resizeGL(width(), height());
+    }
 
     mSceneChanged = true;
 
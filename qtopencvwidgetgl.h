@@ -2,6 +2,7 @@
 #define CQTOPENCVVIEWERGL_H
 
 #include <QGLWidget>
+#include <QMouseEvent>
 #include <opencv2/core/core.hpp>
 
 /**
@@ -12,12 +13,16 @@ class QtOpenCVWidgetGL : public QGLWidget
         Q_OBJECT
     public:
         explicit QtOpenCVWidgetGL(QWidget *parent = 0);
+        ~QtOpenCVWidgetGL();
 
     signals:
         void    imageSizeChanged( int outW, int outH ); /// Used to resize the image outside the widget
+        void    roiSelected( int x, int y, int w, int h ); /// A region dragged out with the left button, in image pixels; w and h are 0 when cleared
 
     public slots:
         bool    showImage( const cv::Mat &image ); /// Used to set the image to be viewed
+        void    clearImage(); /// Let go of the image, keeping what is on screen, so its pixels can be freed
+        void    setRoi( int x, int y, int w, int h ); /// Outline a region of the image, in image pixels; w or h of 0 removes it
 
     protected:
         void 	initializeGL(); /// OpenGL initialization
@@ -25,13 +30,25 @@ class QtOpenCVWidgetGL : public QGLWidget
         void 	resizeGL(int width, int height);        /// Widget Resize Event
 
         void        updateScene();
+        void        uploadImage();
         void        renderImage();
+        void        renderRoi();
+
+        void        mousePressEvent(QMouseEvent *event);
+        void        mouseMoveEvent(QMouseEvent *event);
+        void        mouseReleaseEvent(QMouseEvent *event);
+        QPoint      toImage(const QPoint &point) const;
 
     private:
         bool        mSceneChanged;          /// Indicates when OpenGL view is to be redrawn
+        bool        mImageChanged;          /// Indicates when the texture has to be refreshed from mOrigImage
+
+        cv::Mat     mOrigImage;             /// OpenCV image to be shown (shares the caller's data, never copied)
 
-        QImage      mRenderQtImg;           /// Qt image to be rendered
-        cv::Mat     mOrigImage;             /// original OpenCV image to be shown
+        GLuint      mTexture;               /// Persistent texture the image is streamed into
+        int         mTexW;                  /// Allocated texture width
+        int         mTexH;                  /// Allocated texture height
+        int         mTexType;               /// OpenCV type the texture was allocated for
 
         QColor      mBgColor;		/// Background color
 
@@ -42,6 +59,10 @@ class QtOpenCVWidgetGL : public QGLWidget
         int         mPosX;                  /// Top left X position to render image in the center of widget
         int         mPosY;                  /// Top left Y position to render image in the center of widget
 
+        QRect       mRoi;                   /// Outlined region, in image pixels
+        bool        mDragging;              /// Whether a region is being dragged out
+        QPoint      mDragStart;             /// Image pixel the drag started at
+
 };
 
 #endif // CQTOPENCVVIEWERGL_H
@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+#include "opencv2/imgproc/imgproc.hpp" //resize, cvtColor
+#include "opencv2/highgui/highgui.hpp" //VideoCapture
+
+#include "rangeestimator.h"
+#include "matcher.h"
+#include "rectifier.h"
+#include "mappedcapture.h"
+#include "frameindex.h"
+#include "tracer.h"
+
+namespace {
+
+//frames sampled across the range
+const size_t RANGE_SAMPLES = 8;
+
+//width the sampled eyes are matched at
+const int RANGE_MATCH_WIDTH = 320;
+
+//the search covers this fraction of the eye width in front of the screen plane, and three times as much behind it
+const double RANGE_SEARCH_FRACTION = 0.125;
+
+//percentiles of the valid disparities taken as the range, so stray mismatches don't widen it
+const double RANGE_LOW_PERCENTILE = 0.01;
+const double RANGE_HIGH_PERCENTILE = 0.99;
+
+//margin added on each side: a fraction of the range, and at least a few pixels
+const double RANGE_MARGIN_FRACTION = 0.1;
+const double RANGE_MIN_MARGIN = 2.0;
+
+}
+
+/**
+ * Constructor.
+ * @param args The job's arguments. The input files and frame range are read from them, and the disparity range is written back.
+ * @param layout The resolved stereo layout of the input.
+ * @param report The stream the chosen range is logged to.
+ */
+RangeEstimator::RangeEstimator(Arguments& args, const StereoLayout& layout, std::ostream& report)
+    : arguments(args), layout(layout), report(report)
+{
+}
+
+/**
+ * Sample the clip and set MIN_DISPARITY and NUM_DISPARITIES.
+ * Throws std::runtime_error if a sampled frame can't be read, or the estimated range fails validation.
+ * @return False if no valid disparities were found, in which case the arguments are left alone.
+ */
+bool RangeEstimator::estimate() {
+    size_t start_frame = arguments.get_value<int>(Arguments::START_FRAME);
+    size_t end_frame = arguments.get_value<int>(Arguments::END_FRAME);
+    if (end_frame == 0) {
+        //the container's count is an estimate; mapped files and the seek index know it exactly
+        std::string input_filename = arguments.get_value<std::string>(Arguments::INPUT_FILENAME);
+        MappedCapture feed(arguments, input_filename);
+        size_t frame_count = (size_t)feed.get(CV_CAP_PROP_FRAME_COUNT);
+        if (!feed.is_mapped()) {
+            try {
+                frame_count = FrameIndex::open(input_filename)->frame_count();
+            } catch (std::runtime_error&) {
+            }
+        }
+        end_frame = frame_count > 0 ? frame_count - 1 : 0;
+    }
+    end_frame = std::max(end_frame, start_frame);
+
+    //evenly spread, one thread per sample; each gathers its own disparities so nothing is shared until the merge
+    size_t samples = std::min(RANGE_SAMPLES, end_frame - start_frame + 1);
+    std::vector<std::vector<float> > sampled(samples);
+    std::vector<std::exception_ptr> errors(samples);
+    std::vector<std::thread> threads;
+    for (size_t index = 0; index < samples; ++index) {
+        size_t frame = start_frame + (end_frame - start_frame) * (2 * index + 1) / (2 * samples);
+        threads.push_back(std::thread([this, frame, index, &sampled, &errors]() {
+            try {
+                Tracer::name_thread("range sampler");
+                sample(frame, sampled[index]);
+            } catch (...) {
+                errors[index] = std::current_exception();
+            }
+        }));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    for (const std::exception_ptr& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    std::vector<float> disparities;
+    for (const std::vector<float>& values : sampled) {
+        disparities.insert(disparities.end(), values.begin(), values.end());
+    }
+    if (disparities.empty()) {
+        report << "Auto range: no disparities found in " << samples << " sampled frames, keeping minDisparity "
+               << arguments.get_value<int>(Arguments::MIN_DISPARITY) << ", disparity " << arguments.get_value<int>(Arguments::NUM_DISPARITIES)
+               << std::endl;
+        return false;
+    }
+
+    std::vector<float>::iterator low = disparities.begin() + (size_t)(RANGE_LOW_PERCENTILE * (disparities.size() - 1));
+    std::nth_element(disparities.begin(), low, disparities.end());
+    float low_disparity = *low;
+    std::vector<float>::iterator high = disparities.begin() + (size_t)(RANGE_HIGH_PERCENTILE * (disparities.size() - 1));
+    std::nth_element(disparities.begin(), high, disparities.end());
+    float high_disparity = *high;
+
+    //minDisparity can't go below 0, so anything in front of the screen plane is left out of the range
+    double margin = std::max(RANGE_MIN_MARGIN, RANGE_MARGIN_FRACTION * (high_disparity - low_disparity));
+    int min_disparity = std::max(0, (int)std::floor(low_disparity - margin));
+    int num_disparities = std::max(16, (int)std::ceil((high_disparity + margin - min_disparity) / 16.0) * 16);
+    arguments.set_value<int>(Arguments::MIN_DISPARITY, min_disparity);
+    arguments.set_value<int>(Arguments::NUM_DISPARITIES, num_disparities);
+    if (!arguments.is_valid(Arguments::MIN_DISPARITY, true) || !arguments.is_valid(Arguments::NUM_DISPARITIES, true)) {
+        throw std::runtime_error("Error: the estimated disparity range cannot be used");
+    }
+    min_disparity = arguments.get_value<int>(Arguments::MIN_DISPARITY);
+    num_disparities = arguments.get_value<int>(Arguments::NUM_DISPARITIES);
+
+    report << "Auto range: sampled " << samples << " frames, disparities " << low_disparity << " to " << high_disparity
+           << " px; using minDisparity " << min_disparity << ", disparity " << num_disparities << std::endl;
+    return true;
+}
+
+/**
+ * Decode one frame on its own captures and match it at low resolution.
+ * Throws std::runtime_error if the frame can't be read.
+ * @param frame The 0-indexed frame to sample.
+ * @param disparities Receives the frame's valid disparities, in full resolution pixels.
+ */
+void RangeEstimator::sample(size_t frame, std::vector<float>& disparities) const {
+    std::string input_filename = arguments.get_value<std::string>(Arguments::INPUT_FILENAME);
+    MappedCapture feed(arguments, input_filename);
+    feed.set(CV_CAP_PROP_POS_FRAMES, frame);
+    cv::Mat frame_src, right_src, left_eye, right_eye;
+    feed >> frame_src;
+    if (layout.get_type() == StereoLayout::SEPARATE) {
+        MappedCapture right_feed(arguments, arguments.get_value<std::string>(Arguments::RIGHT_FILENAME));
+        right_feed.set(CV_CAP_PROP_POS_FRAMES, frame);
+        right_feed >> right_src;
+        right_eye = right_src;
+    }
+    if (frame_src.empty() || (layout.get_type() == StereoLayout::SEPARATE && right_src.empty())) {
+        throw std::runtime_error("Error: frame " + std::to_string(frame) + " of [" + input_filename + "] cannot be read for range estimation");
+    }
+    layout.split(frame_src, left_eye, right_eye);
+
+    std::string calibration_filename = arguments.get_value<std::string>(Arguments::CALIBRATION_FILENAME);
+    if (!calibration_filename.empty()) {
+        Rectifier rectifier;
+        rectifier.load(calibration_filename, layout.get_eye_size());
+        cv::Mat left_rectified, right_rectified;
+        rectifier.rectify(left_eye, right_eye, left_rectified, right_rectified);
+        left_eye = left_rectified;
+        right_eye = right_rectified;
+    }
+
+    //gray and small: only the range is wanted, not the detail
+    double scale = std::min(1.0, (double)RANGE_MATCH_WIDTH / left_eye.cols);
+    cv::Size low_size(std::max(1, (int)std::lround(left_eye.cols * scale)), std::max(1, (int)std::lround(left_eye.rows * scale)));
+    cv::Mat left_low, right_low, left_gray, right_gray;
+    resize(left_eye, left_low, low_size, 0, 0, cv::INTER_AREA);
+    resize(right_eye, right_low, low_size, 0, 0, cv::INTER_AREA);
+    if (left_low.channels() == 3) {
+        cvtColor(left_low, left_gray, CV_BGR2GRAY);
+        cvtColor(right_low, right_gray, CV_BGR2GRAY);
+    } else {
+        left_gray = left_low;
+        right_gray = right_low;
+    }
+
+    int search_min = -(int)std::ceil(low_size.width * RANGE_SEARCH_FRACTION);
+    int search_count = std::max(16, (int)std::ceil(low_size.width * RANGE_SEARCH_FRACTION * 4 / 16.0) * 16);
+    Arguments search_arguments(arguments);
+    search_arguments.set_value<std::string>(Arguments::ENGINE, "sgbm");
+    search_arguments.set_value<int>(Arguments::MIN_DISPARITY, search_min);
+    search_arguments.set_value<int>(Arguments::NUM_DISPARITIES, search_count);
+    search_arguments.set_value<int>(Arguments::SAD_WINDOW_SIZE, 5);
+    search_arguments.set_value<int>(Arguments::P1, 8 * 25);
+    search_arguments.set_value<int>(Arguments::P2, 32 * 25);
+    search_arguments.set_value<int>(Arguments::UNIQUENESS, 10);
+    search_arguments.set_value<int>(Arguments::SPECKLE_WINDOW_SIZE, 100);
+    search_arguments.set_value<int>(Arguments::SPECKLE_RANGE, 2);
+    std::shared_ptr<Matcher> matcher = Matcher::create(search_arguments);
+    matcher->configure(search_arguments);
+    cv::Mat disparity;
+    matcher->compute(left_gray, right_gray, disparity);
+
+    short invalid = (short)((search_min - 1) * 16);
+    float to_full = (float)(1.0 / (16.0 * scale));
+    for (int y = 0; y < disparity.rows; ++y) {
+        const short* values = disparity.ptr<short>(y);
+        for (int x = 0; x < disparity.cols; ++x) {
+            if (values[x] > invalid) {
+                disparities.push_back(values[x] * to_full);
+            }
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef RANGEESTIMATOR_H
+#define RANGEESTIMATOR_H
+
+#include <ostream>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+#include "arguments.hpp"
+#include "stereolayout.h"
+
+/**
+ * Pre-pass for --auto-range: estimates the disparity range a clip actually uses, so matching searches neither too wide
+ * (cost grows with the range) nor too narrow (depth beyond the range breaks).
+ * Frames spread evenly over START_FRAME..END_FRAME are decoded and matched in parallel, each on its own thread and capture,
+ * with a low resolution SGBM over a deliberately wide range. The 1st to 99th percentile of the valid disparities, plus a margin,
+ * becomes MIN_DISPARITY and NUM_DISPARITIES (a multiple of 16).
+ */
+class RangeEstimator
+{
+public:
+    RangeEstimator(Arguments& args, const StereoLayout& layout, std::ostream& report);
+
+    bool estimate();
+private:
+    void sample(size_t frame, std::vector<float>& disparities) const;
+
+    Arguments& arguments;
+    const StereoLayout& layout;
+    std::ostream& report;
+};
+
+#endif // RANGEESTIMATOR_H
@@ -0,0 +1,265 @@
+#include <cerrno>
+#include <csignal>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "opencv2/imgproc/imgproc.hpp" //cvtColor
+
+#include "rawstream.h"
+#include "processor.h"
+#include "tracer.h"
+
+namespace {
+
+//frames in flight per direction: one being read (or written), one being matched, and one spare so neither side waits
+const size_t STREAM_BUFFERS = 3;
+
+//how often a reader waiting on the input checks whether the stream was stopped
+const int STREAM_POLL_MS = 100;
+
+}
+
+/**
+ * Constructor for an empty, open queue.
+ */
+RawStream::BufferQueue::BufferQueue()
+    : closed(false)
+{
+}
+
+/**
+ * Hand a buffer to the next stage.
+ * @param index The buffer's index.
+ */
+void RawStream::BufferQueue::push(size_t index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    indices.push_back(index);
+    ready.notify_one();
+}
+
+/**
+ * Wait for the next buffer.
+ * @param index Receives the buffer's index.
+ * @return False if the queue was closed and is empty.
+ */
+bool RawStream::BufferQueue::pop(size_t& index) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!closed && indices.empty()) {
+        TraceSpan span("queue wait");
+        while (!closed && indices.empty()) {
+            ready.wait(lock);
+        }
+    }
+    if (indices.empty()) {
+        return false;
+    }
+    index = indices.front();
+    indices.pop_front();
+    return true;
+}
+
+/**
+ * Mark the end of the stream, waking up everything waiting on the queue.
+ */
+void RawStream::BufferQueue::close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    ready.notify_all();
+}
+
+/**
+ * Constructor. The frame size and formats come from the --stream, --pix-fmt and --out-pix-fmt arguments.
+ * @param args The processing arguments.
+ * @param input The handle raw frames are read from (usually stdin).
+ * @param output The handle raw disparity frames are written to (usually stdout).
+ * @param log The stream for messages, which must not be the output.
+ */
+RawStream::RawStream(Arguments& args, std::FILE* input, std::FILE* output, std::ostream& log)
+    : arguments(args), input(input), output(output), log(log), stopping(false)
+{
+    int width = 0, height = 0;
+    std::sscanf(arguments.get_value<std::string>(Arguments::STREAM_SIZE).c_str(), "%dx%d", &width, &height);
+    frame_size = cv::Size(width, height);
+
+    std::string format = arguments.get_value<std::string>(Arguments::STREAM_FORMAT);
+    if (format == "yuv420p") {
+        throw std::runtime_error("Error: --pix-fmt yuv420p is only supported for --raw-size files");
+    }
+    frame_type = format == "gray" ? CV_8UC1 : CV_8UC3;
+    rgb_input = format == "rgb24";
+    gray16_output = arguments.get_value<std::string>(Arguments::STREAM_OUTPUT_FORMAT) == "gray16le";
+}
+
+/**
+ * Process the whole stream. Returns at the end of the input, or when the output is closed.
+ * SIGPIPE is ignored while streaming, so a reader that goes away makes the write fail instead of killing the process.
+ * Throws std::runtime_error if the stream can't be processed or read/written.
+ * @return The number of frames written.
+ */
+size_t RawStream::run() {
+    //the frames are moved in large blocks straight to and from the buffers, stdio buffering would only add a copy.
+    //The input is read through its descriptor, see read_input().
+    std::setvbuf(output, 0, _IONBF, 0);
+    void (*previous_handler)(int) = std::signal(SIGPIPE, SIG_IGN);
+
+    for (size_t index = 0; index < STREAM_BUFFERS; ++index) {
+        input_frames.push_back(cv::Mat(frame_size, frame_type));
+        free_inputs.push(index);
+    }
+
+    std::thread reader(&RawStream::read_frames, this);
+    std::thread writer(&RawStream::write_frames, this);
+    Tracer::name_thread("stream matcher");
+
+    std::unique_ptr<Processor> processor;
+    cv::Mat disparity;
+    size_t frames = 0;
+    try {
+        size_t input_index, output_index;
+        while (read_inputs.pop(input_index)) {
+            cv::Mat& frame = input_frames[input_index];
+            if (rgb_input) {
+                cvtColor(frame, frame, CV_RGB2BGR);
+            }
+
+            //the layout can only be detected once there's a frame to look at
+            if (!processor) {
+                StereoLayout::Type layout_type = StereoLayout::from_string(arguments.get_value<std::string>(Arguments::LAYOUT));
+                if (layout_type == StereoLayout::SEPARATE) {
+                    throw std::runtime_error("Error: the separate layout can't be streamed");
+                } else if (layout_type == StereoLayout::AUTO) {
+                    layout_type = StereoLayout::detect(frame);
+                }
+                processor.reset(new Processor(arguments, frame_size, layout_type));
+
+                cv::Size output_size = processor->get_output_size();
+                for (size_t index = 0; index < STREAM_BUFFERS; ++index) {
+                    output_frames.push_back(cv::Mat(output_size, gray16_output ? CV_16SC1 : CV_8UC1));
+                    free_outputs.push(index);
+                }
+                log << "Streaming " << frame_size.width << "x" << frame_size.height << " " << StereoLayout::to_string(layout_type)
+                    << " -> " << output_size.width << "x" << output_size.height << " "
+                    << (gray16_output ? "gray16le" : "gray") << std::endl;
+            }
+
+            processor->compute_depth(frame, cv::Mat(), disparity);
+            free_inputs.push(input_index);
+
+            if (!free_outputs.pop(output_index)) {
+                break;
+            }
+            //both conversions write into the preallocated buffer, as it already has the right size and type
+            if (gray16_output) {
+                disparity.copyTo(output_frames[output_index]);
+            } else {
+                disparity.convertTo(output_frames[output_index], CV_8U);
+            }
+            computed_outputs.push(output_index);
+            ++frames;
+        }
+    } catch (...) {
+        stop();
+        reader.join();
+        writer.join();
+        std::signal(SIGPIPE, previous_handler);
+        throw;
+    }
+
+    stop();
+    reader.join();
+    writer.join();
+    std::signal(SIGPIPE, previous_handler);
+
+    if (!write_error.empty()) {
+        throw std::runtime_error(write_error);
+    }
+    if (!read_error.empty()) {
+        log << read_error << std::endl;
+    }
+    return frames;
+}
+
+/**
+ * Reader stage: fill free input buffers from the input until it ends. A trailing partial frame is dropped with a warning.
+ */
+void RawStream::read_frames() {
+    Tracer::name_thread("stream reader");
+    size_t index;
+    while (free_inputs.pop(index)) {
+        TraceSpan span("read");
+        cv::Mat& frame = input_frames[index];
+        size_t size = frame.total() * frame.elemSize();
+        size_t got = read_input(frame.data, size);
+        if (got != size) {
+            if (got > 0 && !stopping) {
+                read_error = "Warning: ignored a partial frame at the end of the input";
+            }
+            break;
+        }
+        read_inputs.push(index);
+    }
+    read_inputs.close();
+}
+
+/**
+ * Read a whole frame from the input, a block at a time as it arrives. The input is polled rather than blocked on, so a
+ * stalled producer can't keep the reader, and with it run(), from finishing after the stream was stopped.
+ * @param data The buffer to read into.
+ * @param size The number of bytes to read.
+ * @return The number of bytes read, less than size at the end of the input, on an error, or when the stream was stopped.
+ */
+size_t RawStream::read_input(uchar* data, size_t size) {
+    int fd = fileno(input);
+    size_t got = 0;
+    while (got < size && !stopping) {
+        pollfd ready = {fd, POLLIN, 0};
+        int events = poll(&ready, 1, STREAM_POLL_MS);
+        if (events < 0 && errno != EINTR) {
+            break;
+        } else if (events <= 0) {
+            continue;
+        }
+        ssize_t count = read(fd, data + got, size - got);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        } else if (count <= 0) {
+            break;
+        }
+        got += count;
+    }
+    return got;
+}
+
+/**
+ * Writer stage: write computed output buffers in order, then recycle them. If the output fails, the matching stage is stopped.
+ */
+void RawStream::write_frames() {
+    Tracer::name_thread("stream writer");
+    size_t index;
+    while (computed_outputs.pop(index)) {
+        TraceSpan span("write");
+        cv::Mat& frame = output_frames[index];
+        size_t size = frame.total() * frame.elemSize();
+        if (std::fwrite(frame.data, 1, size, output) != size) {
+            write_error = "Error: the output stream was closed";
+            free_outputs.close();
+            return;
+        }
+        free_outputs.push(index);
+    }
+    std::fflush(output);
+}
+
+/**
+ * Let every stage run out: the matching stage has finished (or failed), so no more buffers are coming.
+ */
+void RawStream::stop() {
+    stopping = true;
+    free_inputs.close();
+    computed_outputs.close();
+    free_outputs.close();
+}
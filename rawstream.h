@@ -0,0 +1,67 @@
+#ifndef RAWSTREAM_H
+#define RAWSTREAM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+#include "arguments.hpp"
+
+/**
+ * Streams raw frames through the processor for pipelines like "ffmpeg ... -f rawvideo - | stereo_to_depthmap --stream WxH |
+ * ffmpeg -f rawvideo ...". Frames of a declared size and pixel format are read from one file handle and raw disparity frames
+ * are written to another.
+ * Reading, matching and writing run as three overlapped stages on their own threads. They pass a small, fixed set of frame
+ * buffers around, allocated once, and the file I/O reads and writes those buffers directly. The matcher's own working
+ * buffers are still allocated per frame.
+ */
+class RawStream
+{
+public:
+    RawStream(Arguments& args, std::FILE* input, std::FILE* output, std::ostream& log);
+
+    size_t run();
+private:
+    /**
+     * A blocking queue of buffer indices, handing buffers from one stage to the next. Once closed, pop() fails when empty.
+     */
+    class BufferQueue {
+    public:
+        BufferQueue();
+        void push(size_t index);
+        bool pop(size_t& index);
+        void close();
+    private:
+        std::deque<size_t> indices;
+        std::mutex mutex;
+        std::condition_variable ready;
+        bool closed;
+    };
+
+    void read_frames();
+    size_t read_input(uchar* data, size_t size);
+    void write_frames();
+    void stop();
+
+    Arguments& arguments;
+    std::FILE* input;
+    std::FILE* output;
+    std::ostream& log;
+
+    cv::Size frame_size;
+    int frame_type;
+    bool rgb_input, gray16_output;
+
+    std::vector<cv::Mat> input_frames, output_frames;
+    BufferQueue free_inputs, read_inputs, free_outputs, computed_outputs;
+    std::string read_error, write_error;
+    std::atomic<bool> stopping; //set once the matching stage is done, so a reader waiting on a stalled input gives up
+};
+
+#endif // RAWSTREAM_H
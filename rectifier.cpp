@@ -0,0 +1,129 @@
+#include <stdexcept>
+
+#include "opencv2/imgproc/imgproc.hpp" //remap
+#include "opencv2/calib3d/calib3d.hpp" //stereoRectify
+
+#include "rectifier.h"
+
+namespace {
+
+//rows remapped per task. Both eyes are cut into bands so the two remaps share the thread pool evenly.
+const int REMAP_BAND_ROWS = 64;
+
+/**
+ * Remaps one band of rows of one eye.
+ */
+class RemapBody : public cv::ParallelLoopBody
+{
+public:
+    RemapBody(const cv::Mat* sources[2], const cv::Mat* map1[2], const cv::Mat* map2[2], cv::Mat* destinations[2], int bands)
+        : bands(bands)
+    {
+        for (int eye = 0; eye < 2; ++eye) {
+            this->sources[eye] = sources[eye];
+            this->map1[eye] = map1[eye];
+            this->map2[eye] = map2[eye];
+            this->destinations[eye] = destinations[eye];
+        }
+    }
+
+    void operator()(const cv::Range& range) const {
+        for (int task = range.start; task < range.end; ++task) {
+            int eye = task / bands;
+            int first = (task % bands) * REMAP_BAND_ROWS;
+            int last = std::min(first + REMAP_BAND_ROWS, destinations[eye]->rows);
+            cv::Mat band = destinations[eye]->rowRange(first, last);
+            cv::remap(*sources[eye], band, map1[eye]->rowRange(first, last), map2[eye]->rowRange(first, last), cv::INTER_LINEAR);
+        }
+    }
+private:
+    const cv::Mat* sources[2];
+    const cv::Mat* map1[2];
+    const cv::Mat* map2[2];
+    cv::Mat* destinations[2];
+    int bands;
+};
+
+}
+
+/**
+ * Constructor. Rectification stays disabled until a calibration is loaded.
+ */
+Rectifier::Rectifier()
+{
+}
+
+/**
+ * Load a stereo calibration and build the rectification maps.
+ * The file is an OpenCV FileStorage (YAML or XML) with the camera matrices and distortion coefficients M1, D1, M2, D2,
+ * plus either the rectification transforms R1, R2, P1, P2 (and optionally Q), or the rotation R and translation T between
+ * the cameras to compute them from. The calibration has to be made at the resolution of one eye.
+ * @param filename The calibration file.
+ * @param eye_size The size of one eye frame.
+ */
+void Rectifier::load(const std::string& filename, const cv::Size& eye_size) {
+    cv::FileStorage storage(filename, cv::FileStorage::READ);
+    if (!storage.isOpened()) {
+        throw std::runtime_error("Error: calibration file [" + filename + "] cannot be opened for reading");
+    }
+
+    cv::Mat M1, D1, M2, D2, R, T, R1, R2, P1, P2;
+    storage["M1"] >> M1;
+    storage["D1"] >> D1;
+    storage["M2"] >> M2;
+    storage["D2"] >> D2;
+    storage["R1"] >> R1;
+    storage["R2"] >> R2;
+    storage["P1"] >> P1;
+    storage["P2"] >> P2;
+    storage["Q"] >> Q;
+
+    if (M1.empty() || M2.empty()) {
+        throw std::runtime_error("Error: calibration file [" + filename + "] is missing the camera matrices M1/M2");
+    }
+    if (R1.empty() || R2.empty() || P1.empty() || P2.empty()) {
+        storage["R"] >> R;
+        storage["T"] >> T;
+        if (R.empty() || T.empty()) {
+            throw std::runtime_error("Error: calibration file [" + filename + "] needs either R1/R2/P1/P2 or R/T");
+        }
+        cv::stereoRectify(M1, D1, M2, D2, eye_size, R, T, R1, R2, P1, P2, Q, cv::CALIB_ZERO_DISPARITY, 0, eye_size);
+    }
+
+    cv::initUndistortRectifyMap(M1, D1, R1, P1, eye_size, CV_16SC2, left_map1, left_map2);
+    cv::initUndistortRectifyMap(M2, D2, R2, P2, eye_size, CV_16SC2, right_map1, right_map2);
+}
+
+/**
+ * @return True if a calibration has been loaded.
+ */
+bool Rectifier::is_enabled() const {
+    return !left_map1.empty();
+}
+
+/**
+ * Rectify both eyes, in parallel.
+ * @param left_eye The left eye frame.
+ * @param right_eye The right eye frame.
+ * @param left_rectified Receives the rectified left eye.
+ * @param right_rectified Receives the rectified right eye.
+ */
+void Rectifier::rectify(const cv::Mat& left_eye, const cv::Mat& right_eye, cv::Mat& left_rectified, cv::Mat& right_rectified) const {
+    left_rectified.create(left_map1.size(), left_eye.type());
+    right_rectified.create(right_map1.size(), right_eye.type());
+
+    const cv::Mat* sources[2] = {&left_eye, &right_eye};
+    const cv::Mat* map1[2] = {&left_map1, &right_map1};
+    const cv::Mat* map2[2] = {&left_map2, &right_map2};
+    cv::Mat* destinations[2] = {&left_rectified, &right_rectified};
+
+    int bands = (left_map1.rows + REMAP_BAND_ROWS - 1) / REMAP_BAND_ROWS;
+    cv::parallel_for_(cv::Range(0, 2 * bands), RemapBody(sources, map1, map2, destinations, bands));
+}
+
+/**
+ * @return The 4x4 disparity-to-depth reprojection matrix, empty if the calibration didn't provide or produce one.
+ */
+const cv::Mat& Rectifier::get_Q() const {
+    return Q;
+}
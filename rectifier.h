@@ -0,0 +1,27 @@
+#ifndef RECTIFIER_H
+#define RECTIFIER_H
+
+#include <string>
+
+#include "opencv2/core/core.hpp"
+
+/**
+ * Rectifies stereo eye pairs from a calibration file, so rigs that aren't perfectly aligned can be matched without a separate pre-pass.
+ * The undistort/rectify maps are built once, in the compact fixed-point CV_16SC2 format, and both eyes are remapped in parallel.
+ */
+class Rectifier
+{
+public:
+    Rectifier();
+
+    void load(const std::string& filename, const cv::Size& eye_size);
+    bool is_enabled() const;
+
+    void rectify(const cv::Mat& left_eye, const cv::Mat& right_eye, cv::Mat& left_rectified, cv::Mat& right_rectified) const;
+
+    const cv::Mat& get_Q() const;
+private:
+    cv::Mat left_map1, left_map2, right_map1, right_map2, Q;
+};
+
+#endif // RECTIFIER_H
@@ -0,0 +1,301 @@
+#include <cstdlib>
+#include <vector>
+
+#include <unistd.h> //gethostname
+
+#include "regressioncheck.h"
+#include "processor.h"
+
+namespace {
+
+//synthetic clip used for the quality cases
+const int CHECK_WIDTH = 320;
+const int CHECK_HEIGHT = 240;
+const size_t CHECK_FRAMES = 3;
+
+//larger clip timed for the speed check
+const int SPEED_WIDTH = 640;
+const int SPEED_HEIGHT = 360;
+const size_t SPEED_FRAMES = 20;
+
+//matching range of the quality cases
+const int CHECK_MIN_DISPARITY = 0;
+const int CHECK_NUM_DISPARITIES = 32;
+
+//disparities of the synthetic scene, in pixels
+const int BACKGROUND_DISPARITY = 4;
+const int FOREGROUND_DISPARITY = 12;
+
+//a golden comparison fails when more than this fraction of pixels differ by over a pixel, or in validity
+const double GOLDEN_TOLERANCE = 0.005;
+
+/**
+ * @return The texture value of a random-dot pattern at a position, the same for every run and platform.
+ */
+uchar dot(int seed, int x, int y) {
+    unsigned int hash = (unsigned int)(x * 73856093) ^ (unsigned int)(y * 19349663) ^ (unsigned int)(seed * 83492791);
+    hash ^= hash >> 13;
+    hash *= 0x5bd1e995u;
+    hash ^= hash >> 15;
+    return (uchar)(hash & 0xff);
+}
+
+/**
+ * @return This machine's name, for keeping speed baselines apart.
+ */
+std::string host_name() {
+    char name[256] = {0};
+    if (gethostname(name, sizeof(name) - 1) != 0 || name[0] == 0) {
+        return "unknown";
+    }
+    return std::string(name);
+}
+
+}
+
+/**
+ * Constructor.
+ * @param args The settings every case starts from. Engine and option settings are overridden per case.
+ * @param directory Where golden maps and speed baselines are kept.
+ * @param report The stream the results are written to.
+ */
+RegressionCheck::RegressionCheck(Arguments& args, const std::string& directory, std::ostream& report)
+    : arguments(args), directory(directory), report(report)
+{
+}
+
+/**
+ * Run every case and the speed check.
+ * @return True if nothing regressed.
+ */
+bool RegressionCheck::run() {
+    bool passed = true;
+
+    //each case starts from the defaults and the same matching settings, whatever the command line said
+    Arguments base;
+    base.set_value<int>(Arguments::MIN_DISPARITY, CHECK_MIN_DISPARITY);
+    base.set_value<int>(Arguments::NUM_DISPARITIES, CHECK_NUM_DISPARITIES);
+    base.set_value<int>(Arguments::SAD_WINDOW_SIZE, 9);
+    base.set_value<double>(Arguments::MATCH_SCALE, 1.0);
+    base.set_value<int>(Arguments::MAX_MEMORY, 0);
+
+    Arguments sgbm(base);
+    sgbm.set_value<std::string>(Arguments::ENGINE, "sgbm");
+    passed = check_case("sgbm", sgbm) && passed;
+
+    Arguments bm(base);
+    bm.set_value<std::string>(Arguments::ENGINE, "bm");
+    passed = check_case("bm", bm) && passed;
+
+    Arguments census(base);
+    census.set_value<std::string>(Arguments::ENGINE, "census");
+    passed = check_case("census", census) && passed;
+
+    Arguments luma(sgbm);
+    luma.set_value<bool>(Arguments::LUMA, true);
+    passed = check_case("sgbm_luma", luma) && passed;
+
+    Arguments filtered(sgbm);
+    filtered.set_value<int>(Arguments::CROSS_CHECK, 1);
+    filtered.set_value<int>(Arguments::POST_FILTER, 4);
+    filtered.set_value<int>(Arguments::TEMPORAL, 3);
+    passed = check_case("sgbm_filtered", filtered) && passed;
+
+    Arguments scaled(sgbm);
+    scaled.set_value<double>(Arguments::MATCH_SCALE, 0.5);
+    passed = check_case("sgbm_half_scale", scaled) && passed;
+
+    passed = check_speed() && passed;
+
+    report << (passed ? "All regression checks passed" : "REGRESSION CHECKS FAILED") << std::endl;
+    return passed;
+}
+
+/**
+ * Run one case on the synthetic clip with one thread and with all of them, and compare against the golden maps.
+ * @param name The case name, also the golden file name.
+ * @param case_arguments The case's settings.
+ * @return True if the case passed.
+ */
+bool RegressionCheck::check_case(const std::string& name, Arguments& case_arguments) {
+    cv::Size eye_size(CHECK_WIDTH, CHECK_HEIGHT);
+    int threads = cv::getNumThreads();
+
+    std::vector<cv::Mat> single, parallel;
+    cv::setNumThreads(1);
+    try {
+        compute_clip(case_arguments, eye_size, CHECK_FRAMES, single);
+    } catch (...) {
+        cv::setNumThreads(threads);
+        throw;
+    }
+    cv::setNumThreads(threads);
+    compute_clip(case_arguments, eye_size, CHECK_FRAMES, parallel);
+
+    bool passed = true;
+    for (size_t frame = 0; frame < single.size(); ++frame) {
+        cv::Mat differences;
+        cv::compare(single[frame], parallel[frame], differences, cv::CMP_NE);
+        if (cv::countNonZero(differences) > 0) {
+            report << "FAIL " << name << ": frame " << frame << " differs between 1 and " << threads << " threads ("
+                   << cv::countNonZero(differences) << " pixels)" << std::endl;
+            passed = false;
+        }
+    }
+
+    std::string golden_filename = directory + "/" + name + ".yml.gz";
+    cv::FileStorage golden(golden_filename, cv::FileStorage::READ);
+    if (!golden.isOpened()) {
+        if (!arguments.get_value<bool>(Arguments::RECORD_REFERENCES)) {
+            report << "FAIL " << name << ": no golden file [" << golden_filename << "], run with --record to write it" << std::endl;
+            return false;
+        }
+        cv::FileStorage record(golden_filename, cv::FileStorage::WRITE);
+        if (!record.isOpened()) {
+            report << "FAIL " << name << ": golden file [" << golden_filename << "] cannot be written" << std::endl;
+            return false;
+        }
+        for (size_t frame = 0; frame < parallel.size(); ++frame) {
+            record << "frame" + std::to_string(frame) << parallel[frame];
+        }
+        report << "RECORDED " << name << ": golden maps written to [" << golden_filename << "]" << std::endl;
+        return passed;
+    }
+
+    for (size_t frame = 0; frame < parallel.size(); ++frame) {
+        cv::Mat expected;
+        golden["frame" + std::to_string(frame)] >> expected;
+        if (expected.empty() || expected.size() != parallel[frame].size() || expected.type() != parallel[frame].type()) {
+            report << "FAIL " << name << ": frame " << frame << " has no matching golden map" << std::endl;
+            passed = false;
+            continue;
+        }
+        double mismatch = compare(parallel[frame], expected);
+        if (mismatch > GOLDEN_TOLERANCE) {
+            report << "FAIL " << name << ": frame " << frame << " differs from golden in " << 100.0 * mismatch << "% of pixels" << std::endl;
+            passed = false;
+        }
+    }
+    if (passed) {
+        report << "PASS " << name << std::endl;
+    }
+    return passed;
+}
+
+/**
+ * Time the default settings on the larger synthetic clip and compare the frame rate to this machine's baseline.
+ * @return True if the frame rate is within --perf-tolerance of the baseline (or the baseline was just recorded).
+ */
+bool RegressionCheck::check_speed() {
+    //the defaults, so baselines stay comparable whatever the command line said
+    Arguments speed_arguments;
+    cv::Size eye_size(SPEED_WIDTH, SPEED_HEIGHT);
+
+    //one untimed run so library start-up doesn't count
+    std::vector<cv::Mat> disparities;
+    compute_clip(speed_arguments, eye_size, 1, disparities);
+    double start = (double)cv::getTickCount();
+    compute_clip(speed_arguments, eye_size, SPEED_FRAMES, disparities);
+    double fps = SPEED_FRAMES / (((double)cv::getTickCount() - start) / cv::getTickFrequency());
+
+    std::string baseline_filename = directory + "/speed_" + host_name() + ".yml";
+    cv::FileStorage baseline(baseline_filename, cv::FileStorage::READ);
+    if (!baseline.isOpened()) {
+        if (!arguments.get_value<bool>(Arguments::RECORD_REFERENCES)) {
+            report << "FAIL speed: no baseline file [" << baseline_filename << "], run with --record to write it" << std::endl;
+            return false;
+        }
+        cv::FileStorage record(baseline_filename, cv::FileStorage::WRITE);
+        if (!record.isOpened()) {
+            report << "FAIL speed: baseline file [" << baseline_filename << "] cannot be written" << std::endl;
+            return false;
+        }
+        record << "fps" << fps;
+        report << "RECORDED speed: " << fps << " fps baseline written to [" << baseline_filename << "]" << std::endl;
+        return true;
+    }
+
+    double baseline_fps = 0;
+    baseline["fps"] >> baseline_fps;
+    int tolerance = arguments.get_value<int>(Arguments::PERF_TOLERANCE);
+    double floor_fps = baseline_fps * (100 - tolerance) / 100.0;
+    if (fps < floor_fps) {
+        report << "FAIL speed: " << fps << " fps, more than " << tolerance << "% below the baseline of " << baseline_fps << " fps" << std::endl;
+        return false;
+    }
+    report << "PASS speed: " << fps << " fps (baseline " << baseline_fps << " fps)" << std::endl;
+    return true;
+}
+
+/**
+ * Render one side-by-side frame of the synthetic clip: a random-dot background plane, and a random-dot block in front of it
+ * that moves a few pixels every frame. Every frame is the same on every machine.
+ * @param frame The frame number.
+ * @param eye_size The size of each eye.
+ * @param frame_src Receives the CV_8UC3 side-by-side frame.
+ */
+void RegressionCheck::render_clip(size_t frame, const cv::Size& eye_size, cv::Mat& frame_src) const {
+    frame_src.create(eye_size.height, eye_size.width * 2, CV_8UC3);
+    int block_left = eye_size.width / 4 + 3 * (int)frame;
+    int block_right = block_left + eye_size.width / 3;
+    int block_top = eye_size.height / 4;
+    int block_bottom = block_top + eye_size.height / 2;
+
+    for (int y = 0; y < eye_size.height; ++y) {
+        uchar* left = frame_src.ptr<uchar>(y);
+        uchar* right = left + 3 * eye_size.width;
+        bool block_row = y >= block_top && y < block_bottom;
+        for (int x = 0; x < eye_size.width; ++x) {
+            //a point at left eye x is seen at right eye x - disparity, so the right eye samples the layers shifted the other way
+            uchar left_value = block_row && x >= block_left && x < block_right
+                    ? dot(2, x, y) : dot(1, x - BACKGROUND_DISPARITY, y);
+            int block_x = x + FOREGROUND_DISPARITY;
+            uchar right_value = block_row && block_x >= block_left && block_x < block_right
+                    ? dot(2, block_x, y) : dot(1, x, y);
+            for (int channel = 0; channel < 3; ++channel) {
+                left[3 * x + channel] = left_value;
+                right[3 * x + channel] = right_value;
+            }
+        }
+    }
+}
+
+/**
+ * Run a fresh Processor over the synthetic clip, so no state carries over between runs.
+ * @param case_arguments The settings to run with.
+ * @param eye_size The size of each eye.
+ * @param frames How many frames to compute.
+ * @param disparities Receives a copy of each frame's CV_16SC1 disparity map.
+ */
+void RegressionCheck::compute_clip(Arguments& case_arguments, const cv::Size& eye_size, size_t frames, std::vector<cv::Mat>& disparities) const {
+    Processor processor(case_arguments, cv::Size(eye_size.width * 2, eye_size.height), StereoLayout::SBS);
+    disparities.clear();
+    cv::Mat frame_src, disparity;
+    for (size_t frame = 0; frame < frames; ++frame) {
+        render_clip(frame, eye_size, frame_src);
+        processor.compute_depth(frame_src, cv::Mat(), disparity);
+        disparities.push_back(disparity.clone());
+    }
+}
+
+/**
+ * @param disparity A computed CV_16SC1 disparity map.
+ * @param golden The golden map of the same size.
+ * @return The fraction of pixels whose validity differs or whose disparities differ by more than a pixel.
+ */
+double RegressionCheck::compare(const cv::Mat& disparity, const cv::Mat& golden) const {
+    short invalid = (short)((CHECK_MIN_DISPARITY - 1) * 16);
+    size_t mismatched = 0;
+    for (int y = 0; y < disparity.rows; ++y) {
+        const short* values = disparity.ptr<short>(y);
+        const short* expected = golden.ptr<short>(y);
+        for (int x = 0; x < disparity.cols; ++x) {
+            bool valid = values[x] > invalid;
+            bool expected_valid = expected[x] > invalid;
+            if (valid != expected_valid || (valid && std::abs(values[x] - expected[x]) > 16)) {
+                ++mismatched;
+            }
+        }
+    }
+    return (double)mismatched / disparity.total();
+}
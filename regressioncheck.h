@@ -0,0 +1,39 @@
+#ifndef REGRESSIONCHECK_H
+#define REGRESSIONCHECK_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+#include "arguments.hpp"
+
+/**
+ * Quality and speed regression checks of the Processor, for catching silent changes after OpenCV or compiler upgrades.
+ * Deterministic synthetic stereo clips (random-dot planes at known disparities, with a moving foreground block) are run
+ * through a set of engine and option cases, and each case must:
+ *  *) match its golden disparity maps in the golden directory, within a tolerance;
+ *  *) give bit-identical output with one worker thread and with all of them.
+ * Then the frame rate of the default settings is compared against this machine's recorded baseline.
+ * A missing golden map or baseline fails the check, unless --record is given, in which case it is written (and reported).
+ */
+class RegressionCheck
+{
+public:
+    RegressionCheck(Arguments& args, const std::string& directory, std::ostream& report);
+
+    bool run();
+private:
+    bool check_case(const std::string& name, Arguments& case_arguments);
+    bool check_speed();
+
+    void render_clip(size_t frame, const cv::Size& eye_size, cv::Mat& frame_src) const;
+    void compute_clip(Arguments& case_arguments, const cv::Size& eye_size, size_t frames, std::vector<cv::Mat>& disparities) const;
+    double compare(const cv::Mat& disparity, const cv::Mat& golden) const;
+
+    Arguments& arguments;
+    std::string directory;
+    std::ostream& report;
+};
+
+#endif // REGRESSIONCHECK_H
@@ -0,0 +1,74 @@
+#include <stdexcept>
+
+#include "stagegraph.h"
+#include "tracer.h"
+
+/**
+ * Add a stage. It starts out of date.
+ * Throws std::logic_error if an input isn't an earlier stage.
+ * @param name The stage's name, a string literal.
+ * @param compute Recomputes the stage's output from its inputs' outputs.
+ * @param inputs The stages whose outputs it reads.
+ * @return The stage's handle, for invalidate() and as an input of later stages.
+ */
+size_t StageGraph::add(const char* name, const Compute& compute, const std::vector<size_t>& inputs) {
+    for (size_t input : inputs) {
+        if (input >= stages.size()) {
+            throw std::logic_error("Error: stage inputs must be added before the stage");
+        }
+    }
+    Stage stage = {name, compute, inputs, true};
+    stages.push_back(stage);
+    return stages.size() - 1;
+}
+
+/**
+ * Mark a stage, and everything that depends on it, out of date.
+ * @param stage The stage whose inputs or settings changed.
+ */
+void StageGraph::invalidate(size_t stage) {
+    stages.at(stage).dirty = true;
+    //later stages are the only ones that can depend on it, and one pass in order reaches them all
+    for (size_t later = stage + 1; later < stages.size(); ++later) {
+        for (size_t input : stages[later].inputs) {
+            if (stages[input].dirty) {
+                stages[later].dirty = true;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Mark every stage out of date.
+ */
+void StageGraph::invalidate_all() {
+    for (Stage& stage : stages) {
+        stage.dirty = true;
+    }
+}
+
+/**
+ * Recompute the stages that are out of date, in order. A stage that throws stays out of date, and so does everything
+ * downstream of it, even stages that were up to date: their outputs may no longer match what the failed stage left behind.
+ * The exception is passed on.
+ * @return True if anything was recomputed.
+ */
+bool StageGraph::update() {
+    bool computed = false;
+    for (size_t index = 0; index < stages.size(); ++index) {
+        Stage& stage = stages[index];
+        if (stage.dirty) {
+            TraceSpan span(stage.name);
+            try {
+                stage.compute();
+            } catch (...) {
+                invalidate(index);
+                throw;
+            }
+            stage.dirty = false;
+            computed = true;
+        }
+    }
+    return computed;
+}
@@ -0,0 +1,37 @@
+#ifndef STAGEGRAPH_H
+#define STAGEGRAPH_H
+
+#include <functional>
+#include <vector>
+
+/**
+ * A small dependency graph of computation stages, each of which keeps its own output (in whatever its compute function
+ * writes to) until something upstream of it changes. Invalidating a stage marks it and every stage downstream of it, and
+ * update() recomputes only the marked stages, in the order they were added. Stages can only depend on stages added before
+ * them, so that order is a topological one.
+ * Used by the GUI preview, so that changing a setting recomputes only the stages it feeds.
+ */
+class StageGraph
+{
+public:
+    typedef std::function<void()> Compute;
+
+    size_t add(const char* name, const Compute& compute, const std::vector<size_t>& inputs = std::vector<size_t>());
+    void invalidate(size_t stage);
+    void invalidate_all();
+    bool update();
+private:
+    /**
+     * One stage: its compute function, the stages it reads, and whether its output is out of date.
+     */
+    struct Stage {
+        const char* name; //a string literal, also the stage's trace span
+        Compute compute;
+        std::vector<size_t> inputs;
+        bool dirty;
+    };
+
+    std::vector<Stage> stages;
+};
+
+#endif // STAGEGRAPH_H
@@ -23,13 +23,59 @@ SOURCES += main.cpp\
 		   qtopencvwidgetgl.cpp\
 		   qtopencvdepthmap.cpp \
     processor.cpp \
-    qslidersubrange.cpp
+    qslidersubrange.cpp \
+    matcher.cpp \
+    censusmatcher.cpp \
+    upsampler.cpp \
+    rectifier.cpp \
+    stereolayout.cpp \
+    batchscheduler.cpp \
+    rawstream.cpp \
+    liveprocessor.cpp \
+    frameindex.cpp \
+    temporalfilter.cpp \
+    guidedfilter.cpp \
+    pointcloudwriter.cpp \
+    tracer.cpp \
+    regressioncheck.cpp \
+    rangeestimator.cpp \
+    fanout.cpp \
+    numaplacement.cpp \
+    disparitycache.cpp \
+    stagegraph.cpp \
+    mappedcapture.cpp
 
 HEADERS  += arguments.hpp\
 			qtopencvwidgetgl.h\
 			qtopencvdepthmap.h \
     processor.h \
-    qslidersubrange.h
+    qslidersubrange.h \
+    matcher.h \
+    censusmatcher.h \
+    censuskernels.inc \
+    upsampler.h \
+    rectifier.h \
+    stereolayout.h \
+    batchscheduler.h \
+    rawstream.h \
+    liveprocessor.h \
+    frameindex.h \
+    temporalfilter.h \
+    guidedfilter.h \
+    pointcloudwriter.h \
+    tracer.h \
+    regressioncheck.h \
+    rangeestimator.h \
+    fanout.h \
+    numaplacement.h \
+    disparitycache.h \
+    stagegraph.h \
+    mappedcapture.h
 
 FORMS    += qtopencvdepthmap.ui
 
+# "make record-tests" writes the golden maps and this machine's speed baseline for the regression checks into tests/, to be
+# reviewed and committed. A "tests" target that checks against them is added once they are.
+record-tests.commands = $$OUT_PWD/$$TARGET --self-test $$PWD/tests --record
+record-tests.depends = $(TARGET)
+QMAKE_EXTRA_TARGETS += record-tests
@@ -0,0 +1,291 @@
+#include <stdexcept>
+
+#include "opencv2/imgproc/imgproc.hpp" //resize, matchTemplate, cvtColor
+
+#include "stereolayout.h"
+
+namespace {
+
+//side of the thumbnails the two halves are compared at when detecting the layout
+const int DETECT_SIZE = 64;
+
+//normalized correlation needed before the halves are considered two views of the same scene
+const double DETECT_MIN_SCORE = 0.5;
+
+//the luma eye buffers start on a cache line
+const size_t LUMA_ALIGNMENT = 64;
+
+//rows converted per task when extracting the luma of both eyes
+const int LUMA_BAND_ROWS = 64;
+
+/**
+ * Make sure an eye buffer is a contiguous CV_8UC1 matrix of the given size starting on a cache line. An existing buffer that
+ * already fits is kept, so the same memory is reused frame after frame.
+ * The matrix is a reshaped view into a slightly larger single row allocation, so it still owns (reference counts) its memory.
+ */
+void allocate_luma(const cv::Size& size, cv::Mat& buffer) {
+    if (buffer.size() == size && buffer.type() == CV_8UC1 && buffer.isContinuous() && ((size_t)buffer.data % LUMA_ALIGNMENT) == 0) {
+        return;
+    }
+    size_t total = (size_t)size.area();
+    cv::Mat storage(1, (int)(total + LUMA_ALIGNMENT), CV_8UC1);
+    size_t offset = (LUMA_ALIGNMENT - ((size_t)storage.data % LUMA_ALIGNMENT)) % LUMA_ALIGNMENT;
+    buffer = storage.colRange((int)offset, (int)(offset + total)).reshape(1, size.height);
+}
+
+/**
+ * Converts (or copies, for single channel input) one band of rows of one eye into its luma buffer.
+ */
+class LumaBody : public cv::ParallelLoopBody
+{
+public:
+    LumaBody(const cv::Mat* sources[2], cv::Mat* destinations[2], int bands)
+        : bands(bands)
+    {
+        for (int eye = 0; eye < 2; ++eye) {
+            this->sources[eye] = sources[eye];
+            this->destinations[eye] = destinations[eye];
+        }
+    }
+
+    void operator()(const cv::Range& range) const {
+        for (int task = range.start; task < range.end; ++task) {
+            int eye = task / bands;
+            int first = (task % bands) * LUMA_BAND_ROWS;
+            int last = std::min(first + LUMA_BAND_ROWS, destinations[eye]->rows);
+            cv::Mat band = destinations[eye]->rowRange(first, last);
+            if (sources[eye]->channels() == 1) {
+                sources[eye]->rowRange(first, last).copyTo(band);
+            } else {
+                cvtColor(sources[eye]->rowRange(first, last), band, CV_BGR2GRAY);
+            }
+        }
+    }
+private:
+    const cv::Mat* sources[2];
+    cv::Mat* destinations[2];
+    int bands;
+};
+
+/**
+ * Correlate two halves of a frame at thumbnail size.
+ * @return The normalized correlation coefficient, or -1 for featureless (e.g. black) halves.
+ */
+double correlate(const cv::Mat& first, const cv::Mat& second) {
+    cv::Mat first_small, second_small, first_gray, second_gray, score;
+    resize(first, first_small, cv::Size(DETECT_SIZE, DETECT_SIZE), 0, 0, cv::INTER_AREA);
+    resize(second, second_small, cv::Size(DETECT_SIZE, DETECT_SIZE), 0, 0, cv::INTER_AREA);
+    if (first_small.channels() == 1) {
+        first_gray = first_small;
+        second_gray = second_small;
+    } else {
+        cvtColor(first_small, first_gray, CV_BGR2GRAY);
+        cvtColor(second_small, second_gray, CV_BGR2GRAY);
+    }
+    cv::matchTemplate(first_gray, second_gray, score, CV_TM_CCOEFF_NORMED);
+    double value = score.at<float>(0, 0);
+    return value == value ? value : -1;
+}
+
+}
+
+/**
+ * Constructor for an empty layout, to be assigned later.
+ */
+StereoLayout::StereoLayout()
+    : type(SBS)
+{
+}
+
+/**
+ * Constructor.
+ * @param type The layout, not AUTO (resolve it with detect() first).
+ * @param frame_size The size of one decoded input frame (of one file, for SEPARATE).
+ */
+StereoLayout::StereoLayout(Type type, const cv::Size& frame_size)
+    : type(type), frame_size(frame_size)
+{
+    switch (type) {
+        case SBS:
+            eye_size = output_size = cv::Size(frame_size.width / 2, frame_size.height);
+            break;
+        case HALF_SBS:
+            eye_size = cv::Size(frame_size.width / 2, frame_size.height);
+            output_size = cv::Size(eye_size.width * 2, frame_size.height);
+            break;
+        case TB:
+            eye_size = output_size = cv::Size(frame_size.width, frame_size.height / 2);
+            break;
+        case HALF_TB:
+            eye_size = cv::Size(frame_size.width, frame_size.height / 2);
+            output_size = cv::Size(frame_size.width, eye_size.height * 2);
+            break;
+        case SEPARATE:
+            eye_size = output_size = frame_size;
+            break;
+        default:
+            throw std::runtime_error("Error: stereo layout has to be resolved before use");
+    }
+}
+
+/**
+ * Parse a layout name as accepted by --layout.
+ * @param name One of auto, sbs, half-sbs, tb, half-tb or separate.
+ * @return The layout type.
+ */
+StereoLayout::Type StereoLayout::from_string(const std::string& name) {
+    if (name == "auto")     return AUTO;
+    if (name == "sbs")      return SBS;
+    if (name == "half-sbs") return HALF_SBS;
+    if (name == "tb")       return TB;
+    if (name == "half-tb")  return HALF_TB;
+    if (name == "separate") return SEPARATE;
+    throw std::runtime_error("Error: unknown stereo layout [" + name + "]");
+}
+
+/**
+ * @param type The layout type.
+ * @return The layout name as accepted by --layout.
+ */
+std::string StereoLayout::to_string(Type type) {
+    switch (type) {
+        case AUTO:     return "auto";
+        case SBS:      return "sbs";
+        case HALF_SBS: return "half-sbs";
+        case TB:       return "tb";
+        case HALF_TB:  return "half-tb";
+        case SEPARATE: return "separate";
+    }
+    return "";
+}
+
+/**
+ * Work out the packing of a single-file stereo frame.
+ * The side-by-side and top-bottom splits are both correlated, and the better matching pair of halves wins (side-by-side if neither
+ * looks like a stereo pair). Full or half resolution is then decided from the eye's aspect ratio: a side-by-side eye narrower than
+ * square, or a top-bottom eye wider than 2.5:1, is taken to be anamorphically squeezed.
+ * @param frame A representative decoded frame.
+ * @return The detected layout.
+ */
+StereoLayout::Type StereoLayout::detect(const cv::Mat& frame) {
+    int half_width = frame.cols / 2;
+    int half_height = frame.rows / 2;
+    double sbs_score = correlate(frame.colRange(0, half_width), frame.colRange(half_width, half_width * 2));
+    double tb_score = correlate(frame.rowRange(0, half_height), frame.rowRange(half_height, half_height * 2));
+
+    if (tb_score > sbs_score && tb_score >= DETECT_MIN_SCORE) {
+        return (double)frame.cols / half_height > 2.5 ? HALF_TB : TB;
+    }
+    return (double)half_width / frame.rows < 1.0 ? HALF_SBS : SBS;
+}
+
+/**
+ * Work out the packing of a video feed from a frame in the middle of it (the first frames are often black).
+ * The feed's read position is restored afterwards.
+ * @param feed The opened input feed.
+ * @return The detected layout, SBS if no frame could be read.
+ */
+StereoLayout::Type StereoLayout::detect(cv::VideoCapture& feed) {
+    double position = feed.get(CV_CAP_PROP_POS_FRAMES);
+    double frame_count = feed.get(CV_CAP_PROP_FRAME_COUNT);
+
+    cv::Mat frame;
+    feed.set(CV_CAP_PROP_POS_FRAMES, frame_count > 0 ? std::floor(frame_count / 2) : 0);
+    feed >> frame;
+    if (frame.empty()) {
+        feed.set(CV_CAP_PROP_POS_FRAMES, 0);
+        feed >> frame;
+    }
+    feed.set(CV_CAP_PROP_POS_FRAMES, position);
+
+    return frame.empty() ? SBS : detect(frame);
+}
+
+/**
+ * @return The layout type.
+ */
+StereoLayout::Type StereoLayout::get_type() const {
+    return type;
+}
+
+/**
+ * @return The size each eye is stored, and matched, at.
+ */
+cv::Size StereoLayout::get_eye_size() const {
+    return eye_size;
+}
+
+/**
+ * @return The size of the depth map at the eye's display aspect.
+ */
+cv::Size StereoLayout::get_output_size() const {
+    return output_size;
+}
+
+/**
+ * Get views of the two eyes. No pixel data is copied.
+ * For SEPARATE the frame is the left eye's, and the right eye has to come from the second file.
+ * @param frame The decoded input frame.
+ * @param left_eye Receives a view of the left eye.
+ * @param right_eye Receives a view of the right eye (untouched for SEPARATE).
+ */
+void StereoLayout::split(const cv::Mat& frame, cv::Mat& left_eye, cv::Mat& right_eye) const {
+    switch (type) {
+        case SBS:
+        case HALF_SBS:
+            left_eye = frame.colRange(0, eye_size.width);
+            right_eye = frame.colRange(eye_size.width, eye_size.width * 2);
+            break;
+        case TB:
+        case HALF_TB:
+            left_eye = frame.rowRange(0, eye_size.height);
+            right_eye = frame.rowRange(eye_size.height, eye_size.height * 2);
+            break;
+        default:
+            left_eye = frame;
+            break;
+    }
+}
+
+/**
+ * Extract the luma of both eyes into their own contiguous, cache-aligned buffers, in the same pass that splits the frame.
+ * Each source pixel is read once, straight out of the decoded frame, so there is no full-frame gray image and the matcher
+ * doesn't have to walk the strided eye views. Frames that are already single channel (e.g. a Y plane) are only copied.
+ * The buffers are reused when they already have the right size.
+ * @param frame The decoded input frame (the left eye's file, for SEPARATE).
+ * @param right_frame The decoded right eye frame for SEPARATE, ignored otherwise.
+ * @param left_eye Receives the CV_8UC1 luma of the left eye.
+ * @param right_eye Receives the CV_8UC1 luma of the right eye.
+ */
+void StereoLayout::split_luma(const cv::Mat& frame, const cv::Mat& right_frame, cv::Mat& left_eye, cv::Mat& right_eye) const {
+    cv::Mat left_view, right_view = right_frame;
+    split(frame, left_view, right_view);
+
+    allocate_luma(left_view.size(), left_eye);
+    allocate_luma(right_view.size(), right_eye);
+
+    const cv::Mat* sources[2] = {&left_view, &right_view};
+    cv::Mat* destinations[2] = {&left_eye, &right_eye};
+    int bands = (left_eye.rows + LUMA_BAND_ROWS - 1) / LUMA_BAND_ROWS;
+    cv::parallel_for_(cv::Range(0, 2 * bands), LumaBody(sources, destinations, bands));
+}
+
+/**
+ * Bring a disparity map computed at the eye size to the output size.
+ * Stretching horizontally also scales the disparity values, as they are measured in horizontal pixels.
+ * Nearest-neighbour sampling keeps invalid pixels and depth edges intact.
+ * @param disparity The CV_16SC1 disparity map at eye size.
+ * @param output Receives the disparity map at output size (shares data with disparity when no stretch is needed).
+ */
+void StereoLayout::to_output(const cv::Mat& disparity, cv::Mat& output) const {
+    if (eye_size == output_size) {
+        output = disparity;
+    } else if (type == HALF_SBS) {
+        cv::Mat stretched;
+        resize(disparity, stretched, output_size, 0, 0, cv::INTER_NEAREST);
+        //invalid pixels are negative (minDisparity - 1) * 16 and get doubled too, which keeps them below every valid value
+        stretched.convertTo(output, CV_16S, (double)output_size.width / eye_size.width);
+    } else {
+        resize(disparity, output, output_size, 0, 0, cv::INTER_NEAREST);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef STEREOLAYOUT_H
+#define STEREOLAYOUT_H
+
+#include <string>
+
+#include "opencv2/highgui/highgui.hpp" //VideoCapture
+
+/**
+ * Describes how the two eyes are packed into the input, and presents each eye as a zero-copy view at its native (stored) size.
+ * Half-width and half-height layouts are matched as stored. Only the disparity map is stretched back to the display aspect,
+ * with the disparity values rescaled to match.
+ */
+class StereoLayout
+{
+public:
+    enum Type {
+        AUTO,     //detect from the content
+        SBS,      //full side-by-side, each eye is half the frame width at its display aspect
+        HALF_SBS, //anamorphic side-by-side, each eye is squeezed to half width
+        TB,       //full top-bottom, each eye is half the frame height at its display aspect
+        HALF_TB,  //anamorphic top-bottom, each eye is squeezed to half height
+        SEPARATE  //left and right eyes come from separate files
+    };
+
+    StereoLayout();
+    StereoLayout(Type type, const cv::Size& frame_size);
+
+    static Type from_string(const std::string& name);
+    static std::string to_string(Type type);
+    static Type detect(const cv::Mat& frame);
+    static Type detect(cv::VideoCapture& feed);
+
+    Type get_type() const;
+    cv::Size get_eye_size() const;
+    cv::Size get_output_size() const;
+
+    void split(const cv::Mat& frame, cv::Mat& left_eye, cv::Mat& right_eye) const;
+    void split_luma(const cv::Mat& frame, const cv::Mat& right_frame, cv::Mat& left_eye, cv::Mat& right_eye) const;
+    void to_output(const cv::Mat& disparity, cv::Mat& output) const;
+private:
+    Type type;
+    cv::Size frame_size, eye_size, output_size;
+};
+
+#endif // STEREOLAYOUT_H
@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <cmath>
+
+#include "opencv2/imgproc/imgproc.hpp" //resize, cvtColor
+
+#include "temporalfilter.h"
+
+namespace {
+
+//size of the thumbnails compared to detect scene cuts
+const int CUT_THUMBNAIL_WIDTH = 64;
+const int CUT_THUMBNAIL_HEIGHT = 36;
+
+//mean absolute thumbnail difference (in gray levels) above which consecutive frames are taken to be a scene cut
+const double CUT_THRESHOLD = 30.0;
+
+/**
+ * Filters a band of rows. The loops run over whole rows per history frame, with no lookups or branches, so the
+ * compiler can vectorize them.
+ */
+class TemporalBody : public cv::ParallelLoopBody
+{
+public:
+    TemporalBody(const std::vector<const cv::Mat*>& disparities, const std::vector<const cv::Mat*>& guides,
+                 const std::vector<float>& age_weights, float range_factor, int max_jump, short invalid, cv::Mat& filtered)
+        : disparities(disparities), guides(guides), age_weights(age_weights), range_factor(range_factor),
+          max_jump(max_jump), invalid(invalid), filtered(filtered) {}
+
+    void operator()(const cv::Range& range) const {
+        const int width = filtered.cols;
+        std::vector<float> weight_sums(width), value_sums(width);
+        for (int y = range.start; y < range.end; ++y) {
+            const short* current = disparities[0]->ptr<short>(y);
+            const uchar* current_guide = guides[0]->ptr<uchar>(y);
+            float* weight_sum = &weight_sums[0];
+            float* value_sum = &value_sums[0];
+            for (int x = 0; x < width; ++x) {
+                weight_sum[x] = 0;
+                value_sum[x] = 0;
+            }
+
+            for (size_t age = 0; age < disparities.size(); ++age) {
+                const short* values = disparities[age]->ptr<short>(y);
+                const uchar* guide = guides[age]->ptr<uchar>(y);
+                const float age_weight = age_weights[age];
+                for (int x = 0; x < width; ++x) {
+                    int difference = (int)guide[x] - (int)current_guide[x];
+                    float weight = age_weight / (1.0f + range_factor * (float)(difference * difference));
+                    //invalid history never counts, and valid history only where it agrees with a valid current value
+                    int jump = (int)values[x] - (int)current[x];
+                    bool usable = values[x] > invalid && (current[x] <= invalid || (jump <= max_jump && jump >= -max_jump));
+                    weight = usable ? weight : 0.0f;
+                    weight_sum[x] += weight;
+                    value_sum[x] += weight * (float)values[x];
+                }
+            }
+
+            short* output = filtered.ptr<short>(y);
+            for (int x = 0; x < width; ++x) {
+                output[x] = weight_sum[x] > 1e-6f ? (short)cvRound(value_sum[x] / weight_sum[x]) : invalid;
+            }
+        }
+    }
+private:
+    const std::vector<const cv::Mat*>& disparities;
+    const std::vector<const cv::Mat*>& guides;
+    const std::vector<float>& age_weights;
+    float range_factor;
+    int max_jump;
+    short invalid;
+    cv::Mat& filtered;
+};
+
+}
+
+/**
+ * Constructor. The filter starts disabled.
+ * @param sigma_range How far apart (in gray levels) guide intensities can be and still be averaged.
+ * @param decay Weight of each frame relative to the next newer one.
+ * @param max_jump Largest disparity difference to the current frame, in pixels, that history may have and still count.
+ */
+TemporalFilter::TemporalFilter(float sigma_range, float decay, int max_jump)
+    : window(0), sigma_range(sigma_range), decay(decay), max_jump(max_jump), head(0), count(0), scene_cuts(0)
+{
+}
+
+/**
+ * Set the window length. Changing it drops the history.
+ * @param window Number of frames averaged, including the current one. 0 or 1 disable the filter.
+ */
+void TemporalFilter::configure(int window) {
+    if (window != this->window) {
+        this->window = window;
+        disparities.assign(std::max(window, 0), cv::Mat());
+        guides.assign(std::max(window, 0), cv::Mat());
+        reset();
+    }
+}
+
+/**
+ * Forget the history, e.g. after a seek.
+ */
+void TemporalFilter::reset() {
+    head = 0;
+    count = 0;
+    previous_thumbnail.release();
+}
+
+/**
+ * @return True if frames are averaged over time.
+ */
+bool TemporalFilter::is_enabled() const {
+    return window > 1;
+}
+
+/**
+ * @return The number of scene cuts the history has been reset at.
+ */
+size_t TemporalFilter::get_scene_cuts() const {
+    return scene_cuts;
+}
+
+/**
+ * Add a frame to the history and write its stabilized disparity map.
+ * @param disparity The CV_16SC1 disparity map of the current frame.
+ * @param guide The current left eye frame at the same size (gray, or BGR which is converted).
+ * @param invalid The disparity value of invalid pixels.
+ * @param filtered Receives the stabilized CV_16SC1 disparity map.
+ */
+void TemporalFilter::filter(const cv::Mat& disparity, const cv::Mat& guide, short invalid, cv::Mat& filtered) {
+    if (!is_enabled()) {
+        filtered = disparity;
+        return;
+    }
+
+    cv::Mat guide_gray;
+    if (guide.channels() == 1) {
+        guide_gray = guide;
+    } else {
+        cvtColor(guide, guide_gray, CV_BGR2GRAY);
+    }
+
+    if (count > 0 && (disparities[head].size() != disparity.size() || is_scene_cut(guide_gray))) {
+        count = 0;
+    } else if (count == 0) {
+        is_scene_cut(guide_gray);
+    }
+
+    //the ring slots keep their buffers, so copying in doesn't allocate once the ring is full
+    head = (head + 1) % window;
+    disparity.copyTo(disparities[head]);
+    guide_gray.copyTo(guides[head]);
+    count = std::min(count + 1, (size_t)window);
+
+    std::vector<const cv::Mat*> history_disparities, history_guides;
+    std::vector<float> age_weights;
+    float age_weight = 1.0f;
+    for (size_t age = 0; age < count; ++age) {
+        size_t slot = (head + window - age) % window;
+        history_disparities.push_back(&disparities[slot]);
+        history_guides.push_back(&guides[slot]);
+        age_weights.push_back(age_weight);
+        age_weight *= decay;
+    }
+
+    filtered.create(disparity.size(), CV_16SC1);
+    int jump = max_jump * 16;
+    float range_factor = 0.5f / (sigma_range * sigma_range);
+    cv::parallel_for_(cv::Range(0, disparity.rows),
+                      TemporalBody(history_disparities, history_guides, age_weights, range_factor, jump, invalid, filtered));
+}
+
+/**
+ * Compare the guide against the previous one at thumbnail size, and remember it for the next frame.
+ * @param guide The current gray guide frame.
+ * @return True if the frame starts a new scene.
+ */
+bool TemporalFilter::is_scene_cut(const cv::Mat& guide) {
+    cv::Mat thumbnail;
+    resize(guide, thumbnail, cv::Size(CUT_THUMBNAIL_WIDTH, CUT_THUMBNAIL_HEIGHT), 0, 0, cv::INTER_AREA);
+    bool cut = false;
+    if (!previous_thumbnail.empty()) {
+        cut = cv::norm(thumbnail, previous_thumbnail, cv::NORM_L1) / thumbnail.total() > CUT_THRESHOLD;
+    }
+    previous_thumbnail = thumbnail;
+    if (cut) {
+        ++scene_cuts;
+    }
+    return cut;
+}
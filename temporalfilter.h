@@ -0,0 +1,41 @@
+#ifndef TEMPORALFILTER_H
+#define TEMPORALFILTER_H
+
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+/**
+ * Streaming temporal stabilization of disparity maps, to remove the frame to frame flicker of independent matching.
+ * The last few disparity maps and their guide (left eye gray) frames are kept in a ring buffer. Each output pixel is a
+ * weighted average of the same pixel over the window, where older frames count less, and a frame only counts where its guide
+ * intensity matches the current one (so moving edges aren't smeared) and its disparity is close to the current one.
+ * The history is dropped at scene cuts and whenever frames stop being consecutive, and memory stays bounded by the window.
+ */
+class TemporalFilter
+{
+public:
+    TemporalFilter(float sigma_range = 10.0f, float decay = 0.75f, int max_jump = 2);
+
+    void configure(int window);
+    void reset();
+    bool is_enabled() const;
+    size_t get_scene_cuts() const;
+
+    void filter(const cv::Mat& disparity, const cv::Mat& guide, short invalid, cv::Mat& filtered);
+private:
+    bool is_scene_cut(const cv::Mat& guide);
+
+    int window;
+    float sigma_range, decay;
+    int max_jump;
+
+    //ring buffer of the most recent frames, newest at head
+    std::vector<cv::Mat> disparities, guides;
+    size_t head, count;
+
+    cv::Mat previous_thumbnail;
+    size_t scene_cuts;
+};
+
+#endif // TEMPORALFILTER_H
@@ -0,0 +1,217 @@
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "tracer.h"
+
+namespace {
+
+//events a buffer reserves on its first append; it grows geometrically from there
+const size_t TRACE_RESERVE = 512;
+//events a buffer keeps, at most: the newest ones, about 2 MB per track, so a trace left on for a long run stays bounded
+const size_t TRACE_CAPACITY = 65536;
+
+/**
+ * One complete span.
+ */
+struct TraceEvent {
+    const char* name;
+    int64_t start; //nanoseconds since the trace started
+    int64_t end;
+    int64_t frame; //-1 if the span isn't about one frame
+};
+
+/**
+ * The spans of one track, a ring of the newest TRACE_CAPACITY. Only the thread holding it appends to it.
+ */
+struct ThreadBuffer {
+    int id;
+    std::string name;
+    std::vector<TraceEvent> events;
+    size_t recorded; //spans ever appended; once over the capacity, the oldest is at recorded % TRACE_CAPACITY
+    bool in_use;     //held by a running thread
+};
+
+std::mutex g_trace_mutex; //guards the registry and the in_use flags, not the events
+std::vector<std::unique_ptr<ThreadBuffer> > g_trace_buffers;
+std::string g_trace_filename;
+std::chrono::steady_clock::time_point g_trace_epoch;
+
+/**
+ * A thread's hold on its buffer, given back when the thread exits. Buffers outlive their threads until the trace is written,
+ * and a later thread of the same name takes over a free one, so short-lived threads started per frame share one track per
+ * role instead of adding a track (and a buffer) every frame.
+ */
+struct BufferLease {
+    ThreadBuffer* buffer = 0;
+
+    ~BufferLease() {
+        if (buffer) {
+            std::lock_guard<std::mutex> lock(g_trace_mutex);
+            buffer->in_use = false;
+        }
+    }
+};
+
+thread_local BufferLease t_trace_lease;
+
+/**
+ * Take a free buffer of the given name, or register a new one. The caller holds g_trace_mutex.
+ * @param name The track's name, empty for unnamed threads.
+ * @return The buffer, now in use.
+ */
+ThreadBuffer* acquire_buffer(const std::string& name) {
+    for (const std::unique_ptr<ThreadBuffer>& buffer : g_trace_buffers) {
+        if (!buffer->in_use && buffer->name == name) {
+            buffer->in_use = true;
+            return buffer.get();
+        }
+    }
+    g_trace_buffers.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+    ThreadBuffer* buffer = g_trace_buffers.back().get();
+    buffer->id = (int)g_trace_buffers.size();
+    buffer->name = name;
+    buffer->recorded = 0;
+    buffer->in_use = true;
+    return buffer;
+}
+
+/**
+ * @return The calling thread's buffer, taken on first use.
+ */
+ThreadBuffer& thread_buffer() {
+    if (!t_trace_lease.buffer) {
+        std::lock_guard<std::mutex> lock(g_trace_mutex);
+        t_trace_lease.buffer = acquire_buffer("");
+    }
+    return *t_trace_lease.buffer;
+}
+
+/**
+ * Write a string as a JSON string literal.
+ */
+void write_json_string(std::FILE* file, const std::string& text) {
+    std::fputc('"', file);
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            std::fputc('\\', file);
+        }
+        std::fputc((unsigned char)c < 0x20 ? ' ' : c, file);
+    }
+    std::fputc('"', file);
+}
+
+}
+
+std::atomic<bool> Tracer::enabled(false);
+
+/**
+ * Start recording. The trace is written by stop().
+ * @param filename The JSON file to write.
+ */
+void Tracer::start(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(g_trace_mutex);
+    g_trace_filename = filename;
+    g_trace_epoch = std::chrono::steady_clock::now();
+    enabled.store(true);
+}
+
+/**
+ * Stop recording and write the trace. Does nothing if tracing wasn't started.
+ * Throws std::runtime_error if the trace file can't be written.
+ */
+void Tracer::stop() {
+    if (!enabled.exchange(false)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(g_trace_mutex);
+    std::FILE* file = std::fopen(g_trace_filename.c_str(), "w");
+    if (!file) {
+        throw std::runtime_error("Error: trace file [" + g_trace_filename + "] cannot be opened for writing");
+    }
+
+    std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (const std::unique_ptr<ThreadBuffer>& buffer : g_trace_buffers) {
+        std::string thread_name = buffer->name.empty() ? "thread " + std::to_string(buffer->id) : buffer->name;
+        std::fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", first ? "" : ",\n", buffer->id);
+        write_json_string(file, thread_name);
+        std::fprintf(file, "}}");
+        first = false;
+
+        //oldest first: a full ring starts where the next span would have gone
+        size_t count = buffer->events.size();
+        size_t oldest = buffer->recorded > count ? buffer->recorded % count : 0;
+        for (size_t position = 0; position < count; ++position) {
+            const TraceEvent& event = buffer->events[(oldest + position) % count];
+            std::fprintf(file, ",\n{\"ph\":\"X\",\"cat\":\"pipeline\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":",
+                         buffer->id, event.start / 1000.0, (event.end - event.start) / 1000.0);
+            write_json_string(file, event.name);
+            if (event.frame >= 0) {
+                std::fprintf(file, ",\"args\":{\"frame\":%lld}", (long long)event.frame);
+            }
+            std::fprintf(file, "}");
+        }
+    }
+    std::fprintf(file, "\n]}\n");
+    bool written = !std::ferror(file);
+    written = std::fclose(file) == 0 && written;
+    if (!written) {
+        throw std::runtime_error("Error: trace file [" + g_trace_filename + "] could not be written");
+    }
+}
+
+/**
+ * Name the calling thread in the trace.
+ * @param name The name shown for the thread's track.
+ */
+void Tracer::name_thread(const std::string& name) {
+    if (!is_enabled()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(g_trace_mutex);
+    ThreadBuffer*& buffer = t_trace_lease.buffer;
+    if (!buffer) {
+        buffer = acquire_buffer(name);
+    } else if (buffer->name != name) {
+        //a thread that hasn't recorded anything yet can still move to its role's track
+        if (buffer->events.empty()) {
+            buffer->in_use = false;
+            buffer = acquire_buffer(name);
+        } else {
+            buffer->name = name;
+        }
+    }
+}
+
+/**
+ * @return Nanoseconds since the trace started.
+ */
+int64_t Tracer::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_trace_epoch).count();
+}
+
+/**
+ * Append a span to the calling thread's buffer. Once the buffer is full, the span replaces the oldest one.
+ * @param name The span's name, a string literal.
+ * @param start The span's start, from now().
+ * @param end The span's end, from now().
+ * @param frame The frame the span worked on, -1 for none.
+ */
+void Tracer::record(const char* name, int64_t start, int64_t end, int64_t frame) {
+    TraceEvent event = {name, start, end, frame};
+    ThreadBuffer& buffer = thread_buffer();
+    std::vector<TraceEvent>& events = buffer.events;
+    if (events.capacity() == 0) {
+        events.reserve(TRACE_RESERVE);
+    }
+    if (events.size() < TRACE_CAPACITY) {
+        events.push_back(event);
+    } else {
+        events[buffer.recorded % TRACE_CAPACITY] = event;
+    }
+    ++buffer.recorded;
+}
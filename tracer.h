@@ -0,0 +1,50 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * Records timed spans of the pipeline stages on every thread, and writes them as Chrome trace-event JSON
+ * (open in Perfetto or chrome://tracing) to see where frames stall between stages.
+ * Each thread appends to its own buffer, so recording takes no locks: only a thread's first span registers its buffer.
+ * A buffer keeps the newest 65536 spans of its track, so memory stays bounded however long tracing is left on.
+ * When tracing is off, a span costs one relaxed atomic load.
+ * stop() reads every buffer, so it must only be called once the traced threads have finished.
+ */
+class Tracer
+{
+public:
+    static void start(const std::string& filename);
+    static void stop();
+    static bool is_enabled() {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    static void name_thread(const std::string& name);
+    static int64_t now();
+    static void record(const char* name, int64_t start, int64_t end, int64_t frame);
+private:
+    static std::atomic<bool> enabled;
+};
+
+/**
+ * Times its own lifetime as one span of the trace. Names must be string literals (they are kept as pointers).
+ */
+class TraceSpan
+{
+public:
+    TraceSpan(const char* name, int64_t frame = -1) : name(name), frame(frame), start(Tracer::is_enabled() ? Tracer::now() : -1) {}
+    ~TraceSpan() {
+        if (start >= 0 && Tracer::is_enabled()) {
+            Tracer::record(name, start, Tracer::now(), frame);
+        }
+    }
+private:
+    const char* name;
+    int64_t frame;
+    int64_t start;
+};
+
+#endif // TRACER_H
@@ -0,0 +1,119 @@
+#include <cmath>
+#include <vector>
+
+#include "upsampler.h"
+
+namespace {
+
+/**
+ * Upsamples a band of output rows.
+ */
+class UpsampleBody : public cv::ParallelLoopBody
+{
+public:
+    UpsampleBody(const cv::Mat& low_disparity, short low_invalid, const cv::Mat& low_guide, const cv::Mat& guide,
+                 double disparity_scale, short invalid, int radius, double sigma_spatial, const float* range_weights, cv::Mat& disparity)
+        : low_disparity(low_disparity), low_invalid(low_invalid), low_guide(low_guide), guide(guide),
+          disparity_scale(disparity_scale), invalid(invalid), radius(radius), sigma_spatial(sigma_spatial),
+          range_weights(range_weights), disparity(disparity) {}
+
+    void operator()(const cv::Range& range) const {
+        const int taps = 2 * radius;
+        const double scale_x = (double)low_disparity.cols / guide.cols;
+        const double scale_y = (double)low_disparity.rows / guide.rows;
+        const double spatial_factor = -0.5 / (sigma_spatial * sigma_spatial);
+
+        //horizontal taps and spatial weights only depend on the column, so they are shared by every row in the band
+        std::vector<int> tap_x(guide.cols * taps);
+        std::vector<float> weight_x(guide.cols * taps);
+        for (int x = 0; x < guide.cols; ++x) {
+            double lx = (x + 0.5) * scale_x - 0.5;
+            int first = (int)std::floor(lx) - radius + 1;
+            for (int t = 0; t < taps; ++t) {
+                double distance = first + t - lx;
+                tap_x[x * taps + t] = std::min(std::max(first + t, 0), low_disparity.cols - 1);
+                weight_x[x * taps + t] = (float)std::exp(spatial_factor * distance * distance);
+            }
+        }
+
+        std::vector<int> tap_y(taps);
+        std::vector<float> weight_y(taps);
+        for (int y = range.start; y < range.end; ++y) {
+            double ly = (y + 0.5) * scale_y - 0.5;
+            int first = (int)std::floor(ly) - radius + 1;
+            for (int t = 0; t < taps; ++t) {
+                double distance = first + t - ly;
+                tap_y[t] = std::min(std::max(first + t, 0), low_disparity.rows - 1);
+                weight_y[t] = (float)std::exp(spatial_factor * distance * distance);
+            }
+
+            const uchar* guide_row = guide.ptr<uchar>(y);
+            short* output = disparity.ptr<short>(y);
+            for (int x = 0; x < guide.cols; ++x) {
+                const int centre = guide_row[x];
+                const int* columns = &tap_x[x * taps];
+                const float* column_weights = &weight_x[x * taps];
+                float weight_sum = 0, value_sum = 0;
+                for (int ty = 0; ty < taps; ++ty) {
+                    const short* low_row = low_disparity.ptr<short>(tap_y[ty]);
+                    const uchar* low_guide_row = low_guide.ptr<uchar>(tap_y[ty]);
+                    for (int tx = 0; tx < taps; ++tx) {
+                        short value = low_row[columns[tx]];
+                        if (value == low_invalid) {
+                            continue;
+                        }
+                        float weight = weight_y[ty] * column_weights[tx] * range_weights[std::abs(centre - low_guide_row[columns[tx]])];
+                        weight_sum += weight;
+                        value_sum += weight * value;
+                    }
+                }
+                output[x] = weight_sum > 1e-6f ? cv::saturate_cast<short>(value_sum / weight_sum * disparity_scale) : invalid;
+            }
+        }
+    }
+private:
+    const cv::Mat& low_disparity;
+    short low_invalid;
+    const cv::Mat& low_guide;
+    const cv::Mat& guide;
+    double disparity_scale;
+    short invalid;
+    int radius;
+    double sigma_spatial;
+    const float* range_weights;
+    cv::Mat& disparity;
+};
+
+}
+
+/**
+ * Constructor.
+ * @param radius Half the number of low resolution taps used in each direction.
+ * @param sigma_spatial Spatial standard deviation, in low resolution pixels.
+ * @param sigma_range Intensity standard deviation, in 8-bit gray levels.
+ */
+Upsampler::Upsampler(int radius, double sigma_spatial, double sigma_range)
+    : radius(std::max(1, radius)), sigma_spatial(sigma_spatial)
+{
+    for (int difference = 0; difference < 256; ++difference) {
+        range_weights[difference] = (float)std::exp(-0.5 * difference * difference / (sigma_range * sigma_range));
+    }
+}
+
+/**
+ * Upsample a disparity map to the guide's size.
+ * @param low_disparity The CV_16SC1 disparity map computed at low resolution.
+ * @param low_invalid The value marking invalid pixels in low_disparity.
+ * @param low_guide The 8-bit gray left eye at low_disparity's size.
+ * @param guide The 8-bit gray left eye at the output size.
+ * @param disparity_scale Factor to apply to the disparity values (output width / low resolution width).
+ * @param invalid The value to mark invalid output pixels with.
+ * @param disparity Receives the CV_16SC1 disparity map at the guide's size.
+ */
+void Upsampler::upsample(const cv::Mat& low_disparity, short low_invalid, const cv::Mat& low_guide, const cv::Mat& guide,
+                         double disparity_scale, short invalid, cv::Mat& disparity) const {
+    disparity.create(guide.size(), CV_16SC1);
+    cv::parallel_for_(cv::Range(0, guide.rows),
+                      UpsampleBody(low_disparity, low_invalid, low_guide, guide, disparity_scale, invalid,
+                                   radius, sigma_spatial, range_weights, disparity));
+}
@@ -0,0 +1,25 @@
+#ifndef UPSAMPLER_H
+#define UPSAMPLER_H
+
+#include "opencv2/core/core.hpp"
+
+/**
+ * Edge-aware joint bilateral upsampling of a low resolution disparity map, guided by the full resolution left eye.
+ * Each output pixel averages the nearby low resolution disparities, weighted by spatial distance and by how closely the guide's
+ * intensity matches, so depth edges follow image edges instead of being blurred by plain interpolation.
+ * Invalid low resolution disparities are ignored, and pixels without any valid neighbour stay invalid.
+ */
+class Upsampler
+{
+public:
+    Upsampler(int radius = 2, double sigma_spatial = 1.0, double sigma_range = 12.0);
+
+    void upsample(const cv::Mat& low_disparity, short low_invalid, const cv::Mat& low_guide, const cv::Mat& guide,
+                  double disparity_scale, short invalid, cv::Mat& disparity) const;
+private:
+    int radius;
+    double sigma_spatial;
+    float range_weights[256];
+};
+
+#endif // UPSAMPLER_H